@@ -0,0 +1,918 @@
+/*
+ * archive.c
+ *
+ * Reading of slot state from a tar archive of a data directory, such as
+ * the base.tar written by pg_basebackup, without extracting it.
+ *
+ * The archive is read in a single sequential pass, decompressing it on
+ * the fly if it is compressed with gzip, LZ4 or Zstandard (detected from
+ * its first bytes, not its name).  Only the PG_VERSION and
+ * pg_replslot/<slot>/state members are read; every other member is
+ * skipped using the size in its tar header, with lseek() if the archive
+ * is uncompressed, so the cost of an uncompressed archive is roughly one
+ * read per member header however large the data files are.
+ *
+ * The state files are kept in memory, to be validated and decoded just
+ * like those read from a data directory.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "pg_replslot_reader.h"
+
+/* after pg_config.h, which says which compression libraries are available */
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#define ARCHIVE_BUFSIZE		65536
+#define TAR_BLOCK_SIZE		512
+
+/* largest pax extended header whose "path" is looked for */
+#define MAX_PAX_HEADER_SIZE	65536
+
+/* fields of a ustar header */
+#define TAR_NAME_OFFSET		0
+#define TAR_NAME_LEN		100
+#define TAR_SIZE_OFFSET		124
+#define TAR_SIZE_LEN		12
+#define TAR_CHKSUM_OFFSET	148
+#define TAR_CHKSUM_LEN		8
+#define TAR_TYPE_OFFSET		156
+#define TAR_MAGIC_OFFSET	257
+#define TAR_PREFIX_OFFSET	345
+#define TAR_PREFIX_LEN		155
+
+#define TarPadding(size)	((TAR_BLOCK_SIZE - (size) % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE)
+
+typedef enum ArchiveCompression
+{
+	COMPRESSION_NONE,
+	COMPRESSION_GZIP,
+	COMPRESSION_LZ4,
+	COMPRESSION_ZSTD
+} ArchiveCompression;
+
+/*
+ * The decompressed contents of an archive, read sequentially; "in" holds
+ * data read from the file but not yet consumed.
+ */
+typedef struct ArchiveStream
+{
+	const char *path;
+	int			fd;
+	bool		seekable;
+	off_t		file_size;		/* if seekable */
+	ArchiveCompression compression;
+	char	   *in;
+	size_t		in_len;
+	size_t		in_pos;
+	bool		in_eof;
+	char	   *scratch;		/* for data skipped by decompressing it */
+#ifdef HAVE_LIBZ
+	z_stream	zs;
+#endif
+#ifdef USE_LZ4
+	LZ4F_dctx  *lz4;
+#endif
+#ifdef USE_ZSTD
+	ZSTD_DStream *zstd;
+#endif
+} ArchiveStream;
+
+static bool StreamOpen(ArchiveStream *stream, int fd, const char *path);
+static bool StreamFill(ArchiveStream *stream);
+static ssize_t StreamRead(ArchiveStream *stream, char *dst, size_t len);
+static bool StreamSkip(ArchiveStream *stream, uint64 len);
+static bool Decompress(ArchiveStream *stream, char *dst, size_t len,
+					   size_t *produced, size_t *consumed);
+static bool StreamDrain(ArchiveStream *stream);
+static void StreamClose(ArchiveStream *stream);
+static bool ReadMember(ArchiveStream *stream, char *dst, size_t keep, uint64 size,
+					   ssize_t *kept);
+static bool TarChecksumValid(const char *header);
+static uint64 TarNumber(const char *field, int len);
+static void TarMemberName(const char *header, char *name);
+static bool ParsePaxPath(const char *data, size_t len, char *name);
+static bool IsSlotStatePath(const char *path, char *slot_name);
+static bool IsPgVersionPath(const char *path, int *depth);
+static ArchivedSlot *AddArchivedSlot(SlotArchive *archive, const char *slot_name);
+
+
+/*
+ * Read the PG_VERSION and slot state files of the data directory in the
+ * tar archive "path"; returns NULL, having reported why, on failure.
+ *
+ * If the archive holds several PG_VERSION files, as there is one in each
+ * database's directory, the one nearest the top is used.
+ */
+SlotArchive *
+ReadSlotArchive(const char *path)
+{
+	int			fd = open(path, O_RDONLY | PG_BINARY, 0);
+
+	if (fd < 0)
+	{
+		fprintf(stderr, "Unable to open archive \"%s\": %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	return ReadSlotArchiveFd(fd, path);
+}
+
+
+/*
+ * As ReadSlotArchive(), but reading the archive from "fd", which need not
+ * be seekable and is closed; "path" names it in messages.
+ */
+SlotArchive *
+ReadSlotArchiveFd(int fd, const char *path)
+{
+	ArchiveStream stream;
+	SlotArchive *archive;
+	char		header[TAR_BLOCK_SIZE];
+	char		member_path[MAXPGPATH];
+	char		long_name[MAXPGPATH];
+	bool		have_long_name = false;
+	int			pg_version_depth = INT_MAX;
+	bool		first = true;
+
+	if (!StreamOpen(&stream, fd, path))
+		return NULL;
+
+	archive = pg_malloc0(sizeof(SlotArchive));
+	archive->by_name = NameHashCreate(64);
+
+	for (;;)
+	{
+		ssize_t		n = StreamRead(&stream, header, TAR_BLOCK_SIZE);
+		uint64		size;
+		char		type;
+		const char *name;
+		char		slot_name[NAMEDATALEN];
+		int			depth;
+
+		if (n < 0)
+			goto fail;
+
+		/* tolerate a missing end-of-archive marker, as GNU tar does */
+		if (n == 0 && !first)
+			break;
+
+		if (n < TAR_BLOCK_SIZE)
+		{
+			if (first)
+				fprintf(stderr, "\"%s\" is not a tar archive\n", path);
+			else
+				fprintf(stderr, "Archive \"%s\" is truncated\n", path);
+			goto fail;
+		}
+
+		/* the end of the archive is marked by zeroed blocks */
+		if (header[0] == '\0' && memcmp(header, header + 1, TAR_BLOCK_SIZE - 1) == 0)
+			break;
+
+		if (!TarChecksumValid(header))
+		{
+			if (first)
+				fprintf(stderr, "\"%s\" is not a tar archive\n", path);
+			else
+				fprintf(stderr, "Archive \"%s\" has a corrupt member header\n", path);
+			goto fail;
+		}
+
+		first = false;
+
+		size = TarNumber(header + TAR_SIZE_OFFSET, TAR_SIZE_LEN);
+		type = header[TAR_TYPE_OFFSET];
+
+		if (type == 'L' || type == 'x')
+		{
+			/* a GNU long name or pax header gives the next member's name */
+			char	   *data;
+			size_t		keep = type == 'L' ? MAXPGPATH - 1 : MAX_PAX_HEADER_SIZE;
+			ssize_t		kept;
+
+			data = pg_malloc(Min(size, keep) + 1);
+
+			if (!ReadMember(&stream, data, keep, size, &kept))
+			{
+				pg_free(data);
+				goto fail;
+			}
+
+			data[kept] = '\0';
+
+			if (type == 'L')
+			{
+				strlcpy(long_name, data, MAXPGPATH);
+				have_long_name = true;
+			}
+			else if ((uint64) kept == size && ParsePaxPath(data, kept, long_name))
+				have_long_name = true;
+
+			pg_free(data);
+			continue;
+		}
+
+		if (type != '0' && type != '\0' && type != '7')
+		{
+			/* directories, links and the like; also pax global headers */
+			if (!StreamSkip(&stream, size + TarPadding(size)))
+				goto fail;
+			continue;
+		}
+
+		if (have_long_name)
+		{
+			strlcpy(member_path, long_name, MAXPGPATH);
+			have_long_name = false;
+		}
+		else
+			TarMemberName(header, member_path);
+
+		name = member_path;
+		while (name[0] == '/' || (name[0] == '.' && name[1] == '/'))
+			name += name[0] == '/' ? 1 : 2;
+
+		if (IsSlotStatePath(name, slot_name))
+		{
+			ArchivedSlot *slot = AddArchivedSlot(archive, slot_name);
+
+			memset(&slot->buf, 0, sizeof(ReplslotStateBuf));
+
+			if (!ReadMember(&stream, slot->buf.data, sizeof(ReplslotStateBuf),
+							size, &slot->len))
+				goto fail;
+		}
+		else if (IsPgVersionPath(name, &depth) && depth < pg_version_depth)
+		{
+			char		version[32];
+			ssize_t		kept;
+
+			if (!ReadMember(&stream, version, sizeof(version) - 1, size, &kept))
+				goto fail;
+
+			version[kept] = '\0';
+
+			if (archive->pg_version != NULL)
+				pg_free(archive->pg_version);
+			archive->pg_version = pg_strdup(version);
+			pg_version_depth = depth;
+		}
+		else if (!StreamSkip(&stream, size + TarPadding(size)))
+			goto fail;
+	}
+
+	if (!StreamDrain(&stream))
+		goto fail;
+
+	StreamClose(&stream);
+
+	return archive;
+
+fail:
+	StreamClose(&stream);
+	FreeSlotArchive(archive);
+
+	return NULL;
+}
+
+
+/*
+ * The archived state file of slot directory "slot_name", if there is one.
+ */
+const ArchivedSlot *
+SlotArchiveLookup(const SlotArchive *archive, const char *slot_name)
+{
+	int			slot_num = NameHashLookup(archive->by_name, slot_name);
+
+	return slot_num < 0 ? NULL : &archive->slots[slot_num];
+}
+
+
+void
+FreeSlotArchive(SlotArchive *archive)
+{
+	int			i;
+
+	for (i = 0; i < archive->slot_cnt; i++)
+		pg_free(archive->slots[i].slot_name);
+
+	if (archive->pg_version != NULL)
+		pg_free(archive->pg_version);
+	if (archive->slots != NULL)
+		pg_free(archive->slots);
+	NameHashFree(archive->by_name);
+	pg_free(archive);
+}
+
+
+/*
+ * Add the slot directory "slot_name"; a later member for the same slot,
+ * as tar appends, replaces an earlier one.
+ */
+static ArchivedSlot *
+AddArchivedSlot(SlotArchive *archive, const char *slot_name)
+{
+	int			slot_num = NameHashLookup(archive->by_name, slot_name);
+	ArchivedSlot *slot;
+
+	if (slot_num >= 0)
+		return &archive->slots[slot_num];
+
+	if (archive->slot_cnt == archive->slots_size)
+	{
+		archive->slots_size = Max(archive->slots_size * 2, 64);
+		archive->slots = pg_realloc(archive->slots,
+									archive->slots_size * sizeof(ArchivedSlot));
+	}
+
+	slot = &archive->slots[archive->slot_cnt];
+	slot->slot_name = pg_strdup(slot_name);
+
+	/* the name is allocated separately, so stays put as the array grows */
+	NameHashInsert(archive->by_name, slot->slot_name, archive->slot_cnt);
+
+	archive->slot_cnt++;
+
+	return slot;
+}
+
+
+/*
+ * Read up to "keep" bytes of a member of "size" bytes into "dst", setting
+ * "*kept" to the number read, and skip the rest of it and its padding.
+ */
+static bool
+ReadMember(ArchiveStream *stream, char *dst, size_t keep, uint64 size,
+		   ssize_t *kept)
+{
+	size_t		len = (size_t) Min((uint64) keep, size);
+	ssize_t		n = StreamRead(stream, dst, len);
+
+	if (n < 0)
+		return false;
+
+	if ((size_t) n < len)
+	{
+		fprintf(stderr, "Archive \"%s\" is truncated\n", stream->path);
+		return false;
+	}
+
+	*kept = n;
+
+	return StreamSkip(stream, size - len + TarPadding(size));
+}
+
+
+/*
+ * A "pg_replslot/<slot>/state" member, at the top of the archive or
+ * below a leading directory; sets "slot_name" to the slot directory.
+ */
+static bool
+IsSlotStatePath(const char *path, char *slot_name)
+{
+	const char *p;
+
+	for (p = path; (p = strstr(p, "pg_replslot/")) != NULL; p++)
+	{
+		const char *name = p + strlen("pg_replslot/");
+		const char *slash = strchr(name, '/');
+
+		if (p != path && p[-1] != '/')
+			continue;
+
+		if (slash == NULL || slash == name || slash - name >= NAMEDATALEN ||
+			strcmp(slash, "/state") != 0)
+			continue;
+
+		memcpy(slot_name, name, slash - name);
+		slot_name[slash - name] = '\0';
+
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * A PG_VERSION member; sets "depth" to the number of directories it is
+ * below the top of the archive.
+ */
+static bool
+IsPgVersionPath(const char *path, int *depth)
+{
+	const char *base = strrchr(path, '/');
+	const char *p;
+
+	base = base == NULL ? path : base + 1;
+
+	if (strcmp(base, "PG_VERSION") != 0)
+		return false;
+
+	*depth = 0;
+	for (p = path; p < base; p++)
+	{
+		if (*p == '/')
+			(*depth)++;
+	}
+
+	return true;
+}
+
+
+/*
+ * The header's checksum is the sum of its bytes, with the checksum field
+ * itself taken as spaces.
+ */
+static bool
+TarChecksumValid(const char *header)
+{
+	uint64		sum = 0;
+	int			i;
+
+	for (i = 0; i < TAR_BLOCK_SIZE; i++)
+	{
+		if (i >= TAR_CHKSUM_OFFSET && i < TAR_CHKSUM_OFFSET + TAR_CHKSUM_LEN)
+			sum += ' ';
+		else
+			sum += (unsigned char) header[i];
+	}
+
+	return sum == TarNumber(header + TAR_CHKSUM_OFFSET, TAR_CHKSUM_LEN);
+}
+
+
+/*
+ * A numeric header field: octal digits, or for sizes too large for them,
+ * big-endian base-256 flagged by the high bit of the first byte.
+ */
+static uint64
+TarNumber(const char *field, int len)
+{
+	uint64		value = 0;
+	int			i;
+
+	if ((unsigned char) field[0] & 0x80)
+	{
+		value = (unsigned char) field[0] & 0x7F;
+		for (i = 1; i < len; i++)
+			value = (value << 8) | (unsigned char) field[i];
+		return value;
+	}
+
+	for (i = 0; i < len && field[i] == ' '; i++)
+		;
+
+	for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+		value = (value << 3) | (field[i] - '0');
+
+	return value;
+}
+
+
+/*
+ * The member's name from a ustar header, which may be split between the
+ * prefix and name fields; neither need be terminated.
+ */
+static void
+TarMemberName(const char *header, char *name)
+{
+	size_t		prefix_len = 0;
+	size_t		name_len = strnlen(header + TAR_NAME_OFFSET, TAR_NAME_LEN);
+
+	if (memcmp(header + TAR_MAGIC_OFFSET, "ustar", 5) == 0)
+		prefix_len = strnlen(header + TAR_PREFIX_OFFSET, TAR_PREFIX_LEN);
+
+	if (prefix_len > 0)
+	{
+		memcpy(name, header + TAR_PREFIX_OFFSET, prefix_len);
+		name[prefix_len++] = '/';
+	}
+
+	memcpy(name + prefix_len, header + TAR_NAME_OFFSET, name_len);
+	name[prefix_len + name_len] = '\0';
+}
+
+
+/*
+ * Find the "path" record of a pax extended header, made up of records of
+ * the form "<length> <keyword>=<value>\n".
+ */
+static bool
+ParsePaxPath(const char *data, size_t len, char *name)
+{
+	size_t		pos = 0;
+
+	while (pos < len)
+	{
+		const char *record = data + pos;
+		char	   *endptr;
+		unsigned long record_len = strtoul(record, &endptr, 10);
+
+		if (endptr == record || *endptr != ' ' || record_len == 0 ||
+			record_len > len - pos)
+			return false;
+
+		if (strncmp(endptr + 1, "path=", 5) == 0)
+		{
+			const char *value = endptr + 6;
+			size_t		value_len = record + record_len - 1 - value;
+
+			if (value > record + record_len - 1 || value_len >= MAXPGPATH)
+				return false;
+
+			memcpy(name, value, value_len);
+			name[value_len] = '\0';
+			return true;
+		}
+
+		pos += record_len;
+	}
+
+	return false;
+}
+
+
+/*
+ * Start reading the archive "path" from "fd", and detect how it is
+ * compressed from its first bytes; "fd" is closed on failure.
+ */
+static bool
+StreamOpen(ArchiveStream *stream, int fd, const char *path)
+{
+	const unsigned char *magic;
+	struct stat statbuf;
+
+	memset(stream, 0, sizeof(ArchiveStream));
+
+	stream->path = path;
+	stream->fd = fd;
+
+	if (fstat(stream->fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode))
+	{
+		stream->seekable = true;
+		stream->file_size = statbuf.st_size;
+	}
+	stream->in = pg_malloc(ARCHIVE_BUFSIZE);
+
+	if (!StreamFill(stream))
+	{
+		StreamClose(stream);
+		return false;
+	}
+
+	magic = (const unsigned char *) stream->in;
+
+	if (stream->in_len >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+		stream->compression = COMPRESSION_GZIP;
+	else if (stream->in_len >= 4 && magic[0] == 0x04 && magic[1] == 0x22 &&
+			 magic[2] == 0x4D && magic[3] == 0x18)
+		stream->compression = COMPRESSION_LZ4;
+	else if (stream->in_len >= 4 && magic[0] == 0x28 && magic[1] == 0xB5 &&
+			 magic[2] == 0x2F && magic[3] == 0xFD)
+		stream->compression = COMPRESSION_ZSTD;
+	else
+		return true;
+
+	switch (stream->compression)
+	{
+		case COMPRESSION_NONE:
+			break;
+		case COMPRESSION_GZIP:
+#ifdef HAVE_LIBZ
+			/* 32 added to the window size accepts a gzip header */
+			if (inflateInit2(&stream->zs, 15 + 32) == Z_OK)
+				return true;
+			fprintf(stderr, "Unable to initialize gzip decompression\n");
+#else
+			fprintf(stderr, "Archive \"%s\" is compressed with gzip, which this build does not support\n", path);
+#endif
+			break;
+		case COMPRESSION_LZ4:
+#ifdef USE_LZ4
+			if (!LZ4F_isError(LZ4F_createDecompressionContext(&stream->lz4, LZ4F_VERSION)))
+				return true;
+			stream->lz4 = NULL;
+			fprintf(stderr, "Unable to initialize LZ4 decompression\n");
+#else
+			fprintf(stderr, "Archive \"%s\" is compressed with LZ4, which this build does not support\n", path);
+#endif
+			break;
+		case COMPRESSION_ZSTD:
+#ifdef USE_ZSTD
+			stream->zstd = ZSTD_createDStream();
+			if (stream->zstd != NULL)
+				return true;
+			fprintf(stderr, "Unable to initialize Zstandard decompression\n");
+#else
+			fprintf(stderr, "Archive \"%s\" is compressed with Zstandard, which this build does not support\n", path);
+#endif
+			break;
+	}
+
+	/* only initialized decompressors are cleaned up */
+	stream->compression = COMPRESSION_NONE;
+	StreamClose(stream);
+
+	return false;
+}
+
+
+/*
+ * Read more of the file once everything buffered has been consumed.
+ */
+static bool
+StreamFill(ArchiveStream *stream)
+{
+	ssize_t		ret;
+
+	do
+	{
+		ret = read(stream->fd, stream->in, ARCHIVE_BUFSIZE);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+	{
+		fprintf(stderr, "Unable to read archive \"%s\": %s\n",
+				stream->path, strerror(errno));
+		return false;
+	}
+
+	stream->in_len = ret;
+	stream->in_pos = 0;
+	stream->in_eof = ret == 0;
+
+	return true;
+}
+
+
+/*
+ * Read "len" bytes of the decompressed archive into "dst"; returns the
+ * number read, which is less only at the end of the archive, or -1 on
+ * error.
+ */
+static ssize_t
+StreamRead(ArchiveStream *stream, char *dst, size_t len)
+{
+	size_t		done = 0;
+
+	while (done < len)
+	{
+		size_t		produced;
+		size_t		consumed;
+
+		if (stream->in_pos == stream->in_len && !stream->in_eof &&
+			!StreamFill(stream))
+			return -1;
+
+		if (stream->compression == COMPRESSION_NONE)
+		{
+			produced = Min(len - done, stream->in_len - stream->in_pos);
+
+			if (produced == 0)
+				break;
+
+			memcpy(dst + done, stream->in + stream->in_pos, produced);
+			stream->in_pos += produced;
+			done += produced;
+			continue;
+		}
+
+		if (!Decompress(stream, dst + done, len - done, &produced, &consumed))
+			return -1;
+
+		done += produced;
+
+		if (produced == 0 && consumed == 0 && stream->in_eof)
+			break;
+	}
+
+	return done;
+}
+
+
+/*
+ * Skip "len" bytes of the decompressed archive; an uncompressed archive
+ * is seeked through where possible.
+ */
+static bool
+StreamSkip(ArchiveStream *stream, uint64 len)
+{
+	if (stream->compression == COMPRESSION_NONE && stream->seekable)
+	{
+		off_t		offset;
+		size_t		buffered = (size_t) Min(len, (uint64) (stream->in_len - stream->in_pos));
+
+		stream->in_pos += buffered;
+		len -= buffered;
+
+		if (len == 0)
+			return true;
+
+		offset = lseek(stream->fd, (off_t) len, SEEK_CUR);
+
+		if (offset < 0)
+		{
+			fprintf(stderr, "Unable to seek in archive \"%s\": %s\n",
+					stream->path, strerror(errno));
+			return false;
+		}
+
+		/* seeking past the end isn't an error in itself */
+		if (offset > stream->file_size)
+		{
+			fprintf(stderr, "Archive \"%s\" is truncated\n", stream->path);
+			return false;
+		}
+
+		return true;
+	}
+
+	if (stream->scratch == NULL)
+		stream->scratch = pg_malloc(ARCHIVE_BUFSIZE);
+
+	while (len > 0)
+	{
+		size_t		chunk = (size_t) Min(len, (uint64) ARCHIVE_BUFSIZE);
+		ssize_t		n = StreamRead(stream, stream->scratch, chunk);
+
+		if (n < 0)
+			return false;
+
+		if ((size_t) n < chunk)
+		{
+			fprintf(stderr, "Archive \"%s\" is truncated\n", stream->path);
+			return false;
+		}
+
+		len -= n;
+	}
+
+	return true;
+}
+
+
+/*
+ * Decompress as much of the buffered input into "dst" as it has room for.
+ */
+static bool
+Decompress(ArchiveStream *stream, char *dst, size_t len,
+		   size_t *produced, size_t *consumed)
+{
+	size_t		avail = stream->in_len - stream->in_pos;
+	char	   *src = stream->in + stream->in_pos;
+
+	*produced = 0;
+	*consumed = 0;
+
+	switch (stream->compression)
+	{
+		case COMPRESSION_NONE:
+			break;
+		case COMPRESSION_GZIP:
+#ifdef HAVE_LIBZ
+			{
+				int			ret;
+
+				stream->zs.next_in = (Bytef *) src;
+				stream->zs.avail_in = avail;
+				stream->zs.next_out = (Bytef *) dst;
+				stream->zs.avail_out = len;
+
+				ret = inflate(&stream->zs, Z_NO_FLUSH);
+
+				*consumed = avail - stream->zs.avail_in;
+				*produced = len - stream->zs.avail_out;
+
+				/* another gzip member may follow */
+				if (ret == Z_STREAM_END)
+					ret = inflateReset(&stream->zs);
+
+				if (ret != Z_OK && ret != Z_BUF_ERROR)
+				{
+					fprintf(stderr, "Unable to decompress archive \"%s\": %s\n",
+							stream->path, stream->zs.msg ? stream->zs.msg : "corrupt data");
+					return false;
+				}
+			}
+#endif
+			break;
+		case COMPRESSION_LZ4:
+#ifdef USE_LZ4
+			{
+				size_t		dst_size = len;
+				size_t		src_size = avail;
+				size_t		ret;
+
+				ret = LZ4F_decompress(stream->lz4, dst, &dst_size, src, &src_size, NULL);
+
+				if (LZ4F_isError(ret))
+				{
+					fprintf(stderr, "Unable to decompress archive \"%s\": %s\n",
+							stream->path, LZ4F_getErrorName(ret));
+					return false;
+				}
+
+				*consumed = src_size;
+				*produced = dst_size;
+			}
+#endif
+			break;
+		case COMPRESSION_ZSTD:
+#ifdef USE_ZSTD
+			{
+				ZSTD_inBuffer in = {src, avail, 0};
+				ZSTD_outBuffer out = {dst, len, 0};
+				size_t		ret;
+
+				ret = ZSTD_decompressStream(stream->zstd, &out, &in);
+
+				if (ZSTD_isError(ret))
+				{
+					fprintf(stderr, "Unable to decompress archive \"%s\": %s\n",
+							stream->path, ZSTD_getErrorName(ret));
+					return false;
+				}
+
+				*consumed = in.pos;
+				*produced = out.pos;
+			}
+#endif
+			break;
+	}
+
+	stream->in_pos += *consumed;
+
+	return true;
+}
+
+
+/*
+ * Read whatever follows the end of the archive, such as tar's padding to a
+ * full record, so that a command writing it to a pipe isn't killed by
+ * SIGPIPE for the pipe being closed first.  A file needn't be read.
+ */
+static bool
+StreamDrain(ArchiveStream *stream)
+{
+	if (stream->seekable)
+		return true;
+
+	while (!stream->in_eof)
+	{
+		if (!StreamFill(stream))
+			return false;
+	}
+
+	return true;
+}
+
+
+static void
+StreamClose(ArchiveStream *stream)
+{
+	switch (stream->compression)
+	{
+		case COMPRESSION_NONE:
+			break;
+		case COMPRESSION_GZIP:
+#ifdef HAVE_LIBZ
+			inflateEnd(&stream->zs);
+#endif
+			break;
+		case COMPRESSION_LZ4:
+#ifdef USE_LZ4
+			LZ4F_freeDecompressionContext(stream->lz4);
+#endif
+			break;
+		case COMPRESSION_ZSTD:
+#ifdef USE_ZSTD
+			ZSTD_freeDStream(stream->zstd);
+#endif
+			break;
+	}
+
+	if (stream->fd >= 0)
+		close(stream->fd);
+	if (stream->in != NULL)
+		pg_free(stream->in);
+	if (stream->scratch != NULL)
+		pg_free(stream->scratch);
+}
@@ -0,0 +1,444 @@
+/*
+ * catalog.c
+ *
+ * Resolution of logical slots' database OIDs to names by reading the
+ * pg_database catalog straight from the data directory, for --db-names.
+ *
+ * pg_database is a shared, mapped catalog, so its file in global/ is
+ * found through global/pg_filenode.map.  Its heap pages are read one at a
+ * time into a single buffer, and the OID and name of each tuple are
+ * collected into an array which is then sorted, so each slot's database
+ * is found with a binary search however many databases there are.
+ *
+ * Without access to the commit log, which tuples are current is decided
+ * by their hint bits alone: tuples whose inserting transaction is known
+ * to have aborted or whose deleting transaction is known to have
+ * committed are ignored, and where several versions of a row remain, the
+ * one not deleted (or locked) by any transaction is preferred.  A name
+ * changed very recently may therefore show its previous value.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pg_replslot_reader.h"
+
+/* see src/include/catalog/pg_database.h */
+#define DatabaseRelationId	1262
+
+/*
+ * See src/backend/utils/cache/relmapper.c; PostgreSQL 16 dropped the
+ * padding which made the file exactly 512 bytes, with room for 64
+ * mappings instead of 62.  The low byte of the magic number is the format
+ * version, so only the rest is checked; the size says which layout it is,
+ * and the checksum that it was read correctly.
+ */
+#define RELMAPPER_FILEMAGIC		0x592700
+#define RELMAPPER_MAGIC_MASK	0xFFFFFF00
+#define RELMAPPER_FILESIZE_V1	512
+#define RELMAPPER_FILESIZE_V2	524
+#define RELMAPPER_FILESIZE_MAX	RELMAPPER_FILESIZE_V2
+#define RELMAPPER_MAPPINGS_V1	62
+#define RELMAPPER_MAPPINGS_V2	64
+
+typedef struct RelMapping
+{
+	Oid			mapoid;
+	Oid			mapfilenode;
+} RelMapping;
+
+/* see src/include/storage/bufpage.h and itemid.h */
+#define PAGE_HEADER_SIZE		24
+#define PD_LOWER_OFFSET			12
+#define PD_UPPER_OFFSET			14
+#define PD_PAGESIZE_OFFSET		18
+#define LP_NORMAL				1
+
+typedef struct DiskItemId
+{
+	unsigned	lp_off:15,
+				lp_flags:2,
+				lp_len:15;
+} DiskItemId;
+
+/* see src/include/access/htup_details.h */
+#define T_XMAX_OFFSET			4
+#define T_INFOMASK_OFFSET		20
+#define T_HOFF_OFFSET			22
+#define HEAP_HASOID_OLD			0x0008	/* before PostgreSQL 12 */
+#define HEAP_XMAX_LOCK_ONLY		0x0080
+#define HEAP_XMIN_COMMITTED		0x0100
+#define HEAP_XMIN_INVALID		0x0200
+#define HEAP_XMAX_COMMITTED		0x0400
+#define HEAP_XMAX_INVALID		0x0800
+
+typedef struct DatabaseName
+{
+	Oid			oid;
+	bool		current;		/* not deleted or locked by any transaction */
+	char		name[NAMEDATALEN];
+} DatabaseName;
+
+struct DatabaseNames
+{
+	DatabaseName *databases;
+	int			database_cnt;
+	int			databases_size;
+};
+
+static bool ReadPgDatabaseFilenode(const ClusterInfo *cluster, Oid *filenode);
+static void ReadPgDatabasePage(const ClusterInfo *cluster, const char *page,
+							   DatabaseNames *names);
+static int	DatabaseNameCmp(const void *a, const void *b);
+
+
+/*
+ * Read the OID and name of each database in "cluster"'s pg_database;
+ * returns NULL, having reported why, if they can't be read.
+ */
+DatabaseNames *
+ReadDatabaseNames(const ClusterInfo *cluster)
+{
+	DatabaseNames *names;
+	Oid			filenode;
+	char		path[MAXPGPATH];
+	char	   *page;
+	int			fd;
+	int			i,
+				j;
+
+	if (!ReadPgDatabaseFilenode(cluster, &filenode))
+		return NULL;
+
+	snprintf(path, MAXPGPATH, "%s/global/%u", cluster->datadir, filenode);
+
+	fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Unable to open pg_database file \"%s\": %s\n",
+				path, strerror(errno));
+		return NULL;
+	}
+
+	names = pg_malloc0(sizeof(DatabaseNames));
+	page = pg_malloc(BLCKSZ);
+
+	for (;;)
+	{
+		ssize_t		n = read(fd, page, BLCKSZ);
+		uint16		pagesize_version;
+
+		if (n < 0)
+		{
+			fprintf(stderr, "Unable to read pg_database file \"%s\": %s\n",
+					path, strerror(errno));
+			goto fail;
+		}
+
+		/* a partial page can only be one being extended */
+		if (n < BLCKSZ)
+			break;
+
+		memcpy(&pagesize_version, page + PD_PAGESIZE_OFFSET, sizeof(uint16));
+
+		/* a page extended but not yet written is all zeroes */
+		if (pagesize_version == 0)
+			continue;
+
+		if ((pagesize_version & 0xFF00) != BLCKSZ)
+		{
+			fprintf(stderr, "pg_database file \"%s\" has %u-byte pages, but this build supports only %u\n",
+					path, pagesize_version & 0xFF00, (uint32) BLCKSZ);
+			goto fail;
+		}
+
+		ReadPgDatabasePage(cluster, page, names);
+	}
+
+	close(fd);
+	pg_free(page);
+
+	if (names->database_cnt > 1)
+		qsort(names->databases, names->database_cnt, sizeof(DatabaseName),
+			  DatabaseNameCmp);
+
+	/* keep one version of each row, sorted first */
+	for (i = 0, j = 0; i < names->database_cnt; i++)
+	{
+		if (j > 0 && names->databases[j - 1].oid == names->databases[i].oid)
+			continue;
+
+		names->databases[j++] = names->databases[i];
+	}
+	names->database_cnt = j;
+
+	return names;
+
+fail:
+	close(fd);
+	pg_free(page);
+	FreeDatabaseNames(names);
+
+	return NULL;
+}
+
+
+/*
+ * The name of database "oid", or NULL if it isn't in "names".
+ */
+const char *
+LookupDatabaseName(const DatabaseNames *names, Oid oid)
+{
+	int			low = 0;
+	int			high = names->database_cnt - 1;
+
+	while (low <= high)
+	{
+		int			mid = low + (high - low) / 2;
+		const DatabaseName *database = &names->databases[mid];
+
+		if (database->oid == oid)
+			return database->name;
+
+		if (database->oid < oid)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Set the database name of "replslot_info", if it's a logical slot whose
+ * database is in "names"; "names" is NULL if pg_database couldn't be read.
+ */
+void
+SetDatabaseName(const DatabaseNames *names, ReplslotInfo *replslot_info)
+{
+	if (names != NULL && replslot_info->type == RS_LOGICAL)
+		replslot_info->db_name = LookupDatabaseName(names, replslot_info->db_oid);
+	else
+		replslot_info->db_name = NULL;
+}
+
+
+void
+FreeDatabaseNames(DatabaseNames *names)
+{
+	if (names->databases != NULL)
+		pg_free(names->databases);
+	pg_free(names);
+}
+
+
+/*
+ * Find pg_database's filenode in global/pg_filenode.map.
+ */
+static bool
+ReadPgDatabaseFilenode(const ClusterInfo *cluster, Oid *filenode)
+{
+	char		path[MAXPGPATH];
+	char		buf[RELMAPPER_FILESIZE_MAX + 1];
+	uint32		magic;
+	int32		num_mappings;
+	int			max_mappings;
+	ssize_t		n;
+	int			fd;
+	int			i;
+
+	snprintf(path, MAXPGPATH, "%s/global/pg_filenode.map", cluster->datadir);
+
+	fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Unable to open relation map \"%s\": %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	n = read(fd, buf, sizeof(buf));
+	close(fd);
+
+	if (n == RELMAPPER_FILESIZE_V1)
+		max_mappings = RELMAPPER_MAPPINGS_V1;
+	else if (n == RELMAPPER_FILESIZE_V2)
+		max_mappings = RELMAPPER_MAPPINGS_V2;
+	else
+	{
+		fprintf(stderr, "Relation map \"%s\" has an unexpected size\n", path);
+		return false;
+	}
+
+	memcpy(&magic, buf, sizeof(uint32));
+	memcpy(&num_mappings, buf + sizeof(int32), sizeof(int32));
+
+	if ((magic & RELMAPPER_MAGIC_MASK) != RELMAPPER_FILEMAGIC ||
+		num_mappings < 0 || num_mappings > max_mappings)
+	{
+		fprintf(stderr, "Relation map \"%s\" is invalid\n", path);
+		return false;
+	}
+
+	/* before 9.5, the checksum is the old CRC-32, which isn't checked */
+	if (cluster->pg_version_num >= 90500)
+	{
+		size_t		crc_offset = 2 * sizeof(int32) + max_mappings * sizeof(RelMapping);
+		pg_crc32c	crc;
+		pg_crc32c	file_crc;
+
+		INIT_CRC32C(crc);
+		COMP_CRC32C(crc, buf, crc_offset);
+		FIN_CRC32C(crc);
+
+		memcpy(&file_crc, buf + crc_offset, sizeof(pg_crc32c));
+
+		if (!EQ_CRC32C(crc, file_crc))
+		{
+			fprintf(stderr, "Checksum mismatch in relation map \"%s\"\n", path);
+			return false;
+		}
+	}
+
+	for (i = 0; i < num_mappings; i++)
+	{
+		RelMapping	mapping;
+
+		memcpy(&mapping, buf + 2 * sizeof(int32) + i * sizeof(RelMapping),
+			   sizeof(RelMapping));
+
+		if (mapping.mapoid == DatabaseRelationId)
+		{
+			*filenode = mapping.mapfilenode;
+			return true;
+		}
+	}
+
+	fprintf(stderr, "Relation map \"%s\" has no entry for pg_database\n", path);
+
+	return false;
+}
+
+
+/*
+ * Add the OID and name of each live-looking tuple on a pg_database heap
+ * page to "names".
+ */
+static void
+ReadPgDatabasePage(const ClusterInfo *cluster, const char *page,
+				   DatabaseNames *names)
+{
+	uint16		pd_lower;
+	uint16		pd_upper;
+	int			item_cnt;
+	int			i;
+
+	memcpy(&pd_lower, page + PD_LOWER_OFFSET, sizeof(uint16));
+	memcpy(&pd_upper, page + PD_UPPER_OFFSET, sizeof(uint16));
+
+	if (pd_lower < PAGE_HEADER_SIZE || pd_lower > pd_upper || pd_upper > BLCKSZ)
+		return;
+
+	item_cnt = (pd_lower - PAGE_HEADER_SIZE) / sizeof(DiskItemId);
+
+	for (i = 0; i < item_cnt; i++)
+	{
+		DiskItemId	item;
+		const char *tuple;
+		const char *data;
+		uint16		infomask;
+		uint8		hoff;
+		TransactionId xmax;
+		DatabaseName *database;
+		size_t		data_len;
+
+		memcpy(&item, page + PAGE_HEADER_SIZE + i * sizeof(DiskItemId),
+			   sizeof(DiskItemId));
+
+		if (item.lp_flags != LP_NORMAL || item.lp_off < pd_upper ||
+			item.lp_off + item.lp_len > BLCKSZ)
+			continue;
+
+		tuple = page + item.lp_off;
+
+		if (item.lp_len <= T_HOFF_OFFSET)
+			continue;
+
+		memcpy(&infomask, tuple + T_INFOMASK_OFFSET, sizeof(uint16));
+		memcpy(&xmax, tuple + T_XMAX_OFFSET, sizeof(TransactionId));
+		hoff = (uint8) tuple[T_HOFF_OFFSET];
+
+		/* frozen tuples have both xmin bits set */
+		if ((infomask & (HEAP_XMIN_COMMITTED | HEAP_XMIN_INVALID)) == HEAP_XMIN_INVALID)
+			continue;
+
+		if ((infomask & HEAP_XMAX_COMMITTED) && !(infomask & HEAP_XMAX_LOCK_ONLY))
+			continue;
+
+		if (hoff > item.lp_len)
+			continue;
+
+		data = tuple + hoff;
+		data_len = item.lp_len - hoff;
+
+		if (names->database_cnt == names->databases_size)
+		{
+			names->databases_size = Max(names->databases_size * 2, 16);
+			names->databases = pg_realloc(names->databases,
+										  names->databases_size * sizeof(DatabaseName));
+		}
+
+		database = &names->databases[names->database_cnt];
+
+		/* from PostgreSQL 12, the OID is an ordinary column before datname */
+		if (cluster->pg_version_num >= 120000)
+		{
+			if (data_len < sizeof(Oid) + NAMEDATALEN)
+				continue;
+
+			memcpy(&database->oid, data, sizeof(Oid));
+			data += sizeof(Oid);
+		}
+		else
+		{
+			if (!(infomask & HEAP_HASOID_OLD) || hoff < T_HOFF_OFFSET + 1 + sizeof(Oid) ||
+				data_len < NAMEDATALEN)
+				continue;
+
+			memcpy(&database->oid, tuple + hoff - sizeof(Oid), sizeof(Oid));
+		}
+
+		memcpy(database->name, data, NAMEDATALEN - 1);
+		database->name[NAMEDATALEN - 1] = '\0';
+
+		database->current = !TransactionIdIsValid(xmax) ||
+			(infomask & (HEAP_XMAX_INVALID | HEAP_XMAX_LOCK_ONLY)) != 0;
+
+		names->database_cnt++;
+	}
+}
+
+
+/*
+ * Order by OID, then with the current version of a row first.
+ */
+static int
+DatabaseNameCmp(const void *a, const void *b)
+{
+	const DatabaseName *da = (const DatabaseName *) a;
+	const DatabaseName *db = (const DatabaseName *) b;
+
+	if (da->oid != db->oid)
+		return da->oid < db->oid ? -1 : 1;
+
+	if (da->current != db->current)
+		return da->current ? -1 : 1;
+
+	return 0;
+}
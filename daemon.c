@@ -0,0 +1,609 @@
+/*
+ * daemon.c
+ *
+ * The query endpoint of --daemon.
+ *
+ * The slots are rescanned every "refresh_interval" seconds, and each scan
+ * is rendered once as JSON and once in the Prometheus text exposition
+ * format.  Requests are answered from those rendered reports, so however
+ * many clients there are and however often they ask, no state file is
+ * read and no slot formatted on their behalf.
+ *
+ * The endpoint speaks just enough HTTP/1.0 for curl and Prometheus:
+ * "GET /metrics" returns the Prometheus report, "GET /" and "GET /slots"
+ * the JSON one, and every connection is closed after its response.  It
+ * listens either on TCP ("[HOST:]PORT") or on a Unix socket (any address
+ * containing a '/').
+ *
+ * All clients are served by a single thread with poll(); sockets are
+ * non-blocking, so a slow client holds up no-one else, and a client is
+ * disconnected if it hasn't been sent its response DAEMON_CLIENT_TIMEOUT
+ * seconds after connecting, so idle connections can't use up the client
+ * slots.  The scans are run by a thread of their own, which hands each new
+ * report over through a pipe, so requests are still answered while a slow
+ * scan is under way.  A response being sent keeps a reference to the report
+ * it was taken from, which is freed only once it has been replaced by a
+ * newer one and the last such response has been sent; reference counts are
+ * only touched by the serving thread.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "pg_replslot_reader.h"
+
+#define DAEMON_MAX_CLIENTS		64
+#define DAEMON_REQUEST_SIZE		2048
+#define DAEMON_LISTEN_BACKLOG	64
+#define DAEMON_CLIENT_TIMEOUT	10	/* seconds */
+
+/*
+ * The reports rendered from one scan.
+ */
+typedef struct DaemonReport
+{
+	int			refcnt;
+	PQExpBufferData json;
+	PQExpBufferData prometheus;
+} DaemonReport;
+
+/*
+ * A connected client; "fd" is -1 if the slot is free.  Until the request
+ * has been received, "report" is NULL; after that the response consists
+ * of "header" followed by "body", of which "sent" bytes have been sent.
+ */
+typedef struct DaemonClient
+{
+	int			fd;
+	instr_time	connected;
+	char		request[DAEMON_REQUEST_SIZE];
+	size_t		request_len;
+	DaemonReport *report;
+	char		header[256];
+	size_t		header_len;
+	const char *body;
+	size_t		body_len;
+	size_t		sent;
+} DaemonClient;
+
+static int	OpenListenSocket(const char *listen_addr);
+static DaemonReport *CreateReport(DaemonRefreshFunc refresh);
+static void ReleaseReport(DaemonReport *report);
+static void *RefreshWorker(void *arg);
+static void TakeNewReport(void);
+static void AcceptClient(int listen_fd);
+static void ReadRequest(DaemonClient *client);
+static void StartResponse(DaemonClient *client);
+static void SendResponse(DaemonClient *client);
+static void CloseClient(DaemonClient *client);
+static void SetNonBlocking(int fd);
+
+static DaemonClient clients[DAEMON_MAX_CLIENTS];
+static int	client_cnt = 0;
+static DaemonReport *current_report = NULL;
+
+/* handed over from RefreshWorker(), which writes to refresh_pipe[1] */
+static pthread_mutex_t new_report_lock = PTHREAD_MUTEX_INITIALIZER;
+static DaemonReport *new_report = NULL;
+static int	refresh_pipe[2];
+
+static DaemonRefreshFunc daemon_refresh;
+static int	daemon_refresh_interval;
+
+
+/*
+ * Listen on "listen_addr" and serve the reports produced by "refresh",
+ * called again every "refresh_interval" seconds; never returns.
+ */
+void
+DaemonMain(const char *listen_addr, int refresh_interval,
+		   DaemonRefreshFunc refresh)
+{
+	struct pollfd fds[DAEMON_MAX_CLIENTS + 2];
+	int			poll_clients[DAEMON_MAX_CLIENTS];
+	int			listen_fd;
+	pthread_t	refresh_thread;
+	int			i;
+
+	/* a client going away mid-response must not end the daemon */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < DAEMON_MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	listen_fd = OpenListenSocket(listen_addr);
+
+	current_report = CreateReport(refresh);
+
+	if (pipe(refresh_pipe) != 0)
+	{
+		fprintf(stderr, "Unable to create pipe: %s\n", strerror(errno));
+		exit(1);
+	}
+	SetNonBlocking(refresh_pipe[0]);
+	SetNonBlocking(refresh_pipe[1]);
+
+	daemon_refresh = refresh;
+	daemon_refresh_interval = refresh_interval;
+
+	{
+		int			ret = pthread_create(&refresh_thread, NULL, RefreshWorker, NULL);
+
+		if (ret != 0)
+		{
+			fprintf(stderr, "Unable to create refresh thread: %s\n", strerror(ret));
+			exit(1);
+		}
+	}
+
+	fprintf(stderr, "Listening on %s\n", listen_addr);
+
+	for (;;)
+	{
+		instr_time	now;
+		int			timeout = -1;
+		int			nfds = 0;
+		int			ret;
+
+		INSTR_TIME_SET_CURRENT(now);
+
+		/* stop accepting while every client slot is in use */
+		fds[nfds].fd = client_cnt < DAEMON_MAX_CLIENTS ? listen_fd : -1;
+		fds[nfds].events = POLLIN;
+		nfds++;
+
+		fds[nfds].fd = refresh_pipe[0];
+		fds[nfds].events = POLLIN;
+		nfds++;
+
+		for (i = 0; i < DAEMON_MAX_CLIENTS; i++)
+		{
+			instr_time	elapsed;
+			double		remaining_ms;
+
+			if (clients[i].fd < 0)
+				continue;
+
+			elapsed = now;
+			INSTR_TIME_SUBTRACT(elapsed, clients[i].connected);
+			remaining_ms = DAEMON_CLIENT_TIMEOUT * 1000.0 - INSTR_TIME_GET_MILLISEC(elapsed);
+
+			if (remaining_ms <= 0)
+			{
+				CloseClient(&clients[i]);
+				continue;
+			}
+
+			if (timeout < 0 || remaining_ms + 1 < timeout)
+				timeout = (int) remaining_ms + 1;
+
+			fds[nfds].fd = clients[i].fd;
+			fds[nfds].events = clients[i].report == NULL ? POLLIN : POLLOUT;
+			poll_clients[nfds - 2] = i;
+			nfds++;
+		}
+
+		ret = poll(fds, nfds, timeout);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "poll() failed: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		if (ret == 0)
+			continue;
+
+		/* requests read from now on are answered from the new report */
+		if (fds[1].revents & POLLIN)
+			TakeNewReport();
+
+		for (i = 2; i < nfds; i++)
+		{
+			DaemonClient *client = &clients[poll_clients[i - 2]];
+
+			if (fds[i].revents == 0)
+				continue;
+
+			if (client->report == NULL)
+				ReadRequest(client);
+			else
+				SendResponse(client);
+		}
+
+		if (fds[0].revents & POLLIN)
+			AcceptClient(listen_fd);
+	}
+}
+
+
+/*
+ * Create a listening socket for "listen_addr", which is the path of a
+ * Unix socket if it contains a '/', otherwise "[HOST:]PORT"; without a
+ * host, all addresses are listened on.
+ */
+static int
+OpenListenSocket(const char *listen_addr)
+{
+	int			fd;
+
+	if (strchr(listen_addr, '/') != NULL)
+	{
+		struct sockaddr_un addr;
+		struct stat statbuf;
+
+		if (strlen(listen_addr) >= sizeof(addr.sun_path))
+		{
+			fprintf(stderr, "Socket path \"%s\" is too long\n", listen_addr);
+			exit(1);
+		}
+
+		/* remove a socket left behind by an earlier run */
+		if (lstat(listen_addr, &statbuf) == 0 && S_ISSOCK(statbuf.st_mode))
+			unlink(listen_addr);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strlcpy(addr.sun_path, listen_addr, sizeof(addr.sun_path));
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 ||
+			bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+			listen(fd, DAEMON_LISTEN_BACKLOG) != 0)
+		{
+			fprintf(stderr, "Unable to listen on \"%s\": %s\n",
+					listen_addr, strerror(errno));
+			exit(1);
+		}
+	}
+	else
+	{
+		struct addrinfo hints;
+		struct addrinfo *result;
+		char		host[MAXLEN];
+		const char *port = strrchr(listen_addr, ':');
+		int			ret;
+		int			on = 1;
+
+		if (port == NULL)
+		{
+			host[0] = '\0';
+			port = listen_addr;
+		}
+		else
+		{
+			/* an IPv6 address may be given in brackets */
+			if (listen_addr[0] == '[' && port > listen_addr + 1 && port[-1] == ']')
+				strlcpy(host, listen_addr + 1, Min(sizeof(host), port - listen_addr - 1));
+			else
+				strlcpy(host, listen_addr, Min(sizeof(host), port - listen_addr + 1));
+			port++;
+		}
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		ret = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &result);
+		if (ret != 0)
+		{
+			fprintf(stderr, "Invalid listen address \"%s\": %s\n",
+					listen_addr, gai_strerror(ret));
+			exit(1);
+		}
+
+		fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+		if (fd >= 0)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+		if (fd < 0 ||
+			bind(fd, result->ai_addr, result->ai_addrlen) != 0 ||
+			listen(fd, DAEMON_LISTEN_BACKLOG) != 0)
+		{
+			fprintf(stderr, "Unable to listen on \"%s\": %s\n",
+					listen_addr, strerror(errno));
+			exit(1);
+		}
+
+		freeaddrinfo(result);
+	}
+
+	SetNonBlocking(fd);
+
+	return fd;
+}
+
+
+static DaemonReport *
+CreateReport(DaemonRefreshFunc refresh)
+{
+	DaemonReport *report = pg_malloc(sizeof(DaemonReport));
+
+	report->refcnt = 1;
+	initPQExpBuffer(&report->json);
+	initPQExpBuffer(&report->prometheus);
+
+	refresh(&report->json, &report->prometheus);
+
+	return report;
+}
+
+
+static void
+ReleaseReport(DaemonReport *report)
+{
+	if (--report->refcnt > 0)
+		return;
+
+	termPQExpBuffer(&report->json);
+	termPQExpBuffer(&report->prometheus);
+	pg_free(report);
+}
+
+
+/*
+ * Rescan the slots every "refresh_interval" seconds, leaving each new
+ * report for the serving thread to take.  A report it hasn't got round to
+ * taking yet is superseded, and has no other reference.
+ */
+static void *
+RefreshWorker(void *arg)
+{
+	for (;;)
+	{
+		DaemonReport *report;
+		DaemonReport *superseded;
+
+		sleep(daemon_refresh_interval);
+
+		report = CreateReport(daemon_refresh);
+
+		pthread_mutex_lock(&new_report_lock);
+		superseded = new_report;
+		new_report = report;
+		pthread_mutex_unlock(&new_report_lock);
+
+		if (superseded != NULL)
+			ReleaseReport(superseded);
+
+		/* if the pipe is full, the serving thread has yet to be woken anyway */
+		if (write(refresh_pipe[1], "", 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			fprintf(stderr, "Unable to write to pipe: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Replace the current report with the one RefreshWorker() has left, if
+ * there is one.
+ */
+static void
+TakeNewReport(void)
+{
+	char		buf[64];
+	DaemonReport *report;
+
+	while (read(refresh_pipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&new_report_lock);
+	report = new_report;
+	new_report = NULL;
+	pthread_mutex_unlock(&new_report_lock);
+
+	if (report != NULL)
+	{
+		ReleaseReport(current_report);
+		current_report = report;
+	}
+}
+
+
+static void
+AcceptClient(int listen_fd)
+{
+	int			i;
+
+	while (client_cnt < DAEMON_MAX_CLIENTS)
+	{
+		int			fd = accept(listen_fd, NULL, NULL);
+
+		if (fd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+				errno != ECONNABORTED)
+				fprintf(stderr, "accept() failed: %s\n", strerror(errno));
+			return;
+		}
+
+		SetNonBlocking(fd);
+
+		for (i = 0; clients[i].fd >= 0; i++)
+			;
+
+		memset(&clients[i], 0, sizeof(DaemonClient));
+		clients[i].fd = fd;
+		INSTR_TIME_SET_CURRENT(clients[i].connected);
+		client_cnt++;
+	}
+}
+
+
+/*
+ * Read what is available of the client's request, and start the response
+ * once the end of its headers has been received.
+ */
+static void
+ReadRequest(DaemonClient *client)
+{
+	ssize_t		ret;
+
+	ret = read(client->fd, client->request + client->request_len,
+			   sizeof(client->request) - client->request_len - 1);
+
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+
+	if (ret <= 0)
+	{
+		CloseClient(client);
+		return;
+	}
+
+	client->request_len += ret;
+	client->request[client->request_len] = '\0';
+
+	if (strstr(client->request, "\r\n\r\n") != NULL ||
+		strstr(client->request, "\n\n") != NULL ||
+		client->request_len == sizeof(client->request) - 1)
+		StartResponse(client);
+}
+
+
+/*
+ * Choose the response to the request received, and send what can be sent
+ * of it straight away.
+ */
+static void
+StartResponse(DaemonClient *client)
+{
+	const char *status = "200 OK";
+	const char *content_type = NULL;
+	char	   *path;
+	char	   *line_end;
+	char	   *end;
+
+	client->report = current_report;
+	current_report->refcnt++;
+
+	path = strchr(client->request, ' ');
+	line_end = strchr(client->request, '\n');
+
+	if (path == NULL || line_end == NULL || line_end < path)
+		status = "400 Bad Request";
+	else if (strncmp(client->request, "GET ", 4) != 0)
+		status = "405 Method Not Allowed";
+	else
+	{
+		path++;
+		end = path + strcspn(path, " ?\r\n");
+		*end = '\0';
+
+		if (strcmp(path, "/metrics") == 0)
+		{
+			content_type = "text/plain; version=0.0.4";
+			client->body = client->report->prometheus.data;
+			client->body_len = client->report->prometheus.len;
+		}
+		else if (strcmp(path, "/") == 0 || strcmp(path, "/slots") == 0)
+		{
+			content_type = "application/json";
+			client->body = client->report->json.data;
+			client->body_len = client->report->json.len;
+		}
+		else
+			status = "404 Not Found";
+	}
+
+	if (content_type == NULL)
+	{
+		content_type = "text/plain";
+		client->body = status;
+		client->body_len = strlen(status);
+	}
+
+	client->header_len = snprintf(client->header, sizeof(client->header),
+								  "HTTP/1.0 %s\r\n"
+								  "Content-Type: %s\r\n"
+								  "Content-Length: %zu\r\n"
+								  "Connection: close\r\n"
+								  "\r\n",
+								  status, content_type, client->body_len);
+	client->sent = 0;
+
+	SendResponse(client);
+}
+
+
+/*
+ * Send as much of the response as the socket will take, closing the
+ * connection once it has all been sent.
+ */
+static void
+SendResponse(DaemonClient *client)
+{
+	while (client->sent < client->header_len + client->body_len)
+	{
+		ssize_t		ret;
+
+		if (client->sent < client->header_len)
+			ret = write(client->fd, client->header + client->sent,
+						client->header_len - client->sent);
+		else
+			ret = write(client->fd, client->body + client->sent - client->header_len,
+						client->body_len - (client->sent - client->header_len));
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		if (ret < 0)
+			break;
+
+		client->sent += ret;
+	}
+
+	CloseClient(client);
+}
+
+
+static void
+CloseClient(DaemonClient *client)
+{
+	close(client->fd);
+	client->fd = -1;
+	client_cnt--;
+
+	if (client->report != NULL)
+	{
+		ReleaseReport(client->report);
+		client->report = NULL;
+	}
+}
+
+
+static void
+SetNonBlocking(int fd)
+{
+	int			flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+	{
+		fprintf(stderr, "Unable to make socket non-blocking: %s\n",
+				strerror(errno));
+		exit(1);
+	}
+}
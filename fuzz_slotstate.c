@@ -0,0 +1,71 @@
+/*
+ * fuzz_slotstate.c
+ *
+ * libFuzzer harness for the checks and decoding applied to every slot
+ * state file, whether it was read with pread(), io_uring or from an
+ * archive (see the "fuzz" target in the Makefile).  AFL++ can build it
+ * too, with afl-clang-fast and -fsanitize=fuzzer.
+ *
+ * Each input is taken as the contents of a state file, and put in a
+ * ReplslotStateBuf as the readers do: only the first SLOT_STATE_BUFSIZE
+ * bytes, so that longer input looks like a file longer than any valid
+ * one, with the rest of the buffer left holding garbage.  It is then
+ * validated as coming from each supported PostgreSQL release in turn
+ * and decoded if accepted.  Besides the sanitizers' checks, an accepted
+ * file must have been read in full, and every message and decoded name
+ * must be terminated within its buffer.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pg_replslot_reader.h"
+
+/* a release writing each state file format, either side of the CRC change */
+static const int pg_version_nums[] = {90400, 90600, 130000, 140000, 160000, 170000};
+
+int			LLVMFuzzerTestOneInput(const uint8 *data, size_t size);
+
+
+int
+LLVMFuzzerTestOneInput(const uint8 *data, size_t size)
+{
+	ReplslotStateBuf buf;
+	ssize_t		readBytes = (ssize_t) Min(size, sizeof(ReplslotStateBuf));
+	int			i;
+
+	memset(&buf, 0x7F, sizeof(ReplslotStateBuf));
+	memcpy(buf.data, data, readBytes);
+
+	for (i = 0; i < lengthof(pg_version_nums); i++)
+	{
+		const ReplslotFormat *format;
+		ReplslotInfo replslot_info;
+		char		error[MAXLEN];
+
+		format = ValidateReplSlotState(&buf, readBytes, "fuzz", pg_version_nums[i], error);
+
+		if (format == NULL)
+		{
+			if (memchr(error, '\0', MAXLEN) == NULL)
+				abort();
+			continue;
+		}
+
+		if ((size_t) readBytes != ReplicationSlotOnDiskConstantSize + format->length)
+			abort();
+
+		memset(&replslot_info, 0, sizeof(ReplslotInfo));
+		DecodeReplslotState(format, buf.data + ReplicationSlotOnDiskConstantSize,
+							&replslot_info);
+
+		if (memchr(replslot_info.name, '\0', NAMEDATALEN) == NULL ||
+			memchr(replslot_info.plugin, '\0', NAMEDATALEN) == NULL)
+			abort();
+	}
+
+	return 0;
+}
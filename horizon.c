@@ -0,0 +1,145 @@
+/*
+ * horizon.c
+ *
+ * The oldest restart_lsn, xmin and catalog_xmin among a data directory's
+ * slots, which are what hold back WAL removal and vacuum, for --summary.
+ *
+ * Each is a running minimum, together with the name of the slot holding
+ * it, so the slots needn't be kept once they have been added.  With
+ * several jobs, each worker keeps minima of its own, which are merged
+ * once all the slots have been read.  Ties are broken by slot name, so
+ * the slot reported doesn't depend on the order the slots were read in.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pg_replslot_reader.h"
+
+static bool OlderLsn(XLogRecPtr lsn, const char *slot_name,
+					 XLogRecPtr oldest, const char *oldest_slot_name);
+static bool OlderXid(TransactionId xid, const char *slot_name,
+					 TransactionId oldest, const char *oldest_slot_name);
+
+
+void
+SlotHorizonsInit(SlotHorizons *horizons, const ClusterInfo *cluster)
+{
+	memset(horizons, 0, sizeof(SlotHorizons));
+
+	horizons->cluster = cluster;
+	horizons->restart_lsn = InvalidXLogRecPtr;
+	horizons->xmin = InvalidTransactionId;
+	horizons->catalog_xmin = InvalidTransactionId;
+}
+
+
+/*
+ * Take the slot "replslot_info" into account; a slot whose state file
+ * couldn't be parsed, or which has been invalidated, is only counted.
+ */
+void
+SlotHorizonsAdd(SlotHorizons *horizons, const ReplslotInfo *replslot_info)
+{
+	horizons->slot_cnt++;
+
+	if (!replslot_info->slotfile_parsed)
+	{
+		horizons->unparsed_cnt++;
+		return;
+	}
+
+	/* the server ignores an invalidated slot's horizons */
+	if (replslot_info->invalidated != RS_INVAL_NONE)
+		return;
+
+	if (OlderLsn(replslot_info->restart_lsn, replslot_info->name,
+				 horizons->restart_lsn, horizons->restart_lsn_slot))
+	{
+		horizons->restart_lsn = replslot_info->restart_lsn;
+		strlcpy(horizons->restart_lsn_slot, replslot_info->name, NAMEDATALEN);
+	}
+
+	if (OlderXid(replslot_info->xmin, replslot_info->name,
+				 horizons->xmin, horizons->xmin_slot))
+	{
+		horizons->xmin = replslot_info->xmin;
+		strlcpy(horizons->xmin_slot, replslot_info->name, NAMEDATALEN);
+	}
+
+	if (OlderXid(replslot_info->catalog_xmin, replslot_info->name,
+				 horizons->catalog_xmin, horizons->catalog_xmin_slot))
+	{
+		horizons->catalog_xmin = replslot_info->catalog_xmin;
+		strlcpy(horizons->catalog_xmin_slot, replslot_info->name, NAMEDATALEN);
+	}
+}
+
+
+/*
+ * Fold the minima in "from", for the same data directory, into "into".
+ */
+void
+SlotHorizonsMerge(SlotHorizons *into, const SlotHorizons *from)
+{
+	into->slot_cnt += from->slot_cnt;
+	into->unparsed_cnt += from->unparsed_cnt;
+
+	if (OlderLsn(from->restart_lsn, from->restart_lsn_slot,
+				 into->restart_lsn, into->restart_lsn_slot))
+	{
+		into->restart_lsn = from->restart_lsn;
+		strlcpy(into->restart_lsn_slot, from->restart_lsn_slot, NAMEDATALEN);
+	}
+
+	if (OlderXid(from->xmin, from->xmin_slot, into->xmin, into->xmin_slot))
+	{
+		into->xmin = from->xmin;
+		strlcpy(into->xmin_slot, from->xmin_slot, NAMEDATALEN);
+	}
+
+	if (OlderXid(from->catalog_xmin, from->catalog_xmin_slot,
+				 into->catalog_xmin, into->catalog_xmin_slot))
+	{
+		into->catalog_xmin = from->catalog_xmin;
+		strlcpy(into->catalog_xmin_slot, from->catalog_xmin_slot, NAMEDATALEN);
+	}
+}
+
+
+/*
+ * Whether "lsn" should replace "oldest"; an invalid LSN holds nothing back.
+ */
+static bool
+OlderLsn(XLogRecPtr lsn, const char *slot_name,
+		 XLogRecPtr oldest, const char *oldest_slot_name)
+{
+	if (XLogRecPtrIsInvalid(lsn))
+		return false;
+
+	if (XLogRecPtrIsInvalid(oldest) || lsn < oldest)
+		return true;
+
+	return lsn == oldest && strcmp(slot_name, oldest_slot_name) < 0;
+}
+
+
+/*
+ * As OlderLsn(), for transaction IDs, which are compared modulo 2^32 as
+ * TransactionIdPrecedes() does.
+ */
+static bool
+OlderXid(TransactionId xid, const char *slot_name,
+		 TransactionId oldest, const char *oldest_slot_name)
+{
+	if (!TransactionIdIsValid(xid))
+		return false;
+
+	if (!TransactionIdIsValid(oldest) || (int32) (xid - oldest) < 0)
+		return true;
+
+	return xid == oldest && strcmp(slot_name, oldest_slot_name) < 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * live.c
+ *
+ * Comparison of the slots on disk with pg_replication_slots, for
+ * --compare-live.
+ *
+ * While the server is running, a slot's state file is only rewritten at
+ * checkpoints, so the restart_lsn and confirmed_flush_lsn the server holds
+ * in memory are usually ahead of those on disk; this shows by how much,
+ * i.e. what a crash would set the slot back to.
+ *
+ * pg_replication_slots is fetched with a single query however many slots
+ * there are, and each slot read from disk is then matched with its row by
+ * name through a NameHash.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pg_replslot_reader.h"
+
+/* columns of the query result */
+#define LIVE_COL_SLOT_NAME			0
+#define LIVE_COL_ACTIVE				1
+#define LIVE_COL_RESTART_LSN		2
+#define LIVE_COL_CONFIRMED_FLUSH	3
+
+/*
+ * The rows of pg_replication_slots; "matched" records, for each row,
+ * whether a slot read from disk has been compared with it.
+ */
+struct LiveSlotSet
+{
+	PGresult   *res;
+	NameHash   *by_name;
+	bool	   *matched;
+};
+
+static XLogRecPtr ParseLsn(const char *str);
+
+
+/*
+ * Connect to the running server with "conninfo" and fetch its replication
+ * slots; returns NULL, having reported why, on failure.
+ */
+LiveSlotSet *
+FetchLiveSlots(const char *conninfo)
+{
+	LiveSlotSet *live_slots;
+	PGconn	   *conn;
+	PGresult   *res;
+	const char *query;
+	int			row_cnt;
+	int			i;
+
+	conn = PQconnectdb(conninfo);
+
+	if (PQstatus(conn) != CONNECTION_OK)
+	{
+		fprintf(stderr, "Unable to connect to the server for --compare-live: %s",
+				PQerrorMessage(conn));
+		PQfinish(conn);
+		return NULL;
+	}
+
+	/* confirmed_flush_lsn was added to pg_replication_slots in 9.6 */
+	if (PQserverVersion(conn) >= 90600)
+		query = "SELECT slot_name, active, restart_lsn, confirmed_flush_lsn "
+			"FROM pg_catalog.pg_replication_slots";
+	else
+		query = "SELECT slot_name, active, restart_lsn, NULL "
+			"FROM pg_catalog.pg_replication_slots";
+
+	res = PQexec(conn, query);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "Unable to query pg_replication_slots: %s",
+				PQerrorMessage(conn));
+		PQclear(res);
+		PQfinish(conn);
+		return NULL;
+	}
+
+	PQfinish(conn);
+
+	row_cnt = PQntuples(res);
+
+	live_slots = pg_malloc(sizeof(LiveSlotSet));
+	live_slots->res = res;
+	live_slots->by_name = NameHashCreate(row_cnt);
+	live_slots->matched = pg_malloc0(Max(row_cnt, 1) * sizeof(bool));
+
+	/* the names stay in the result for as long as the hash table needs them */
+	for (i = 0; i < row_cnt; i++)
+		NameHashInsert(live_slots->by_name,
+					   PQgetvalue(res, i, LIVE_COL_SLOT_NAME), i);
+
+	return live_slots;
+}
+
+
+/*
+ * Set the live fields of a slot read from disk from its row in
+ * pg_replication_slots, if it has one.  May be called from several
+ * threads at once, for different slots.
+ */
+void
+CompareLiveSlot(LiveSlotSet *live_slots, ReplslotInfo *replslot_info)
+{
+	int			row = NameHashLookup(live_slots->by_name, replslot_info->name);
+	PGresult   *res = live_slots->res;
+
+	replslot_info->live_known = true;
+	replslot_info->live_found = row >= 0;
+
+	if (row < 0)
+		return;
+
+	live_slots->matched[row] = true;
+
+	replslot_info->live_active = strcmp(PQgetvalue(res, row, LIVE_COL_ACTIVE), "t") == 0;
+	replslot_info->live_restart_lsn = ParseLsn(PQgetvalue(res, row, LIVE_COL_RESTART_LSN));
+	replslot_info->live_confirmed_flush = ParseLsn(PQgetvalue(res, row, LIVE_COL_CONFIRMED_FLUSH));
+}
+
+
+/*
+ * Report the slots in pg_replication_slots which no slot read from disk
+ * was compared with: temporary slots, which never have a state file, and
+ * slots whose state file couldn't be parsed.
+ */
+void
+ReportUnmatchedLiveSlots(const LiveSlotSet *live_slots, FILE *fp)
+{
+	int			i;
+
+	for (i = 0; i < PQntuples(live_slots->res); i++)
+	{
+		if (live_slots->matched[i])
+			continue;
+
+		fprintf(fp, "Slot \"%s\" is in pg_replication_slots but has no valid state file\n",
+				PQgetvalue(live_slots->res, i, LIVE_COL_SLOT_NAME));
+	}
+}
+
+
+void
+FreeLiveSlots(LiveSlotSet *live_slots)
+{
+	NameHashFree(live_slots->by_name);
+	PQclear(live_slots->res);
+	pg_free(live_slots->matched);
+	pg_free(live_slots);
+}
+
+
+/*
+ * Parse an LSN as output by pg_lsn_out(); NULL, which is returned as an
+ * empty string, is InvalidXLogRecPtr.
+ */
+static XLogRecPtr
+ParseLsn(const char *str)
+{
+	uint32		hi;
+	uint32		lo;
+
+	if (sscanf(str, "%X/%X", &hi, &lo) != 2)
+		return InvalidXLogRecPtr;
+
+	return ((XLogRecPtr) hi << 32) | lo;
+}
@@ -0,0 +1,1969 @@
+/*
+ * output.c
+ *
+ * Report formatting for pg_replslot_reader.
+ *
+ * Apart from the default human-readable report, slots can be written as
+ * JSON, CSV or TSV.  All of these are rendered into a single output buffer
+ * which is written out with write() whenever it fills, so each slot can be
+ * emitted as soon as it has been read without the report as a whole being
+ * held in memory, and a report of many thousands of slots takes a few
+ * large writes rather than several stdio calls per slot.  Anything written
+ * to stdout with stdio is flushed before the buffer is.
+ *
+ * The Prometheus text exposition format is the exception, as each metric's
+ * samples for all slots must be grouped together; those slots are kept
+ * until the end of the report.
+ *
+ * With --output, the report is written to a temporary file which is then
+ * renamed over the target, so a reader never sees a partial report.
+ *
+ * OutputToBuffer() instead renders a complete report into memory, for
+ * --daemon to serve.
+ *
+ * A --diff report is started with OutputDiffBegin() instead, and has a
+ * row for each changed slot rather than each slot.  OutputSummary()
+ * writes a complete --summary report, with a row for each data directory.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pg_replslot_reader.h"
+
+#define OUTPUT_BUFSIZE 65536
+
+/* the values of a --summary written as Prometheus metrics */
+typedef enum SummaryField
+{
+	SUMMARY_SLOTS,
+	SUMMARY_UNPARSED,
+	SUMMARY_RESTART_LSN,
+	SUMMARY_XMIN,
+	SUMMARY_CATALOG_XMIN
+} SummaryField;
+
+static void EmitFlush(void);
+static void EmitBytes(const char *data, size_t len);
+static void EmitRepeated(char c, size_t cnt);
+static void EmitString(const char *str);
+static void EmitPrintf(const char *fmt,...) pg_attribute_printf(1, 2);
+static void EmitJsonString(const char *str);
+static void EmitCsvField(const char *str);
+static void EmitTsvField(const char *str);
+static void EmitField(const char *str, bool first);
+static void EmitJsonXid(TransactionId xid);
+static void EmitJsonLsn(XLogRecPtr lsn);
+static void FormatXid(char *buf, size_t len, TransactionId xid);
+static void FormatLsn(char *buf, size_t len, XLogRecPtr lsn);
+static bool LiveLsnAhead(XLogRecPtr live_lsn, XLogRecPtr lsn, int64 *ahead);
+static void EmitJsonLiveAhead(XLogRecPtr live_lsn, XLogRecPtr lsn);
+static void OutputLiveLsnText(const char *label, XLogRecPtr live_lsn, XLogRecPtr lsn);
+static void OutputSlotText(const ReplslotInfo *ptr);
+static void OutputDiffText(const ReplslotDiff *diff);
+static void OutputDiffLsnText(const char *label, XLogRecPtr old_lsn, XLogRecPtr lsn);
+static void OutputDiffXidText(const char *label, TransactionId old_xid, TransactionId xid);
+static void EmitDiffHeader(const char *name, const char *unit);
+static void EmitDiffLsn(const char *name, XLogRecPtr old_lsn, XLogRecPtr lsn);
+static void EmitDiffXid(const char *name, TransactionId old_xid, TransactionId xid);
+static void FormatRate(char *buf, size_t len, int64 delta);
+static void OutputSummaryText(const SlotHorizons *horizons);
+static void EmitSummaryPrometheus(const SlotHorizons *horizons, int horizons_cnt,
+								  const char *name, const char *help, SummaryField field);
+static void OutputPrometheus(void);
+static void EmitPrometheusLabels(const ReplslotInfo *ptr);
+static void EmitPrometheusLabelValue(const char *str);
+static void OpenOutputFile(void);
+static void CloseOutputFile(void);
+
+/*
+ * A gauge written for each slot in the Prometheus format; "get" returns
+ * false if the slot has no value for it.
+ */
+typedef struct PrometheusMetric
+{
+	const char *name;
+	const char *help;
+	bool		(*get) (const ReplslotInfo *ptr, uint64 *value);
+} PrometheusMetric;
+
+static bool GetParsed(const ReplslotInfo *ptr, uint64 *value);
+static bool GetRestartLsn(const ReplslotInfo *ptr, uint64 *value);
+static bool GetConfirmedFlush(const ReplslotInfo *ptr, uint64 *value);
+static bool GetXmin(const ReplslotInfo *ptr, uint64 *value);
+static bool GetCatalogXmin(const ReplslotInfo *ptr, uint64 *value);
+static bool GetPersistent(const ReplslotInfo *ptr, uint64 *value);
+static bool GetTwoPhase(const ReplslotInfo *ptr, uint64 *value);
+static bool GetFailover(const ReplslotInfo *ptr, uint64 *value);
+static bool GetSynced(const ReplslotInfo *ptr, uint64 *value);
+static bool GetInvalidated(const ReplslotInfo *ptr, uint64 *value);
+static bool GetWalRetainedBytes(const ReplslotInfo *ptr, uint64 *value);
+static bool GetWalSegmentMissing(const ReplslotInfo *ptr, uint64 *value);
+static bool GetWalArchiveMissing(const ReplslotInfo *ptr, uint64 *value);
+static bool GetLiveActive(const ReplslotInfo *ptr, uint64 *value);
+static bool GetLiveRestartLsnAhead(const ReplslotInfo *ptr, uint64 *value);
+static bool GetLiveConfirmedFlushAhead(const ReplslotInfo *ptr, uint64 *value);
+static bool GetSpillFiles(const ReplslotInfo *ptr, uint64 *value);
+static bool GetSpillBytes(const ReplslotInfo *ptr, uint64 *value);
+
+static const PrometheusMetric prometheus_metrics[] = {
+	{"pg_replslot_state_file_valid",
+	 "Whether the slot's state file could be read and parsed", GetParsed},
+	{"pg_replslot_restart_lsn_bytes",
+	 "restart_lsn of the slot, as a WAL byte position", GetRestartLsn},
+	{"pg_replslot_confirmed_flush_lsn_bytes",
+	 "confirmed_flush_lsn of the logical slot, as a WAL byte position", GetConfirmedFlush},
+	{"pg_replslot_xmin",
+	 "xmin of the slot", GetXmin},
+	{"pg_replslot_catalog_xmin",
+	 "catalog_xmin of the slot", GetCatalogXmin},
+	{"pg_replslot_persistent",
+	 "Whether the slot is persistent rather than ephemeral", GetPersistent},
+	{"pg_replslot_two_phase",
+	 "Whether the logical slot decodes prepared transactions (PostgreSQL 14 and later)", GetTwoPhase},
+	{"pg_replslot_failover",
+	 "Whether the logical slot is synchronized to standbys (PostgreSQL 17 and later)", GetFailover},
+	{"pg_replslot_synced",
+	 "Whether the slot was synchronized from the primary (PostgreSQL 17 and later)", GetSynced},
+	{"pg_replslot_invalidated",
+	 "Whether the slot has been invalidated and can no longer be used", GetInvalidated},
+	{"pg_replslot_wal_retained_bytes",
+	 "Bytes of WAL in pg_wal retained by the slot", GetWalRetainedBytes},
+	{"pg_replslot_wal_segment_missing",
+	 "Whether the oldest WAL segment the slot requires has been removed", GetWalSegmentMissing},
+	{"pg_replslot_wal_archive_missing",
+	 "Whether the oldest WAL segment the slot requires is absent from the WAL archive", GetWalArchiveMissing},
+	{"pg_replslot_live_active",
+	 "Whether the slot is active on the running server", GetLiveActive},
+	{"pg_replslot_live_restart_lsn_ahead_bytes",
+	 "Bytes the server's restart_lsn is ahead of the state file's", GetLiveRestartLsnAhead},
+	{"pg_replslot_live_confirmed_flush_lsn_ahead_bytes",
+	 "Bytes the server's confirmed_flush_lsn is ahead of the state file's", GetLiveConfirmedFlushAhead},
+	{"pg_replslot_spill_files",
+	 "Number of transaction spill files in the slot's directory", GetSpillFiles},
+	{"pg_replslot_spill_bytes",
+	 "Total size of the transaction spill files in the slot's directory", GetSpillBytes},
+	{NULL, NULL, NULL}
+};
+
+const char *output_path = NULL;
+
+OutputFormat output_format = OUTPUT_TEXT;
+
+static char output_buf[OUTPUT_BUFSIZE];
+static size_t output_len = 0;
+static int	output_slot_cnt = 0;
+static int	output_fd = STDOUT_FILENO;
+static char output_tmp_path[MAXPGPATH];
+static ReplslotArray prometheus_slots;
+static PQExpBuffer output_capture = NULL;
+static double diff_elapsed = 0;
+
+
+/*
+ * Parse the argument to --format; returns false if not recognized.
+ */
+bool
+ParseOutputFormat(const char *name, OutputFormat *format)
+{
+	if (strcmp(name, "text") == 0)
+		*format = OUTPUT_TEXT;
+	else if (strcmp(name, "json") == 0)
+		*format = OUTPUT_JSON;
+	else if (strcmp(name, "csv") == 0)
+		*format = OUTPUT_CSV;
+	else if (strcmp(name, "tsv") == 0)
+		*format = OUTPUT_TSV;
+	else if (strcmp(name, "prometheus") == 0)
+		*format = OUTPUT_PROMETHEUS;
+	else
+		return false;
+
+	return true;
+}
+
+
+/*
+ * Start a report of "slot_cnt" slots.
+ */
+void
+OutputBegin(int slot_cnt)
+{
+	output_slot_cnt = 0;
+
+	OpenOutputFile();
+
+	switch (output_format)
+	{
+		case OUTPUT_TEXT:
+			if (slot_cnt == 0)
+				EmitString("No replication slots found\n");
+			else if (cluster_cnt > 1)
+				EmitPrintf("%i replication slot(s) found in %i data directories\n\n",
+						   slot_cnt, cluster_cnt);
+			else
+				EmitPrintf("%i replication slot(s) found\n\n", slot_cnt);
+			break;
+		case OUTPUT_JSON:
+			EmitString("[");
+			break;
+		case OUTPUT_CSV:
+		case OUTPUT_TSV:
+			/* slots are only attributed to a data directory if there are several */
+			if (cluster_cnt > 1)
+				EmitField("cluster", true);
+			EmitField("name", cluster_cnt <= 1);
+			EmitField("parsed", false);
+			EmitField("type", false);
+			EmitField("db_oid", false);
+			EmitField("persistency", false);
+			EmitField("version", false);
+			EmitField("length", false);
+			EmitField("xmin", false);
+			EmitField("catalog_xmin", false);
+			EmitField("restart_lsn", false);
+			EmitField("confirmed_flush", false);
+			EmitField("plugin", false);
+			EmitField("two_phase", false);
+			EmitField("two_phase_at", false);
+			EmitField("synced", false);
+			EmitField("failover", false);
+			EmitField("invalidation_reason", false);
+			if (wal_retention)
+			{
+				EmitField("wal_retained_bytes", false);
+				EmitField("oldest_wal_segment", false);
+				EmitField("wal_segment_missing", false);
+			}
+			if (wal_archive != NULL)
+			{
+				EmitField("archive_wal_segment", false);
+				EmitField("wal_archive_missing", false);
+			}
+			if (compare_live)
+			{
+				EmitField("live_found", false);
+				EmitField("live_active", false);
+				EmitField("live_restart_lsn", false);
+				EmitField("restart_lsn_ahead_bytes", false);
+				EmitField("live_confirmed_flush", false);
+				EmitField("confirmed_flush_ahead_bytes", false);
+			}
+			if (spill_files)
+			{
+				EmitField("spill_files", false);
+				EmitField("spill_bytes", false);
+				EmitField("spill_min_lsn", false);
+				EmitField("spill_max_lsn", false);
+			}
+			if (db_names)
+				EmitField("db_name", false);
+			EmitField("error", false);
+			EmitString("\n");
+			break;
+		case OUTPUT_PROMETHEUS:
+			ReplslotArrayInit(&prometheus_slots, slot_cnt);
+			break;
+	}
+}
+
+
+/*
+ * Start a report of slots which have changed since the last one, as
+ * produced by --watch; unlike OutputBegin(), no header is repeated.
+ */
+void
+OutputUpdateBegin(void)
+{
+	output_slot_cnt = 0;
+
+	OpenOutputFile();
+
+	if (output_format == OUTPUT_JSON)
+		EmitString("[");
+	else if (output_format == OUTPUT_PROMETHEUS)
+		ReplslotArrayInit(&prometheus_slots, 16);
+}
+
+
+/*
+ * Write out a single slot.
+ */
+void
+OutputSlot(const ReplslotInfo *ptr)
+{
+	const char *type = ptr->type == RS_PHYSICAL ? "physical" : "logical";
+	const char *persistency = ptr->persistency == RS_PERSISTENT ? "persistent" : "ephemeral";
+
+	switch (output_format)
+	{
+		case OUTPUT_TEXT:
+			OutputSlotText(ptr);
+			break;
+		case OUTPUT_JSON:
+			EmitString(output_slot_cnt == 0 ? "\n  {" : ",\n  {");
+			if (cluster_cnt > 1)
+			{
+				EmitString("\"cluster\": ");
+				EmitJsonString(ptr->cluster->datadir);
+				EmitString(", ");
+			}
+			EmitString("\"name\": ");
+			EmitJsonString(ptr->name);
+
+			if (ptr->slotfile_parsed == false)
+			{
+				EmitString(", \"parsed\": false, \"error\": ");
+				EmitJsonString(ptr->error);
+			}
+			else
+			{
+				EmitPrintf(", \"parsed\": true, \"type\": \"%s\"", type);
+
+				if (ptr->type == RS_LOGICAL)
+					EmitPrintf(", \"db_oid\": %u", ptr->db_oid);
+				else
+					EmitString(", \"db_oid\": null");
+
+				if (db_names)
+				{
+					EmitString(", \"db_name\": ");
+					if (ptr->db_name != NULL)
+						EmitJsonString(ptr->db_name);
+					else
+						EmitString("null");
+				}
+
+				EmitPrintf(", \"persistency\": \"%s\", \"version\": %u, \"length\": %u",
+						   persistency, ptr->version, ptr->length);
+
+				EmitString(", \"xmin\": ");
+				EmitJsonXid(ptr->xmin);
+				EmitString(", \"catalog_xmin\": ");
+				EmitJsonXid(ptr->catalog_xmin);
+				EmitString(", \"restart_lsn\": ");
+				EmitJsonLsn(ptr->restart_lsn);
+				EmitString(", \"confirmed_flush\": ");
+				EmitJsonLsn(ptr->confirmed_flush);
+				EmitString(", \"plugin\": ");
+				if (ptr->type == RS_LOGICAL)
+					EmitJsonString(ptr->plugin);
+				else
+					EmitString("null");
+
+				/* fields only some state file formats have */
+				if (ptr->version >= SLOT_VERSION_TWO_PHASE)
+				{
+					EmitPrintf(", \"two_phase\": %s, \"two_phase_at\": ",
+							   ptr->two_phase ? "true" : "false");
+					EmitJsonLsn(ptr->two_phase_at);
+				}
+				if (ptr->version >= SLOT_VERSION_FAILOVER)
+					EmitPrintf(", \"synced\": %s, \"failover\": %s",
+							   ptr->synced ? "true" : "false",
+							   ptr->failover ? "true" : "false");
+
+				EmitString(", \"invalidation_reason\": ");
+				if (ptr->invalidated != RS_INVAL_NONE)
+					EmitJsonString(InvalidationCauseName(ptr->invalidated));
+				else
+					EmitString("null");
+
+				if (ptr->wal_retention_known)
+				{
+					EmitPrintf(", \"wal_retained_bytes\": " UINT64_FORMAT,
+							   ptr->wal_retained_bytes);
+					EmitString(", \"oldest_wal_segment\": ");
+					if (*ptr->oldest_wal_segment != '\0')
+						EmitJsonString(ptr->oldest_wal_segment);
+					else
+						EmitString("null");
+					EmitPrintf(", \"wal_segment_missing\": %s",
+							   ptr->wal_segment_missing ? "true" : "false");
+				}
+
+				if (ptr->wal_archive_known)
+				{
+					EmitString(", \"archive_wal_segment\": ");
+					if (*ptr->archive_wal_segment != '\0')
+						EmitJsonString(ptr->archive_wal_segment);
+					else
+						EmitString("null");
+					EmitPrintf(", \"wal_archive_missing\": %s",
+							   ptr->wal_archive_missing ? "true" : "false");
+				}
+
+				if (ptr->live_known)
+				{
+					EmitPrintf(", \"live_found\": %s",
+							   ptr->live_found ? "true" : "false");
+				}
+
+				if (ptr->live_found)
+				{
+					EmitPrintf(", \"live_active\": %s",
+							   ptr->live_active ? "true" : "false");
+					EmitString(", \"live_restart_lsn\": ");
+					EmitJsonLsn(ptr->live_restart_lsn);
+					EmitString(", \"restart_lsn_ahead_bytes\": ");
+					EmitJsonLiveAhead(ptr->live_restart_lsn, ptr->restart_lsn);
+					EmitString(", \"live_confirmed_flush\": ");
+					EmitJsonLsn(ptr->live_confirmed_flush);
+					EmitString(", \"confirmed_flush_ahead_bytes\": ");
+					EmitJsonLiveAhead(ptr->live_confirmed_flush, ptr->confirmed_flush);
+				}
+
+				if (ptr->spill_known)
+				{
+					EmitPrintf(", \"spill_files\": " UINT64_FORMAT ", \"spill_bytes\": " UINT64_FORMAT,
+							   ptr->spill_file_cnt, ptr->spill_bytes);
+					EmitString(", \"spill_min_lsn\": ");
+					EmitJsonLsn(ptr->spill_min_lsn);
+					EmitString(", \"spill_max_lsn\": ");
+					EmitJsonLsn(ptr->spill_max_lsn);
+				}
+			}
+			EmitString("}");
+			break;
+		case OUTPUT_CSV:
+		case OUTPUT_TSV:
+			{
+				char		numbuf[32];
+
+				if (cluster_cnt > 1)
+					EmitField(ptr->cluster->datadir, true);
+				EmitField(ptr->name, cluster_cnt <= 1);
+				EmitField(ptr->slotfile_parsed ? "true" : "false", false);
+
+				if (ptr->slotfile_parsed == false)
+				{
+					int			field_cnt = 15;
+					int			i;
+
+					/* type through invalidation_reason, and any optional fields shown */
+					if (wal_retention)
+						field_cnt += 3;
+					if (wal_archive != NULL)
+						field_cnt += 2;
+					if (compare_live)
+						field_cnt += 6;
+					if (spill_files)
+						field_cnt += 4;
+					if (db_names)
+						field_cnt += 1;
+
+					for (i = 0; i < field_cnt; i++)
+						EmitField("", false);
+					EmitField(ptr->error, false);
+				}
+				else
+				{
+					EmitField(type, false);
+
+					if (ptr->type == RS_LOGICAL)
+						snprintf(numbuf, sizeof(numbuf), "%u", ptr->db_oid);
+					else
+						numbuf[0] = '\0';
+					EmitField(numbuf, false);
+
+					EmitField(persistency, false);
+					snprintf(numbuf, sizeof(numbuf), "%u", ptr->version);
+					EmitField(numbuf, false);
+					snprintf(numbuf, sizeof(numbuf), "%u", ptr->length);
+					EmitField(numbuf, false);
+
+					FormatXid(numbuf, sizeof(numbuf), ptr->xmin);
+					EmitField(numbuf, false);
+					FormatXid(numbuf, sizeof(numbuf), ptr->catalog_xmin);
+					EmitField(numbuf, false);
+					FormatLsn(numbuf, sizeof(numbuf), ptr->restart_lsn);
+					EmitField(numbuf, false);
+					FormatLsn(numbuf, sizeof(numbuf), ptr->confirmed_flush);
+					EmitField(numbuf, false);
+					EmitField(ptr->type == RS_LOGICAL ? ptr->plugin : "", false);
+					if (ptr->version >= SLOT_VERSION_TWO_PHASE)
+					{
+						EmitField(ptr->two_phase ? "true" : "false", false);
+						FormatLsn(numbuf, sizeof(numbuf), ptr->two_phase_at);
+						EmitField(numbuf, false);
+					}
+					else
+					{
+						EmitField("", false);
+						EmitField("", false);
+					}
+					if (ptr->version >= SLOT_VERSION_FAILOVER)
+					{
+						EmitField(ptr->synced ? "true" : "false", false);
+						EmitField(ptr->failover ? "true" : "false", false);
+					}
+					else
+					{
+						EmitField("", false);
+						EmitField("", false);
+					}
+					EmitField(ptr->invalidated != RS_INVAL_NONE ?
+							  InvalidationCauseName(ptr->invalidated) : "", false);
+					if (wal_retention && ptr->wal_retention_known)
+					{
+						snprintf(numbuf, sizeof(numbuf), UINT64_FORMAT,
+								 ptr->wal_retained_bytes);
+						EmitField(numbuf, false);
+						EmitField(ptr->oldest_wal_segment, false);
+						EmitField(ptr->wal_segment_missing ? "true" : "false", false);
+					}
+					else if (wal_retention)
+					{
+						EmitField("", false);
+						EmitField("", false);
+						EmitField("", false);
+					}
+					if (wal_archive != NULL)
+					{
+						EmitField(ptr->archive_wal_segment, false);
+						EmitField(ptr->wal_archive_missing ? "true" : "false", false);
+					}
+					if (compare_live)
+					{
+						int64		ahead;
+
+						EmitField(!ptr->live_known ? "" : ptr->live_found ? "true" : "false", false);
+						EmitField(!ptr->live_found ? "" : ptr->live_active ? "true" : "false", false);
+
+						FormatLsn(numbuf, sizeof(numbuf), ptr->live_restart_lsn);
+						EmitField(ptr->live_found ? numbuf : "", false);
+						if (ptr->live_found &&
+							LiveLsnAhead(ptr->live_restart_lsn, ptr->restart_lsn, &ahead))
+							snprintf(numbuf, sizeof(numbuf), INT64_FORMAT, ahead);
+						else
+							numbuf[0] = '\0';
+						EmitField(numbuf, false);
+
+						FormatLsn(numbuf, sizeof(numbuf), ptr->live_confirmed_flush);
+						EmitField(ptr->live_found ? numbuf : "", false);
+						if (ptr->live_found &&
+							LiveLsnAhead(ptr->live_confirmed_flush, ptr->confirmed_flush, &ahead))
+							snprintf(numbuf, sizeof(numbuf), INT64_FORMAT, ahead);
+						else
+							numbuf[0] = '\0';
+						EmitField(numbuf, false);
+					}
+					if (spill_files)
+					{
+						if (ptr->spill_known)
+							snprintf(numbuf, sizeof(numbuf), UINT64_FORMAT, ptr->spill_file_cnt);
+						else
+							numbuf[0] = '\0';
+						EmitField(numbuf, false);
+						if (ptr->spill_known)
+							snprintf(numbuf, sizeof(numbuf), UINT64_FORMAT, ptr->spill_bytes);
+						EmitField(numbuf, false);
+						if (ptr->spill_known)
+							FormatLsn(numbuf, sizeof(numbuf), ptr->spill_min_lsn);
+						EmitField(numbuf, false);
+						if (ptr->spill_known)
+							FormatLsn(numbuf, sizeof(numbuf), ptr->spill_max_lsn);
+						EmitField(numbuf, false);
+					}
+					if (db_names)
+						EmitField(ptr->db_name != NULL ? ptr->db_name : "", false);
+					EmitField("", false);
+				}
+				EmitString("\n");
+			}
+			break;
+		case OUTPUT_PROMETHEUS:
+			*ReplslotArrayExtend(&prometheus_slots, 1) = *ptr;
+			break;
+	}
+
+	output_slot_cnt++;
+}
+
+
+/*
+ * Finish the report and write out anything still buffered.
+ */
+void
+OutputEnd(void)
+{
+	switch (output_format)
+	{
+		case OUTPUT_TEXT:
+			if (output_slot_cnt > 0)
+				EmitString("\n");
+			break;
+		case OUTPUT_JSON:
+			EmitString(output_slot_cnt == 0 ? "]\n" : "\n]\n");
+			break;
+		case OUTPUT_CSV:
+		case OUTPUT_TSV:
+			break;
+		case OUTPUT_PROMETHEUS:
+			OutputPrometheus();
+			ReplslotArrayFree(&prometheus_slots);
+			break;
+	}
+
+	EmitFlush();
+	fflush(stdout);
+
+	CloseOutputFile();
+}
+
+
+/*
+ * Start a --diff report of "diff_cnt" slots changed over the "elapsed"
+ * seconds since the snapshot was taken.  The Prometheus format isn't
+ * supported.
+ */
+void
+OutputDiffBegin(int diff_cnt, double elapsed)
+{
+	output_slot_cnt = 0;
+	diff_elapsed = elapsed;
+
+	OpenOutputFile();
+
+	switch (output_format)
+	{
+		case OUTPUT_TEXT:
+			if (diff_cnt == 0)
+				EmitPrintf("No replication slots changed in %.1f s\n", elapsed);
+			else
+				EmitPrintf("%i replication slot(s) changed in %.1f s\n\n", diff_cnt, elapsed);
+			break;
+		case OUTPUT_JSON:
+			EmitString("[");
+			break;
+		case OUTPUT_CSV:
+		case OUTPUT_TSV:
+			EmitField("name", true);
+			EmitField("change", false);
+			EmitField("type", false);
+			EmitDiffHeader("restart_lsn", "bytes");
+			EmitDiffHeader("confirmed_flush", "bytes");
+			EmitDiffHeader("xmin", NULL);
+			EmitDiffHeader("catalog_xmin", NULL);
+			EmitString("\n");
+			break;
+		case OUTPUT_PROMETHEUS:
+			break;
+	}
+}
+
+
+/*
+ * Write out a single changed slot of a --diff report.
+ */
+void
+OutputDiff(const ReplslotDiff *diff)
+{
+	const char *change = diff->change == SLOT_CREATED ? "created" :
+		diff->change == SLOT_DROPPED ? "dropped" : "changed";
+	const char *type = diff->type == RS_PHYSICAL ? "physical" : "logical";
+
+	switch (output_format)
+	{
+		case OUTPUT_TEXT:
+			OutputDiffText(diff);
+			break;
+		case OUTPUT_JSON:
+			EmitString(output_slot_cnt == 0 ? "\n  {" : ",\n  {");
+			EmitString("\"name\": ");
+			EmitJsonString(diff->name);
+			EmitPrintf(", \"change\": \"%s\", \"type\": \"%s\"", change, type);
+			EmitDiffLsn("restart_lsn", diff->old_restart_lsn, diff->restart_lsn);
+			EmitDiffLsn("confirmed_flush", diff->old_confirmed_flush, diff->confirmed_flush);
+			EmitDiffXid("xmin", diff->old_xmin, diff->xmin);
+			EmitDiffXid("catalog_xmin", diff->old_catalog_xmin, diff->catalog_xmin);
+			EmitString("}");
+			break;
+		case OUTPUT_CSV:
+		case OUTPUT_TSV:
+			EmitField(diff->name, true);
+			EmitField(change, false);
+			EmitField(type, false);
+			EmitDiffLsn("restart_lsn", diff->old_restart_lsn, diff->restart_lsn);
+			EmitDiffLsn("confirmed_flush", diff->old_confirmed_flush, diff->confirmed_flush);
+			EmitDiffXid("xmin", diff->old_xmin, diff->xmin);
+			EmitDiffXid("catalog_xmin", diff->old_catalog_xmin, diff->catalog_xmin);
+			EmitString("\n");
+			break;
+		case OUTPUT_PROMETHEUS:
+			break;
+	}
+
+	output_slot_cnt++;
+}
+
+
+/*
+ * Write a --summary report of the oldest horizons in each data directory
+ * which could be scanned.
+ */
+void
+OutputSummary(const SlotHorizons *horizons, int horizons_cnt)
+{
+	bool		first = true;
+	char		numbuf[32];
+	int			i;
+
+	OpenOutputFile();
+
+	switch (output_format)
+	{
+		case OUTPUT_TEXT:
+			break;
+		case OUTPUT_JSON:
+			EmitString("[");
+			break;
+		case OUTPUT_CSV:
+		case OUTPUT_TSV:
+			if (cluster_cnt > 1)
+				EmitField("cluster", true);
+			EmitField("slots", cluster_cnt <= 1);
+			EmitField("unparsed", false);
+			EmitField("restart_lsn", false);
+			EmitField("restart_lsn_slot", false);
+			EmitField("xmin", false);
+			EmitField("xmin_slot", false);
+			EmitField("catalog_xmin", false);
+			EmitField("catalog_xmin_slot", false);
+			EmitString("\n");
+			break;
+		case OUTPUT_PROMETHEUS:
+			EmitSummaryPrometheus(horizons, horizons_cnt, "pg_replslot_slots",
+								  "Number of slots", SUMMARY_SLOTS);
+			EmitSummaryPrometheus(horizons, horizons_cnt, "pg_replslot_unparsed_slots",
+								  "Number of slots whose state file couldn't be parsed",
+								  SUMMARY_UNPARSED);
+			EmitSummaryPrometheus(horizons, horizons_cnt, "pg_replslot_oldest_restart_lsn_bytes",
+								  "Oldest restart_lsn of any slot, as a WAL byte position",
+								  SUMMARY_RESTART_LSN);
+			EmitSummaryPrometheus(horizons, horizons_cnt, "pg_replslot_oldest_xmin",
+								  "Oldest xmin of any slot", SUMMARY_XMIN);
+			EmitSummaryPrometheus(horizons, horizons_cnt, "pg_replslot_oldest_catalog_xmin",
+								  "Oldest catalog_xmin of any slot", SUMMARY_CATALOG_XMIN);
+			break;
+	}
+
+	for (i = 0; i < horizons_cnt; i++)
+	{
+		const SlotHorizons *ptr = &horizons[i];
+
+		if (!ptr->cluster->valid)
+			continue;
+
+		switch (output_format)
+		{
+			case OUTPUT_TEXT:
+				OutputSummaryText(ptr);
+				break;
+			case OUTPUT_JSON:
+				EmitString(first ? "\n  {" : ",\n  {");
+				if (cluster_cnt > 1)
+				{
+					EmitString("\"cluster\": ");
+					EmitJsonString(ptr->cluster->datadir);
+					EmitString(", ");
+				}
+				EmitPrintf("\"slots\": %i, \"unparsed\": %i", ptr->slot_cnt, ptr->unparsed_cnt);
+				EmitString(", \"restart_lsn\": ");
+				EmitJsonLsn(ptr->restart_lsn);
+				EmitString(", \"restart_lsn_slot\": ");
+				if (!XLogRecPtrIsInvalid(ptr->restart_lsn))
+					EmitJsonString(ptr->restart_lsn_slot);
+				else
+					EmitString("null");
+				EmitString(", \"xmin\": ");
+				EmitJsonXid(ptr->xmin);
+				EmitString(", \"xmin_slot\": ");
+				if (TransactionIdIsValid(ptr->xmin))
+					EmitJsonString(ptr->xmin_slot);
+				else
+					EmitString("null");
+				EmitString(", \"catalog_xmin\": ");
+				EmitJsonXid(ptr->catalog_xmin);
+				EmitString(", \"catalog_xmin_slot\": ");
+				if (TransactionIdIsValid(ptr->catalog_xmin))
+					EmitJsonString(ptr->catalog_xmin_slot);
+				else
+					EmitString("null");
+				EmitString("}");
+				break;
+			case OUTPUT_CSV:
+			case OUTPUT_TSV:
+				if (cluster_cnt > 1)
+					EmitField(ptr->cluster->datadir, true);
+				snprintf(numbuf, sizeof(numbuf), "%i", ptr->slot_cnt);
+				EmitField(numbuf, cluster_cnt <= 1);
+				snprintf(numbuf, sizeof(numbuf), "%i", ptr->unparsed_cnt);
+				EmitField(numbuf, false);
+				FormatLsn(numbuf, sizeof(numbuf), ptr->restart_lsn);
+				EmitField(numbuf, false);
+				EmitField(numbuf[0] != '\0' ? ptr->restart_lsn_slot : "", false);
+				FormatXid(numbuf, sizeof(numbuf), ptr->xmin);
+				EmitField(numbuf, false);
+				EmitField(numbuf[0] != '\0' ? ptr->xmin_slot : "", false);
+				FormatXid(numbuf, sizeof(numbuf), ptr->catalog_xmin);
+				EmitField(numbuf, false);
+				EmitField(numbuf[0] != '\0' ? ptr->catalog_xmin_slot : "", false);
+				EmitString("\n");
+				break;
+			case OUTPUT_PROMETHEUS:
+				break;
+		}
+
+		first = false;
+	}
+
+	if (output_format == OUTPUT_JSON)
+		EmitString(first ? "]\n" : "\n]\n");
+
+	EmitFlush();
+	fflush(stdout);
+
+	CloseOutputFile();
+}
+
+
+/*
+ * Render a complete report of the slots in "array" in "format", which
+ * must not be OUTPUT_TEXT, and append it to "buf" rather than writing it
+ * out.
+ */
+void
+OutputToBuffer(const ReplslotArray *array, OutputFormat format, PQExpBuffer buf)
+{
+	OutputFormat saved_format = output_format;
+	const char *saved_path = output_path;
+	int			i;
+
+	output_format = format;
+	output_path = NULL;
+	output_capture = buf;
+
+	OutputBegin(array->slot_cnt);
+
+	for (i = 0; i < array->slot_cnt; i++)
+		OutputSlot(&array->slots[i]);
+
+	OutputEnd();
+
+	output_capture = NULL;
+	output_format = saved_format;
+	output_path = saved_path;
+}
+
+
+/*
+ * Write a --summary metric, with a sample for each data directory which
+ * has a value for it; the oldest horizons are labelled with the slot
+ * holding them.
+ */
+static void
+EmitSummaryPrometheus(const SlotHorizons *horizons, int horizons_cnt,
+					  const char *name, const char *help, SummaryField field)
+{
+	bool		header_done = false;
+	int			i;
+
+	for (i = 0; i < horizons_cnt; i++)
+	{
+		const SlotHorizons *ptr = &horizons[i];
+		const char *slot_name = NULL;
+		uint64		value;
+
+		if (!ptr->cluster->valid)
+			continue;
+
+		switch (field)
+		{
+			case SUMMARY_SLOTS:
+				value = ptr->slot_cnt;
+				break;
+			case SUMMARY_UNPARSED:
+				value = ptr->unparsed_cnt;
+				break;
+			case SUMMARY_RESTART_LSN:
+				value = ptr->restart_lsn;
+				slot_name = ptr->restart_lsn_slot;
+				if (XLogRecPtrIsInvalid(ptr->restart_lsn))
+					continue;
+				break;
+			case SUMMARY_XMIN:
+				value = ptr->xmin;
+				slot_name = ptr->xmin_slot;
+				if (!TransactionIdIsValid(ptr->xmin))
+					continue;
+				break;
+			case SUMMARY_CATALOG_XMIN:
+			default:
+				value = ptr->catalog_xmin;
+				slot_name = ptr->catalog_xmin_slot;
+				if (!TransactionIdIsValid(ptr->catalog_xmin))
+					continue;
+				break;
+		}
+
+		if (!header_done)
+		{
+			EmitPrintf("# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+			header_done = true;
+		}
+
+		EmitString(name);
+
+		if (cluster_cnt > 1 || slot_name != NULL)
+		{
+			EmitString("{");
+			if (cluster_cnt > 1)
+			{
+				EmitString("cluster=");
+				EmitPrometheusLabelValue(ptr->cluster->datadir);
+				if (slot_name != NULL)
+					EmitString(",");
+			}
+			if (slot_name != NULL)
+			{
+				EmitString("slot=");
+				EmitPrometheusLabelValue(slot_name);
+			}
+			EmitString("}");
+		}
+
+		EmitPrintf(" " UINT64_FORMAT "\n", value);
+	}
+}
+
+
+/*
+ * Write each metric, with its samples for every slot, in the Prometheus
+ * text exposition format.  Metrics no slot has a value for are omitted.
+ */
+static void
+OutputPrometheus(void)
+{
+	const PrometheusMetric *metric;
+
+	for (metric = prometheus_metrics; metric->name != NULL; metric++)
+	{
+		bool		header_done = false;
+		int			i;
+
+		for (i = 0; i < prometheus_slots.slot_cnt; i++)
+		{
+			const ReplslotInfo *ptr = &prometheus_slots.slots[i];
+			uint64		value;
+
+			if (!metric->get(ptr, &value))
+				continue;
+
+			if (!header_done)
+			{
+				EmitPrintf("# HELP %s %s\n# TYPE %s gauge\n",
+						   metric->name, metric->help, metric->name);
+				header_done = true;
+			}
+
+			EmitString(metric->name);
+			EmitPrometheusLabels(ptr);
+			EmitPrintf(" " UINT64_FORMAT "\n", value);
+		}
+	}
+}
+
+
+static void
+EmitPrometheusLabels(const ReplslotInfo *ptr)
+{
+	EmitString("{");
+
+	if (cluster_cnt > 1)
+	{
+		EmitString("cluster=");
+		EmitPrometheusLabelValue(ptr->cluster->datadir);
+		EmitString(",");
+	}
+
+	EmitString("slot=");
+	EmitPrometheusLabelValue(ptr->name);
+
+	if (ptr->slotfile_parsed)
+	{
+		char		numbuf[32];
+
+		EmitString(",type=");
+		EmitPrometheusLabelValue(ptr->type == RS_PHYSICAL ? "physical" : "logical");
+
+		if (ptr->type == RS_LOGICAL)
+			snprintf(numbuf, sizeof(numbuf), "%u", ptr->db_oid);
+		else
+			numbuf[0] = '\0';
+		EmitString(",db_oid=");
+		EmitPrometheusLabelValue(numbuf);
+
+		if (db_names)
+		{
+			EmitString(",db_name=");
+			EmitPrometheusLabelValue(ptr->db_name != NULL ? ptr->db_name : "");
+		}
+
+		EmitString(",plugin=");
+		EmitPrometheusLabelValue(ptr->type == RS_LOGICAL ? ptr->plugin : "");
+	}
+
+	EmitString("}");
+}
+
+
+/*
+ * Label values escape backslashes, double quotes and newlines.
+ */
+static void
+EmitPrometheusLabelValue(const char *str)
+{
+	const char *p;
+
+	EmitString("\"");
+
+	for (p = str; *p != '\0'; p++)
+	{
+		switch (*p)
+		{
+			case '\\':
+				EmitString("\\\\");
+				break;
+			case '"':
+				EmitString("\\\"");
+				break;
+			case '\n':
+				EmitString("\\n");
+				break;
+			default:
+				EmitBytes(p, 1);
+				break;
+		}
+	}
+
+	EmitString("\"");
+}
+
+
+static bool
+GetParsed(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->slotfile_parsed ? 1 : 0;
+	return true;
+}
+
+
+static bool
+GetRestartLsn(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->restart_lsn;
+	return ptr->slotfile_parsed && !XLogRecPtrIsInvalid(ptr->restart_lsn);
+}
+
+
+static bool
+GetConfirmedFlush(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->confirmed_flush;
+	return ptr->slotfile_parsed && ptr->type == RS_LOGICAL &&
+		!XLogRecPtrIsInvalid(ptr->confirmed_flush);
+}
+
+
+static bool
+GetXmin(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->xmin;
+	return ptr->slotfile_parsed && TransactionIdIsValid(ptr->xmin);
+}
+
+
+static bool
+GetCatalogXmin(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->catalog_xmin;
+	return ptr->slotfile_parsed && TransactionIdIsValid(ptr->catalog_xmin);
+}
+
+
+static bool
+GetPersistent(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->persistency == RS_PERSISTENT ? 1 : 0;
+	return ptr->slotfile_parsed;
+}
+
+
+static bool
+GetTwoPhase(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->two_phase ? 1 : 0;
+	return ptr->slotfile_parsed && ptr->type == RS_LOGICAL &&
+		ptr->version >= SLOT_VERSION_TWO_PHASE;
+}
+
+
+static bool
+GetFailover(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->failover ? 1 : 0;
+	return ptr->slotfile_parsed && ptr->type == RS_LOGICAL &&
+		ptr->version >= SLOT_VERSION_FAILOVER;
+}
+
+
+static bool
+GetSynced(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->synced ? 1 : 0;
+	return ptr->slotfile_parsed && ptr->version >= SLOT_VERSION_FAILOVER;
+}
+
+
+static bool
+GetInvalidated(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->invalidated != RS_INVAL_NONE ? 1 : 0;
+	return ptr->slotfile_parsed;
+}
+
+
+static bool
+GetWalRetainedBytes(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->wal_retained_bytes;
+	return ptr->slotfile_parsed && ptr->wal_retention_known;
+}
+
+
+static bool
+GetWalSegmentMissing(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->wal_segment_missing ? 1 : 0;
+	return ptr->slotfile_parsed && ptr->wal_retention_known;
+}
+
+
+static bool
+GetWalArchiveMissing(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->wal_archive_missing ? 1 : 0;
+	return ptr->slotfile_parsed && ptr->wal_archive_known;
+}
+
+
+static bool
+GetLiveActive(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->live_active ? 1 : 0;
+	return ptr->slotfile_parsed && ptr->live_found;
+}
+
+
+/*
+ * The state file is written from the server's in-memory state, so can't
+ * be ahead of it; should it appear so, the difference is shown as 0.
+ */
+static bool
+GetLiveRestartLsnAhead(const ReplslotInfo *ptr, uint64 *value)
+{
+	int64		ahead;
+
+	if (!ptr->slotfile_parsed || !ptr->live_found ||
+		!LiveLsnAhead(ptr->live_restart_lsn, ptr->restart_lsn, &ahead))
+		return false;
+
+	*value = Max(ahead, 0);
+	return true;
+}
+
+
+static bool
+GetLiveConfirmedFlushAhead(const ReplslotInfo *ptr, uint64 *value)
+{
+	int64		ahead;
+
+	if (!ptr->slotfile_parsed || !ptr->live_found ||
+		!LiveLsnAhead(ptr->live_confirmed_flush, ptr->confirmed_flush, &ahead))
+		return false;
+
+	*value = Max(ahead, 0);
+	return true;
+}
+
+
+static bool
+GetSpillFiles(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->spill_file_cnt;
+	return ptr->slotfile_parsed && ptr->spill_known;
+}
+
+
+static bool
+GetSpillBytes(const ReplslotInfo *ptr, uint64 *value)
+{
+	*value = ptr->spill_bytes;
+	return ptr->slotfile_parsed && ptr->spill_known;
+}
+
+
+/*
+ * With --output, start writing the report to a temporary file alongside
+ * the target.
+ */
+static void
+OpenOutputFile(void)
+{
+	if (output_path == NULL)
+		return;
+
+	snprintf(output_tmp_path, MAXPGPATH, "%s.tmp", output_path);
+
+	output_fd = open(output_tmp_path, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY, 0644);
+	if (output_fd < 0)
+	{
+		fprintf(stderr, "Unable to create output file \"%s\": %s\n",
+				output_tmp_path, strerror(errno));
+		exit(1);
+	}
+}
+
+
+/*
+ * With --output, put the completed report in place of the target.
+ */
+static void
+CloseOutputFile(void)
+{
+	if (output_path == NULL)
+		return;
+
+	if (close(output_fd) != 0)
+	{
+		fprintf(stderr, "Unable to write output file \"%s\": %s\n",
+				output_tmp_path, strerror(errno));
+		exit(1);
+	}
+
+	output_fd = STDOUT_FILENO;
+
+	if (rename(output_tmp_path, output_path) != 0)
+	{
+		fprintf(stderr, "Unable to rename output file \"%s\" to \"%s\": %s\n",
+				output_tmp_path, output_path, strerror(errno));
+		exit(1);
+	}
+}
+
+
+/*
+ * Render a slot of the text report into the output buffer; this is the
+ * loop which dominates a large report, so each line is appended directly,
+ * with no stdio involved.
+ */
+static void
+OutputSlotText(const ReplslotInfo *ptr)
+{
+	if (ptr->slotfile_parsed == false)
+	{
+		if (cluster_cnt > 1)
+		{
+			EmitPrintf("Unable to parse slot \"%s\" in ", ptr->name);
+			EmitString(ptr->cluster->datadir);
+			EmitString(":\n");
+		}
+		else
+			EmitPrintf("Unable to parse slot \"%s\":\n", ptr->name);
+		EmitString(ptr->error);
+		EmitString("\n");
+	}
+	else
+	{
+		size_t		name_len = strlen(ptr->name);
+
+		EmitBytes(ptr->name, name_len);
+		EmitString("\n");
+		EmitRepeated('-', name_len);
+		EmitString("\n");
+
+		if (cluster_cnt > 1)
+		{
+			EmitString("  Data directory: ");
+			EmitString(ptr->cluster->datadir);
+			EmitString("\n");
+		}
+
+		if (ptr->type == RS_PHYSICAL)
+			EmitString("  Type: physical\n");
+		else
+		{
+			EmitPrintf("  Type: logical; DB oid: %u", ptr->db_oid);
+			if (db_names && ptr->db_name != NULL)
+				EmitPrintf(" (%s)", ptr->db_name);
+			EmitString("\n");
+		}
+
+		EmitPrintf("  Persistency: %s\n  Version: %u\n  Length: %u\n",
+				   ptr->persistency == RS_PERSISTENT ? "persistent" : "ephemeral",
+				   ptr->version, ptr->length);
+
+		if (TransactionIdIsValid(ptr->xmin))
+			EmitPrintf("  Xmin: %u\n", ptr->xmin);
+		if (TransactionIdIsValid(ptr->catalog_xmin))
+			EmitPrintf("  Catalog xmin: %u\n", ptr->catalog_xmin);
+		if (!XLogRecPtrIsInvalid(ptr->restart_lsn))
+			EmitPrintf("  Restart LSN: %X/%X\n", LSN_FORMAT_ARGS(ptr->restart_lsn));
+		if (ptr->invalidated != RS_INVAL_NONE)
+		{
+			if (!XLogRecPtrIsInvalid(ptr->invalidated_at))
+				EmitPrintf("  Invalidated: %s, at restart LSN %X/%X\n",
+						   InvalidationCauseName(ptr->invalidated),
+						   LSN_FORMAT_ARGS(ptr->invalidated_at));
+			else
+				EmitPrintf("  Invalidated: %s\n", InvalidationCauseName(ptr->invalidated));
+		}
+		if (ptr->type == RS_LOGICAL)
+		{
+			EmitPrintf("  Confirmed flush: %X/%X\n", LSN_FORMAT_ARGS(ptr->confirmed_flush));
+			EmitPrintf("  Plugin: %s\n", ptr->plugin);
+
+			if (ptr->version >= SLOT_VERSION_TWO_PHASE)
+			{
+				EmitString(ptr->two_phase ? "  Two-phase: yes\n" : "  Two-phase: no\n");
+				if (ptr->two_phase && !XLogRecPtrIsInvalid(ptr->two_phase_at))
+					EmitPrintf("  Two-phase at: %X/%X\n", LSN_FORMAT_ARGS(ptr->two_phase_at));
+			}
+			if (ptr->version >= SLOT_VERSION_FAILOVER)
+			{
+				EmitString(ptr->failover ? "  Failover: yes\n" : "  Failover: no\n");
+				EmitString(ptr->synced ? "  Synced: yes\n" : "  Synced: no\n");
+			}
+		}
+
+		if (ptr->wal_retention_known)
+		{
+			if (*ptr->oldest_wal_segment == '\0')
+				EmitString("  WAL retained: none\n");
+			else if (ptr->wal_segment_missing)
+				EmitPrintf("  WAL retained: " UINT64_FORMAT " bytes; required segment %s has been removed\n",
+						   ptr->wal_retained_bytes, ptr->oldest_wal_segment);
+			else
+				EmitPrintf("  WAL retained: " UINT64_FORMAT " bytes in %i segment(s) from %s\n",
+						   ptr->wal_retained_bytes, ptr->wal_retained_segments,
+						   ptr->oldest_wal_segment);
+		}
+
+		if (ptr->wal_archive_known)
+		{
+			if (*ptr->archive_wal_segment == '\0')
+				EmitString("  WAL archive: no segment required\n");
+			else if (!ptr->wal_archive_missing)
+				EmitPrintf("  WAL archive: required segment %s is archived\n",
+						   ptr->archive_wal_segment);
+			else if (ptr->wal_retention_known && !ptr->wal_segment_missing)
+				EmitPrintf("  WAL archive: required segment %s is not archived yet\n",
+						   ptr->archive_wal_segment);
+			else
+				EmitPrintf("  WAL archive: required segment %s is missing, and has been removed from pg_wal\n",
+						   ptr->archive_wal_segment);
+		}
+
+		if (ptr->live_known && !ptr->live_found)
+			EmitString("  Live: not in pg_replication_slots\n");
+		else if (ptr->live_found)
+		{
+			EmitString(ptr->live_active ? "  Live: active\n" : "  Live: inactive\n");
+			OutputLiveLsnText("restart LSN", ptr->live_restart_lsn, ptr->restart_lsn);
+			if (ptr->type == RS_LOGICAL)
+				OutputLiveLsnText("confirmed flush", ptr->live_confirmed_flush,
+								  ptr->confirmed_flush);
+		}
+
+		if (ptr->spill_known)
+		{
+			if (ptr->spill_file_cnt == 0)
+				EmitString("  Spill files: none\n");
+			else
+				EmitPrintf("  Spill files: " UINT64_FORMAT " totalling " UINT64_FORMAT " bytes, for WAL segments %X/%X to %X/%X\n",
+						   ptr->spill_file_cnt, ptr->spill_bytes,
+						   LSN_FORMAT_ARGS(ptr->spill_min_lsn),
+						   LSN_FORMAT_ARGS(ptr->spill_max_lsn));
+		}
+	}
+}
+
+
+static void
+OutputSummaryText(const SlotHorizons *horizons)
+{
+	EmitPrintf("%i replication slot(s) found in ", horizons->slot_cnt);
+	EmitString(horizons->cluster->datadir);
+	if (horizons->unparsed_cnt > 0)
+		EmitPrintf(" (%i could not be parsed)", horizons->unparsed_cnt);
+	EmitString("\n");
+
+	if (!XLogRecPtrIsInvalid(horizons->restart_lsn))
+		EmitPrintf("  Oldest restart_lsn: %X/%X (%s)\n",
+				   LSN_FORMAT_ARGS(horizons->restart_lsn), horizons->restart_lsn_slot);
+	else
+		EmitString("  Oldest restart_lsn: none\n");
+
+	if (TransactionIdIsValid(horizons->xmin))
+		EmitPrintf("  Oldest xmin: %u (%s)\n", horizons->xmin, horizons->xmin_slot);
+	else
+		EmitString("  Oldest xmin: none\n");
+
+	if (TransactionIdIsValid(horizons->catalog_xmin))
+		EmitPrintf("  Oldest catalog_xmin: %u (%s)\n",
+				   horizons->catalog_xmin, horizons->catalog_xmin_slot);
+	else
+		EmitString("  Oldest catalog_xmin: none\n");
+}
+
+
+static void
+OutputDiffText(const ReplslotDiff *diff)
+{
+	const char *change = diff->change == SLOT_CREATED ? "created" :
+		diff->change == SLOT_DROPPED ? "dropped" : "changed";
+	size_t		name_len = strlen(diff->name) + strlen(change) + 3;
+
+	EmitPrintf("%s (%s)\n", diff->name, change);
+	EmitRepeated('-', name_len);
+	EmitString("\n");
+
+	EmitString(diff->type == RS_PHYSICAL ? "  Type: physical\n" : "  Type: logical\n");
+
+	OutputDiffLsnText("Restart LSN", diff->old_restart_lsn, diff->restart_lsn);
+	OutputDiffLsnText("Confirmed flush", diff->old_confirmed_flush, diff->confirmed_flush);
+	OutputDiffXidText("Xmin", diff->old_xmin, diff->xmin);
+	OutputDiffXidText("Catalog xmin", diff->old_catalog_xmin, diff->catalog_xmin);
+}
+
+
+/*
+ * Show how an LSN moved, if it did, with the rate it moved at if it was
+ * set both times.
+ */
+static void
+OutputDiffLsnText(const char *label, XLogRecPtr old_lsn, XLogRecPtr lsn)
+{
+	char		old_buf[32];
+	char		buf[32];
+	char		rate[32];
+	int64		delta = (int64) (lsn - old_lsn);
+
+	if (lsn == old_lsn)
+		return;
+
+	FormatLsn(old_buf, sizeof(old_buf), old_lsn);
+	FormatLsn(buf, sizeof(buf), lsn);
+
+	if (XLogRecPtrIsInvalid(old_lsn) || XLogRecPtrIsInvalid(lsn))
+	{
+		EmitPrintf("  %s: %s -> %s\n", label,
+				   old_buf[0] != '\0' ? old_buf : "none",
+				   buf[0] != '\0' ? buf : "none");
+		return;
+	}
+
+	FormatRate(rate, sizeof(rate), delta);
+
+	if (rate[0] != '\0')
+		EmitPrintf("  %s: %s -> %s (%s" INT64_FORMAT " bytes, %s bytes/s)\n",
+				   label, old_buf, buf, delta > 0 ? "+" : "", delta, rate);
+	else
+		EmitPrintf("  %s: %s -> %s (%s" INT64_FORMAT " bytes)\n",
+				   label, old_buf, buf, delta > 0 ? "+" : "", delta);
+}
+
+
+static void
+OutputDiffXidText(const char *label, TransactionId old_xid, TransactionId xid)
+{
+	char		old_buf[32];
+	char		buf[32];
+	char		rate[32];
+	int64		delta = (int32) (xid - old_xid);
+
+	if (xid == old_xid)
+		return;
+
+	FormatXid(old_buf, sizeof(old_buf), old_xid);
+	FormatXid(buf, sizeof(buf), xid);
+
+	if (!TransactionIdIsValid(old_xid) || !TransactionIdIsValid(xid))
+	{
+		EmitPrintf("  %s: %s -> %s\n", label,
+				   old_buf[0] != '\0' ? old_buf : "none",
+				   buf[0] != '\0' ? buf : "none");
+		return;
+	}
+
+	FormatRate(rate, sizeof(rate), delta);
+
+	if (rate[0] != '\0')
+		EmitPrintf("  %s: %s -> %s (%s" INT64_FORMAT ", %s/s)\n",
+				   label, old_buf, buf, delta > 0 ? "+" : "", delta, rate);
+	else
+		EmitPrintf("  %s: %s -> %s (%s" INT64_FORMAT ")\n",
+				   label, old_buf, buf, delta > 0 ? "+" : "", delta);
+}
+
+
+/*
+ * Write the CSV/TSV column headers for a field of a --diff report, as
+ * written by EmitDiffLsn() or EmitDiffXid().
+ */
+static void
+EmitDiffHeader(const char *name, const char *unit)
+{
+	char		header[64];
+
+	snprintf(header, sizeof(header), "old_%s", name);
+	EmitField(header, false);
+	EmitField(name, false);
+	snprintf(header, sizeof(header), "%s_delta%s%s", name,
+			 unit ? "_" : "", unit ? unit : "");
+	EmitField(header, false);
+	snprintf(header, sizeof(header), "%s%s%s_per_sec", name,
+			 unit ? "_" : "", unit ? unit : "");
+	EmitField(header, false);
+}
+
+
+/*
+ * Write the old and current value of an LSN in a --diff report, with how
+ * far and how fast it moved if it was set both times.
+ */
+static void
+EmitDiffLsn(const char *name, XLogRecPtr old_lsn, XLogRecPtr lsn)
+{
+	char		old_buf[32];
+	char		buf[32];
+	char		delta_buf[32];
+	char		rate[32];
+	int64		delta = (int64) (lsn - old_lsn);
+
+	FormatLsn(old_buf, sizeof(old_buf), old_lsn);
+	FormatLsn(buf, sizeof(buf), lsn);
+
+	if (XLogRecPtrIsInvalid(old_lsn) || XLogRecPtrIsInvalid(lsn))
+	{
+		delta_buf[0] = '\0';
+		rate[0] = '\0';
+	}
+	else
+	{
+		snprintf(delta_buf, sizeof(delta_buf), INT64_FORMAT, delta);
+		FormatRate(rate, sizeof(rate), delta);
+	}
+
+	if (output_format == OUTPUT_JSON)
+	{
+		EmitPrintf(", \"old_%s\": ", name);
+		EmitJsonLsn(old_lsn);
+		EmitPrintf(", \"%s\": ", name);
+		EmitJsonLsn(lsn);
+		EmitPrintf(", \"%s_delta_bytes\": %s, \"%s_bytes_per_sec\": %s",
+				   name, delta_buf[0] != '\0' ? delta_buf : "null",
+				   name, rate[0] != '\0' ? rate : "null");
+	}
+	else
+	{
+		EmitField(old_buf, false);
+		EmitField(buf, false);
+		EmitField(delta_buf, false);
+		EmitField(rate, false);
+	}
+}
+
+
+static void
+EmitDiffXid(const char *name, TransactionId old_xid, TransactionId xid)
+{
+	char		old_buf[32];
+	char		buf[32];
+	char		delta_buf[32];
+	char		rate[32];
+	int64		delta = (int32) (xid - old_xid);
+
+	FormatXid(old_buf, sizeof(old_buf), old_xid);
+	FormatXid(buf, sizeof(buf), xid);
+
+	if (!TransactionIdIsValid(old_xid) || !TransactionIdIsValid(xid))
+	{
+		delta_buf[0] = '\0';
+		rate[0] = '\0';
+	}
+	else
+	{
+		snprintf(delta_buf, sizeof(delta_buf), INT64_FORMAT, delta);
+		FormatRate(rate, sizeof(rate), delta);
+	}
+
+	if (output_format == OUTPUT_JSON)
+	{
+		EmitPrintf(", \"old_%s\": %s, \"%s\": %s, \"%s_delta\": %s, \"%s_per_sec\": %s",
+				   name, old_buf[0] != '\0' ? old_buf : "null",
+				   name, buf[0] != '\0' ? buf : "null",
+				   name, delta_buf[0] != '\0' ? delta_buf : "null",
+				   name, rate[0] != '\0' ? rate : "null");
+	}
+	else
+	{
+		EmitField(old_buf, false);
+		EmitField(buf, false);
+		EmitField(delta_buf, false);
+		EmitField(rate, false);
+	}
+}
+
+
+/*
+ * Format the rate of change of a value which moved by "delta" since the
+ * snapshot; empty if no time has passed.
+ */
+static void
+FormatRate(char *buf, size_t len, int64 delta)
+{
+	if (diff_elapsed > 0)
+		snprintf(buf, len, "%.1f", (double) delta / diff_elapsed);
+	else
+		buf[0] = '\0';
+}
+
+
+static void
+OutputLiveLsnText(const char *label, XLogRecPtr live_lsn, XLogRecPtr lsn)
+{
+	int64		ahead;
+
+	if (XLogRecPtrIsInvalid(live_lsn))
+		EmitPrintf("  Live %s: none\n", label);
+	else if (LiveLsnAhead(live_lsn, lsn, &ahead))
+		EmitPrintf("  Live %s: %X/%X (" INT64_FORMAT " bytes ahead of the state file)\n",
+				   label, LSN_FORMAT_ARGS(live_lsn), ahead);
+	else
+		EmitPrintf("  Live %s: %X/%X\n", label, LSN_FORMAT_ARGS(live_lsn));
+}
+
+
+/*
+ * How far the server's in-memory "live_lsn" is ahead of the state file's
+ * "lsn"; returns false if either is not set.
+ */
+static bool
+LiveLsnAhead(XLogRecPtr live_lsn, XLogRecPtr lsn, int64 *ahead)
+{
+	if (XLogRecPtrIsInvalid(live_lsn) || XLogRecPtrIsInvalid(lsn))
+		return false;
+
+	*ahead = (int64) (live_lsn - lsn);
+	return true;
+}
+
+
+static void
+EmitJsonLiveAhead(XLogRecPtr live_lsn, XLogRecPtr lsn)
+{
+	int64		ahead;
+
+	if (LiveLsnAhead(live_lsn, lsn, &ahead))
+		EmitPrintf(INT64_FORMAT, ahead);
+	else
+		EmitString("null");
+}
+
+
+/*
+ * Invalid transaction IDs and LSNs are shown as empty values (or null in
+ * JSON), as pg_replication_slots shows them as NULL.
+ */
+static void
+FormatXid(char *buf, size_t len, TransactionId xid)
+{
+	if (TransactionIdIsValid(xid))
+		snprintf(buf, len, "%u", xid);
+	else
+		buf[0] = '\0';
+}
+
+
+static void
+FormatLsn(char *buf, size_t len, XLogRecPtr lsn)
+{
+	if (!XLogRecPtrIsInvalid(lsn))
+		snprintf(buf, len, "%X/%X", LSN_FORMAT_ARGS(lsn));
+	else
+		buf[0] = '\0';
+}
+
+
+static void
+EmitJsonXid(TransactionId xid)
+{
+	char		buf[32];
+
+	FormatXid(buf, sizeof(buf), xid);
+
+	if (buf[0] == '\0')
+		EmitString("null");
+	else
+		EmitString(buf);
+}
+
+
+static void
+EmitJsonLsn(XLogRecPtr lsn)
+{
+	char		buf[32];
+
+	FormatLsn(buf, sizeof(buf), lsn);
+
+	if (buf[0] == '\0')
+		EmitString("null");
+	else
+		EmitJsonString(buf);
+}
+
+
+/*
+ * Write out the contents of the output buffer.  Anything the caller
+ * printed through stdio goes first, so the two can't interleave.
+ */
+static void
+EmitFlush(void)
+{
+	size_t		written = 0;
+
+	if (output_len == 0)
+		return;
+
+	if (output_capture != NULL)
+	{
+		appendBinaryPQExpBuffer(output_capture, output_buf, output_len);
+		if (PQExpBufferBroken(output_capture))
+		{
+			fprintf(stderr, "Out of memory rendering report\n");
+			exit(1);
+		}
+		output_len = 0;
+		return;
+	}
+
+	fflush(stdout);
+
+	while (written < output_len)
+	{
+		ssize_t		ret = write(output_fd, output_buf + written,
+								output_len - written);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0)
+		{
+			fprintf(stderr, "Unable to write output: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		written += ret;
+	}
+
+	output_len = 0;
+}
+
+
+static void
+EmitBytes(const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		size_t		chunk;
+
+		if (output_len == OUTPUT_BUFSIZE)
+			EmitFlush();
+
+		chunk = Min(len, OUTPUT_BUFSIZE - output_len);
+		memcpy(output_buf + output_len, data, chunk);
+		output_len += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+
+/*
+ * Append "cnt" copies of "c", such as a heading's underline.
+ */
+static void
+EmitRepeated(char c, size_t cnt)
+{
+	while (cnt > 0)
+	{
+		size_t		chunk;
+
+		if (output_len == OUTPUT_BUFSIZE)
+			EmitFlush();
+
+		chunk = Min(cnt, OUTPUT_BUFSIZE - output_len);
+		memset(output_buf + output_len, c, chunk);
+		output_len += chunk;
+		cnt -= chunk;
+	}
+}
+
+
+static void
+EmitString(const char *str)
+{
+	EmitBytes(str, strlen(str));
+}
+
+
+static void
+EmitPrintf(const char *fmt,...)
+{
+	char		buf[MAXLEN];
+	va_list		args;
+	int			len;
+
+	va_start(args, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+
+	if (len < 0)
+		return;
+
+	EmitBytes(buf, Min(len, sizeof(buf) - 1));
+}
+
+
+static void
+EmitJsonString(const char *str)
+{
+	const char *p;
+
+	EmitString("\"");
+
+	for (p = str; *p != '\0'; p++)
+	{
+		switch (*p)
+		{
+			case '"':
+				EmitString("\\\"");
+				break;
+			case '\\':
+				EmitString("\\\\");
+				break;
+			case '\n':
+				EmitString("\\n");
+				break;
+			case '\r':
+				EmitString("\\r");
+				break;
+			case '\t':
+				EmitString("\\t");
+				break;
+			default:
+				if ((unsigned char) *p < ' ')
+					EmitPrintf("\\u%04x", (unsigned char) *p);
+				else
+					EmitBytes(p, 1);
+				break;
+		}
+	}
+
+	EmitString("\"");
+}
+
+
+/*
+ * CSV fields are quoted (RFC 4180 style) only if they need to be.
+ */
+static void
+EmitCsvField(const char *str)
+{
+	const char *p;
+
+	if (strpbrk(str, ",\"\r\n") == NULL)
+	{
+		EmitString(str);
+		return;
+	}
+
+	EmitString("\"");
+
+	for (p = str; *p != '\0'; p++)
+	{
+		if (*p == '"')
+			EmitString("\"\"");
+		else
+			EmitBytes(p, 1);
+	}
+
+	EmitString("\"");
+}
+
+
+/*
+ * TSV fields use the same backslash escapes as COPY's text format.
+ */
+static void
+EmitTsvField(const char *str)
+{
+	const char *p;
+
+	for (p = str; *p != '\0'; p++)
+	{
+		switch (*p)
+		{
+			case '\\':
+				EmitString("\\\\");
+				break;
+			case '\t':
+				EmitString("\\t");
+				break;
+			case '\n':
+				EmitString("\\n");
+				break;
+			case '\r':
+				EmitString("\\r");
+				break;
+			default:
+				EmitBytes(p, 1);
+				break;
+		}
+	}
+}
+
+
+static void
+EmitField(const char *str, bool first)
+{
+	if (output_format == OUTPUT_CSV)
+	{
+		if (!first)
+			EmitString(",");
+		EmitCsvField(str);
+	}
+	else
+	{
+		if (!first)
+			EmitString("\t");
+		EmitTsvField(str);
+	}
+}
@@ -0,0 +1,341 @@
+/*
+ * pg_replslot_gen.c
+ *
+ * Generates a synthetic data directory containing any number of
+ * replication slots, for benchmarking pg_replslot_reader (see the
+ * "benchmark" target in the Makefile).
+ *
+ * Each slot gets a valid state file in the format written by the
+ * PostgreSQL release given with -p, with the correct magic number and
+ * checksum; alternate slots are physical and logical, and some physical
+ * slots are invalidated.  Optionally some further slots are written
+ * with a corrupt state file, cycling through a bad magic number, a bad
+ * checksum and a truncated file.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pg_replslot_reader.h"
+
+/* where the sizes are written in pg_control, suitably aligned */
+#define GEN_CONTROL_SIZES_OFFSET	256
+
+static int	ParsePgVersion(const char *pg_version);
+static void WriteSlot(const char *slotdir_path, const ReplslotFormat *format,
+					  int slot_num, int corrupt);
+static void SetField(char *slotdata, int16 offset, const void *value, size_t len);
+static void WriteFile(const char *path, const void *data, size_t len);
+static void MakeDirectory(const char *path);
+static void do_help(void);
+
+const char *progname;
+
+
+int
+main(int argc, char **argv)
+{
+	static struct option long_options[] =
+	{
+		{"help", no_argument, NULL, '?'},
+		{"corrupt", required_argument, NULL, 'c'},
+		{"pgdata", required_argument, NULL, 'D'},
+		{"slots", required_argument, NULL, 'n'},
+		{"pg-version", required_argument, NULL, 'p'},
+		{NULL, 0, NULL, 0}
+	};
+
+	const char *datadir = NULL;
+	const char *pg_version = "13";
+	const ReplslotFormat *format;
+	int			slot_cnt = 1000;
+	int			corrupt_cnt = 0;
+	char		path[MAXPGPATH];
+	char		slotdir_path[MAXPGPATH];
+	int			optindex;
+	int			c;
+	int			i;
+
+	progname = argv[0];
+
+	while ((c = getopt_long(argc, argv, "?D:c:n:p:", long_options, &optindex)) != -1)
+	{
+		switch (c)
+		{
+			case '?':
+				do_help();
+				exit(0);
+			case 'D':
+				datadir = optarg;
+				break;
+			case 'c':
+				corrupt_cnt = atoi(optarg);
+				break;
+			case 'n':
+				slot_cnt = atoi(optarg);
+				break;
+			case 'p':
+				pg_version = optarg;
+				break;
+			default:
+				printf("Try \"%s --help\" for more information.\n", progname);
+				exit(1);
+		}
+	}
+
+	if (datadir == NULL)
+	{
+		puts("Please provide the directory to create with -D/--pgdata");
+		exit(1);
+	}
+
+	if (slot_cnt < 0 || corrupt_cnt < 0)
+	{
+		puts("The number of slots must not be negative");
+		exit(1);
+	}
+
+	format = ReplslotFormatForPgVersion(ParsePgVersion(pg_version));
+	if (format == NULL)
+	{
+		printf("PostgreSQL %s doesn't have replication slots\n", pg_version);
+		exit(1);
+	}
+
+	MakeDirectory(datadir);
+
+	snprintf(path, MAXPGPATH, "%s/PG_VERSION", datadir);
+	{
+		char		version_line[32];
+
+		snprintf(version_line, sizeof(version_line), "%s\n", pg_version);
+		WriteFile(path, version_line, strlen(version_line));
+	}
+
+	/*
+	 * Of pg_control, only the sizes are read, so they are all that's
+	 * written; their offset needn't be that of any particular release.
+	 */
+	snprintf(path, MAXPGPATH, "%s/global", datadir);
+	MakeDirectory(path);
+	snprintf(path, MAXPGPATH, "%s/global/pg_control", datadir);
+	{
+		char		control[CONTROL_FILE_SIZE];
+		ControlFileSizes sizes;
+
+		memset(control, 0, sizeof(control));
+		sizes.floatFormat = CONTROL_FLOAT_FORMAT;
+		sizes.blcksz = BLCKSZ;
+		sizes.relseg_size = RELSEG_SIZE;
+		sizes.xlog_blcksz = XLOG_BLCKSZ;
+		sizes.xlog_seg_size = DEFAULT_WAL_SEGMENT_SIZE;
+		memcpy(control + GEN_CONTROL_SIZES_OFFSET, &sizes, sizeof(sizes));
+		WriteFile(path, control, sizeof(control));
+	}
+
+	snprintf(path, MAXPGPATH, "%s/pg_wal", datadir);
+	MakeDirectory(path);
+	snprintf(path, MAXPGPATH, "%s/pg_xlog", datadir);
+	MakeDirectory(path);
+
+	snprintf(slotdir_path, MAXPGPATH, "%s/pg_replslot", datadir);
+	MakeDirectory(slotdir_path);
+
+	for (i = 0; i < slot_cnt + corrupt_cnt; i++)
+		WriteSlot(slotdir_path, format, i, i < slot_cnt ? 0 : i - slot_cnt + 1);
+
+	printf("%i slot(s) written to %s, %i of them corrupt\n",
+		   slot_cnt + corrupt_cnt, slotdir_path, corrupt_cnt);
+
+	exit(0);
+}
+
+
+/*
+ * Convert a PG_VERSION string ("9.6", "13") to a version number as
+ * compared with the format table (90600, 130000).
+ */
+static int
+ParsePgVersion(const char *pg_version)
+{
+	int			major = 0;
+	int			minor = 0;
+
+	if (sscanf(pg_version, "%d.%d", &major, &minor) < 1)
+	{
+		printf("Invalid PostgreSQL version \"%s\"\n", pg_version);
+		exit(1);
+	}
+
+	return major >= 10 ? major * 10000 : major * 10000 + minor * 100;
+}
+
+
+/*
+ * Write the state file of slot number "slot_num" in "format"; if "corrupt"
+ * is nonzero, it selects how the file is damaged.
+ */
+static void
+WriteSlot(const char *slotdir_path, const ReplslotFormat *format,
+		  int slot_num, int corrupt)
+{
+	ReplslotStateBuf buf;
+	char	   *slotdata = buf.data + ReplicationSlotOnDiskConstantSize;
+	NameData	name;
+	char		path[MAXPGPATH];
+	size_t		len;
+	ReplicationSlotPersistency persistency = RS_PERSISTENT;
+	XLogRecPtr	restart_lsn = ((XLogRecPtr) (slot_num + 1) << 24) + 0x28;
+
+	memset(&buf, 0, sizeof(buf));
+
+	buf.cp.magic = SLOT_MAGIC;
+	buf.cp.version = format->version;
+	buf.cp.length = format->length;
+
+	len = ReplicationSlotOnDiskConstantSize + format->length;
+
+	memset(&name, 0, sizeof(name));
+	snprintf(name.data, NAMEDATALEN, "%s_%06d",
+			 corrupt ? "corrupt" : "slot", slot_num);
+
+	SetField(slotdata, format->name, &name, sizeof(name));
+	SetField(slotdata, format->persistency, &persistency, sizeof(persistency));
+
+	/*
+	 * One physical slot in eight has had its WAL removed, where the release
+	 * can invalidate slots, and so no longer has a restart_lsn.
+	 */
+	if (slot_num % 8 == 6 &&
+		(format->invalidated_at >= 0 || format->invalidated >= 0))
+	{
+		uint32		invalidated = RS_INVAL_WAL_REMOVED;
+
+		SetField(slotdata, format->invalidated_at, &restart_lsn, sizeof(restart_lsn));
+		SetField(slotdata, format->invalidated, &invalidated, sizeof(invalidated));
+		restart_lsn = InvalidXLogRecPtr;
+	}
+
+	SetField(slotdata, format->restart_lsn, &restart_lsn, sizeof(restart_lsn));
+
+	if (slot_num % 2 == 0)
+	{
+		TransactionId xmin = 1000 + slot_num;
+
+		SetField(slotdata, format->xmin, &xmin, sizeof(xmin));
+	}
+	else
+	{
+		Oid			database = 16384 + slot_num % 4;
+		TransactionId catalog_xmin = 1000 + slot_num;
+		XLogRecPtr	confirmed_flush = restart_lsn + 0x1000;
+		NameData	plugin;
+		bool		enabled = true;
+
+		memset(&plugin, 0, sizeof(plugin));
+		strlcpy(plugin.data, "pgoutput", NAMEDATALEN);
+
+		SetField(slotdata, format->database, &database, sizeof(database));
+		SetField(slotdata, format->catalog_xmin, &catalog_xmin, sizeof(catalog_xmin));
+		SetField(slotdata, format->confirmed_flush, &confirmed_flush, sizeof(confirmed_flush));
+		SetField(slotdata, format->plugin, &plugin, sizeof(plugin));
+
+		/* every other logical slot uses two-phase decoding and failover */
+		if (slot_num % 4 == 1)
+		{
+			SetField(slotdata, format->two_phase, &enabled, sizeof(enabled));
+			SetField(slotdata, format->two_phase_at, &confirmed_flush,
+					 sizeof(confirmed_flush));
+			SetField(slotdata, format->failover, &enabled, sizeof(enabled));
+		}
+	}
+
+	INIT_CRC32C(buf.cp.checksum);
+	COMP_CRC32C(buf.cp.checksum,
+				buf.data + SnapBuildOnDiskNotChecksummedSize,
+				ReplicationSlotOnDiskConstantSize - SnapBuildOnDiskNotChecksummedSize +
+				buf.cp.length);
+	FIN_CRC32C(buf.cp.checksum);
+
+	switch (corrupt % 3)
+	{
+		case 0:
+			if (corrupt)
+				len = ReplicationSlotOnDiskConstantSize / 2;
+			break;
+		case 1:
+			buf.cp.magic = ~SLOT_MAGIC;
+			break;
+		case 2:
+			buf.cp.checksum ^= 1;
+			break;
+	}
+
+	snprintf(path, MAXPGPATH, "%s/%s", slotdir_path, name.data);
+	MakeDirectory(path);
+
+	snprintf(path, MAXPGPATH, "%s/%s/state", slotdir_path, name.data);
+	WriteFile(path, buf.data, len);
+}
+
+
+/*
+ * Store a field of the slot data, if the format has it.
+ */
+static void
+SetField(char *slotdata, int16 offset, const void *value, size_t len)
+{
+	if (offset >= 0)
+		memcpy(slotdata + offset, value, len);
+}
+
+
+static void
+WriteFile(const char *path, const void *data, size_t len)
+{
+	int			fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY, 0600);
+	if (fd < 0)
+	{
+		printf("Unable to create file \"%s\": %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	if (write(fd, data, len) != (ssize_t) len || close(fd) != 0)
+	{
+		printf("Unable to write file \"%s\": %s\n", path, strerror(errno));
+		exit(1);
+	}
+}
+
+
+static void
+MakeDirectory(const char *path)
+{
+	if (mkdir(path, 0700) != 0 && errno != EEXIST)
+	{
+		printf("Unable to create directory \"%s\": %s\n", path, strerror(errno));
+		exit(1);
+	}
+}
+
+
+static void
+do_help(void)
+{
+	printf(_("%s: generate a data directory with synthetic replication slots\n"), progname);
+	printf(	 "\n");
+	printf(_("	-?, --help							show this help, then exit\n"));
+	printf(_("	-D, --pgdata=DIR					directory to create\n"));
+	printf(_("	-n, --slots=NUM						number of valid slots (default 1000)\n"));
+	printf(_("	-c, --corrupt=NUM					number of additional corrupt slots (default 0)\n"));
+	printf(_("	-p, --pg-version=VERSION			version whose PG_VERSION and state files to write (default 13)\n"));
+	printf(	 "\n");
+}
@@ -18,40 +18,272 @@
  *
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#ifdef USE_LIBURING
+#include <liburing.h>
+#endif
 
 #include "pg_replslot_reader.h"
 
-static void ScanReplSlotDirs(const char *datadir);
-static void ReadReplSlotDir(const char *replslot_dir);
+/* exit statuses of --check */
+#define CHECK_OK			0
+#define CHECK_UNSCANNED		1	/* also for a data directory which can't be scanned */
+#define CHECK_CORRUPT		2
+#define CHECK_LAG			3
 
-static void ValidatePgVersion(const char *datadir);
-static void do_help(void);
-static void do_usage(void);
+/*
+ * How state files are read; see --io-engine.
+ */
+typedef enum IoEngine
+{
+	IO_ENGINE_SYNC,
+	IO_ENGINE_URING
+} IoEngine;
+
+/*
+ * The phases of a scan timed, and the calls counted, by --stats.
+ */
+typedef enum ScanPhase
+{
+	PHASE_READDIR,
+	PHASE_STAT,
+	PHASE_READ,
+	PHASE_VALIDATE,
+	PHASE_FORMAT
+} ScanPhase;
+
+#define NUM_SCAN_PHASES (PHASE_FORMAT + 1)
+
+static const char *const scan_phase_names[NUM_SCAN_PHASES] = {
+	"readdir",
+	"stat",
+	"open/read",
+	"validate",
+	"format"
+};
+
+typedef enum ScanCounter
+{
+	COUNT_READDIR,
+	COUNT_STAT,
+	COUNT_OPEN,
+	COUNT_READ,
+	COUNT_BYTES_READ,
+	COUNT_URING_SUBMIT,
+	COUNT_PARSE_FAILURE
+} ScanCounter;
+
+#define NUM_SCAN_COUNTERS (COUNT_PARSE_FAILURE + 1)
+
+static const char *const scan_counter_names[NUM_SCAN_COUNTERS] = {
+	"readdir",
+	"stat",
+	"open",
+	"read",
+	"bytes_read",
+	"uring_submit",
+	"parse_failures"
+};
+
+typedef struct ScanStats
+{
+	instr_time	phase_times[NUM_SCAN_PHASES];
+	uint64		counters[NUM_SCAN_COUNTERS];
+} ScanStats;
+
+/*
+ * A slot directory found in one of the data directories being scanned.
+ */
+typedef struct SlotDirEntry
+{
+	ClusterInfo *cluster;
+	char	   *slot_name;
+} SlotDirEntry;
+
+/*
+ * Shared state for the worker threads used by --jobs; each worker claims
+ * the next unread slot directory under "lock" until none remain.
+ */
+typedef struct ReplslotWorkQueue
+{
+	pthread_mutex_t lock;
+	SlotDirEntry *entries;
+	ReplslotInfo *replslot_infos;
+	int			entry_cnt;
+	int			next_entry;
+} ReplslotWorkQueue;
 
+/*
+ * Shared state for the worker threads summarizing the slots with --jobs;
+ * each worker keeps minima of its own for every data directory, which
+ * are merged into "horizons" under "lock" once no slots remain.
+ */
+typedef struct ReplslotSummaryQueue
+{
+	pthread_mutex_t lock;
+	SlotDirEntry *entries;
+	int			entry_cnt;
+	int			next_entry;
+	SlotHorizons *horizons;
+} ReplslotSummaryQueue;
 
+/*
+ * Shared state for streaming the slots with --jobs: the worker threads
+ * read state files into a bounded window of ReplslotInfos, which this
+ * thread outputs and hands back, so that only "window_size" slots are in
+ * memory at a time.
+ *
+ * In order, entry number n is read into window[n % window_size], and is
+ * only claimed once the entry window_size before it has been output.
+ * With --unordered, a worker takes any free window slot, and the slots
+ * are output from the "read_slots" FIFO in the order they were read.
+ */
+typedef struct ReplslotPipeline
+{
+	pthread_mutex_t lock;
+	pthread_cond_t slot_read;	/* a slot has been read for output */
+	pthread_cond_t slot_free;	/* a window slot has been handed back */
+	SlotDirEntry *entries;
+	int			entry_cnt;
+	int			next_entry;		/* next entry for a worker to claim */
+	ReplslotInfo *window;
+	int			window_size;
+	bool		unordered;
+	/* in order */
+	bool	   *window_read;
+	int			next_output;	/* entry number to output next */
+	/* with --unordered */
+	int		   *free_slots;
+	int			free_cnt;
+	int		   *read_slots;
+	int			read_head;
+	int			read_cnt;
+} ReplslotPipeline;
+
+/* window slots per job when streaming with --jobs */
+#define PIPELINE_SLOTS_PER_JOB	32
 
-typedef struct ReplslotInfo
+/*
+ * A slot directory being followed by --watch; "changed" is set when its
+ * state file is rewritten and the slot queued in "changed_slots", until
+ * it has been re-read.
+ */
+typedef struct WatchedSlot
 {
-	bool slotfile_parsed;
-	char error[MAXLEN];
-	char name[MAXLEN];
-	ReplicationSlotType type;
-	uint32 version;
-	uint32 length;
-	uint32 db_oid;
-	ReplicationSlotPersistency persistency;
-	struct ReplslotInfo *next;
-} ReplslotInfo;
+	char	   *slot_name;
+	bool		changed;
+} WatchedSlot;
+
+static void AddCluster(const char *datadir);
+static void ReadPgdataList(const char *filename);
+static void ScanReplSlotDirs(void);
+static void WatchReplSlotDirs(ClusterInfo *cluster);
+static void RefreshDaemonReport(PQExpBuffer json, PQExpBuffer prometheus);
+#ifdef __linux__
+static void AddSlotWatch(int inotify_fd, const char *slotdir_path, const char *slot_name);
+static void RemoveSlotWatch(int wd);
+static void MarkSlotChanged(int wd);
+static int	FindSlotWatch(const char *slot_name);
+static bool IsTempSlotDirName(const char *name);
+#endif
+static void PhaseStart(instr_time *start);
+static void PhaseEnd(ScanPhase phase, const instr_time *start);
+static void CountEvent(ScanCounter counter, uint64 n);
+static void PrintScanStats(const instr_time *total, int slot_cnt);
+static bool IsSlotDirEntry(DIR *slotdir, struct dirent *slotdir_ent);
+static void ScanSpillFiles(ClusterInfo *cluster, const char *slot_name,
+						   ReplslotInfo *replslot_info);
+static bool ParseSpillFileName(const char *name, XLogRecPtr *lsn);
+static int	ListReplSlotDirs(SlotDirEntry **entries_p);
+static void CloseReplSlotDirs(SlotDirEntry *entries, int entry_cnt);
+static void ReadReplSlotDirs(SlotDirEntry *entries, int entry_cnt);
+static void StreamReplSlotDirs(SlotDirEntry *entries, int entry_cnt);
+static void *StreamReplSlotDirsWorker(void *arg);
+static bool PipelineHasFreeSlot(const ReplslotPipeline *pipeline);
+static int	CheckReplSlotDirs(SlotDirEntry *entries, int entry_cnt);
+static void SummarizeReplSlotDirs(SlotDirEntry *entries, int entry_cnt);
+static void *SummarizeReplSlotDirsWorker(void *arg);
+static int	CheckReplSlot(const ReplslotInfo *replslot_info);
+static void ReadReplSlotDirsToArray(SlotDirEntry *entries, int entry_cnt,
+									ReplslotArray *replslot_array);
+static void *ReadReplSlotDirsWorker(void *arg);
+#ifdef USE_LIBURING
+static void ReadReplSlotDirsUring(SlotDirEntry *entries, int entry_cnt,
+								  ReplslotInfo *replslot_infos);
+static void ReapUringCompletions(struct io_uring *ring, int pending);
+#endif
+static void ReadReplSlotDir(ClusterInfo *cluster, const char *slot_name,
+							ReplslotInfo *replslot_info);
+static bool StartReplSlotRead(ClusterInfo *cluster, const char *slot_name,
+							  char *state_path, char *path,
+							  struct stat *statbuf, bool *statbuf_valid,
+							  ReplslotInfo *replslot_info);
+static void FinishReplSlotRead(ClusterInfo *cluster, const char *path,
+							   const ReplslotStateBuf *buf, ssize_t readBytes,
+							   const struct stat *statbuf, ReplslotInfo *replslot_info);
+static void SetReplslotError(ReplslotInfo *replslot_info, const char *fmt,...) pg_attribute_printf(2, 3);
+
+static int	ValidatePgVersion(ClusterInfo *cluster);
+static WalSegmentIndex *ScanDataDirWal(const ClusterInfo *cluster);
+static WalSegmentIndex *ScanClustersWalArchive(void);
+static void do_help(void);
+static void do_usage(void);
 
 
 
 const char *progname;
-char datadir[MAXPGPATH] = "";
-ReplslotInfo *replslot_info_start = NULL;
-ReplslotInfo *replslot_info_last = NULL;
+ClusterInfo *clusters = NULL;
+int			cluster_cnt = 0;
+int			clusters_size = 0;
+bool		wal_retention = false;
+StringPool *error_pool = NULL;
+ReplslotFilter slot_filter = {-1, InvalidOid, NULL};
+ReplslotSortKey sort_key = SORT_NONE;
+int			num_jobs = 1;
+IoEngine	io_engine = IO_ENGINE_SYNC;
+bool		verbose = false;
+const char *cache_file = NULL;
+SlotCache  *slot_cache = NULL;
+bool		watch = false;
+WatchedSlot *watched_slots = NULL;
+int			watched_slots_size = 0;
+int		   *changed_slots = NULL;
+int			changed_slots_cnt = 0;
+int			changed_slots_size = 0;
+int			stat_calls_avoided = 0;
+
+bool		unordered = false;
+const char *save_path = NULL;
+const char *diff_path = NULL;
+const char *ssh_command = "ssh -o BatchMode=yes";
+const char *wal_archive = NULL;
+const char *s3_command = "aws s3api";
+WalSegmentIndex *wal_archive_index = NULL;
+bool		snapshot_failed = false;
+bool		compare_live = false;
+bool		spill_files = false;
+bool		db_names = false;
+bool		summary = false;
+bool		check = false;
+bool		check_lag = false;
+uint64		max_lag_bytes = 0;
+bool		fail_on_corrupt = false;
+int			check_status = CHECK_OK;
+const char *live_conninfo = NULL;
+const char *daemon_listen = NULL;
+int			refresh_interval = 10;
+
+bool		collect_stats = false;
+ScanStats	scan_stats;
+pthread_mutex_t scan_stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 int
@@ -60,19 +292,51 @@ main(int argc, char **argv)
 	static struct option long_options[] =
 	{
 		{"help", no_argument, NULL, 1},
+		{"cache", required_argument, NULL, 6},
+		{"io-engine", required_argument, NULL, 7},
+		{"stats", no_argument, NULL, 8},
+		{"daemon", required_argument, NULL, 9},
+		{"refresh-interval", required_argument, NULL, 10},
+		{"compare-live", required_argument, NULL, 11},
+		{"spill-files", no_argument, NULL, 12},
+		{"check", no_argument, NULL, 13},
+		{"max-lag-bytes", required_argument, NULL, 14},
+		{"fail-on-corrupt", no_argument, NULL, 15},
+		{"unordered", no_argument, NULL, 16},
+		{"save", required_argument, NULL, 17},
+		{"diff", required_argument, NULL, 18},
+		{"ssh-command", required_argument, NULL, 19},
+		{"db-names", no_argument, NULL, 20},
+		{"summary", no_argument, NULL, 21},
+		{"wal-archive", required_argument, NULL, 22},
+		{"s3-command", required_argument, NULL, 23},
+		{"db-oid", required_argument, NULL, 2},
+		{"format", required_argument, NULL, 'f'},
+		{"output", required_argument, NULL, 'o'},
+		{"jobs", required_argument, NULL, 'j'},
 		{"pgdata", required_argument, NULL, 'D'},
+		{"pgdata-list", required_argument, NULL, 'L'},
+		{"plugin", required_argument, NULL, 3},
+		{"sort", required_argument, NULL, 4},
+		{"type", required_argument, NULL, 5},
+		{"wal-retention", no_argument, NULL, 'r'},
+		{"verbose", no_argument, NULL, 'v'},
 		{"version", no_argument, NULL, 'V'},
+		{"watch", no_argument, NULL, 'w'},
+		{NULL, 0, NULL, 0}
 	};
 
 	int			optindex;
 	int			c;
+	int			exit_status = 0;
+	int			i;
 
 	progname = argv[0];
 
 	/* Prevent getopt_long() from printing an error message */
 	opterr = 0;
 
-	while ((c = getopt_long(argc, argv, "?VD:", long_options,
+	while ((c = getopt_long(argc, argv, "?VrvwD:L:f:j:o:", long_options,
 							&optindex)) != -1)
 	{
 		switch (c)
@@ -91,11 +355,179 @@ main(int argc, char **argv)
 			case 1:
 				do_help();
 				exit(0);
+			case 2:
+				{
+					char	   *endptr;
+					unsigned long db_oid = strtoul(optarg, &endptr, 10);
+
+					if (*optarg == '\0' || *endptr != '\0' || db_oid == InvalidOid ||
+						db_oid > PG_UINT32_MAX)
+					{
+						printf("Invalid value for --db-oid: \"%s\"\n", optarg);
+						exit(1);
+					}
+					slot_filter.db_oid = (Oid) db_oid;
+				}
+				break;
+			case 3:
+				slot_filter.plugin = optarg;
+				break;
+			case 4:
+				if (!ParseSortKey(optarg, &sort_key))
+				{
+					printf("Invalid value for --sort: \"%s\" (must be one of name, restart_lsn, catalog_xmin, type, spill_bytes)\n",
+						   optarg);
+					exit(1);
+				}
+				break;
+			case 5:
+				if (strcmp(optarg, "physical") == 0)
+					slot_filter.type = RS_PHYSICAL;
+				else if (strcmp(optarg, "logical") == 0)
+					slot_filter.type = RS_LOGICAL;
+				else
+				{
+					printf("Invalid value for --type: \"%s\" (must be physical or logical)\n",
+						   optarg);
+					exit(1);
+				}
+				break;
+			case 6:
+				cache_file = optarg;
+				break;
+			case 7:
+				if (strcmp(optarg, "sync") == 0)
+					io_engine = IO_ENGINE_SYNC;
+				else if (strcmp(optarg, "io_uring") == 0)
+				{
+#ifdef USE_LIBURING
+					io_engine = IO_ENGINE_URING;
+#else
+					puts("--io-engine=io_uring is not supported by this build");
+					exit(1);
+#endif
+				}
+				else
+				{
+					printf("Invalid value for --io-engine: \"%s\" (must be sync or io_uring)\n",
+						   optarg);
+					exit(1);
+				}
+				break;
+			case 8:
+				collect_stats = true;
+				break;
+			case 9:
+				daemon_listen = optarg;
+				break;
+			case 10:
+				{
+					char	   *endptr;
+					long		interval = strtol(optarg, &endptr, 10);
+
+					if (*optarg == '\0' || *endptr != '\0' || interval < 1 || interval > 86400)
+					{
+						printf("Invalid value for --refresh-interval: \"%s\" (must be between 1 and 86400)\n",
+							   optarg);
+						exit(1);
+					}
+					refresh_interval = (int) interval;
+				}
+				break;
+			case 11:
+				live_conninfo = optarg;
+				compare_live = true;
+				break;
+			case 12:
+				spill_files = true;
+				break;
+			case 13:
+				check = true;
+				break;
+			case 14:
+				{
+					char	   *endptr;
+
+					errno = 0;
+					max_lag_bytes = strtoull(optarg, &endptr, 10);
+
+					if (*optarg == '\0' || *endptr != '\0' || *optarg == '-' || errno != 0)
+					{
+						printf("Invalid value for --max-lag-bytes: \"%s\"\n", optarg);
+						exit(1);
+					}
+					check_lag = true;
+				}
+				break;
+			case 15:
+				fail_on_corrupt = true;
+				break;
+			case 16:
+				unordered = true;
+				break;
+			case 17:
+				save_path = optarg;
+				break;
+			case 18:
+				diff_path = optarg;
+				break;
+			case 19:
+				ssh_command = optarg;
+				break;
+			case 20:
+				db_names = true;
+				break;
+			case 21:
+				summary = true;
+				break;
+			case 22:
+				wal_archive = optarg;
+				break;
+			case 23:
+				s3_command = optarg;
+				break;
 			case 'V':
 				printf("%s %s (PostgreSQL %s)\n", progname, RR_VERSION, PG_VERSION);
 				exit(0);
+			case 'r':
+				wal_retention = true;
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case 'w':
+				watch = true;
+				break;
 			case 'D':
-				strncpy(datadir, optarg, MAXPGPATH);
+				AddCluster(optarg);
+				break;
+			case 'L':
+				ReadPgdataList(optarg);
+				break;
+			case 'f':
+				if (!ParseOutputFormat(optarg, &output_format))
+				{
+					printf("Invalid value for -f/--format: \"%s\" (must be one of text, json, csv, tsv, prometheus)\n",
+						   optarg);
+					exit(1);
+				}
+				break;
+			case 'o':
+				output_path = optarg;
+				break;
+			case 'j':
+				{
+					char	   *endptr;
+					long		jobs = strtol(optarg, &endptr, 10);
+
+					if (*optarg == '\0' || *endptr != '\0' || jobs < 1 || jobs > MAX_JOBS)
+					{
+						printf("Invalid value for -j/--jobs: \"%s\" (must be between 1 and %i)\n",
+							   optarg, MAX_JOBS);
+						exit(1);
+					}
+					num_jobs = (int) jobs;
+				}
 				break;
 			default:
 			unknown_option:
@@ -104,324 +536,2384 @@ main(int argc, char **argv)
 		}
 	}
 
-	if (datadir[0] == '\0')
+	if (cluster_cnt == 0)
 	{
 		puts("Please provide the PostgreSQL data directory location with -D/--pgdata");
 		exit(1);
 	}
 
-	ValidatePgVersion(datadir);
-	ScanReplSlotDirs(datadir);
-
-	exit(0);
-}
-
-
-
-/*
- * See also eponymous function in src/backend/utils/init/miscinit.c
- */
-static void
-ValidatePgVersion(const char *datadir)
-{
-	FILE	   *fd;
-	int			ret;
-
-	long		file_major,
-				file_minor,
-				version_num;
-
-	char		path[MAXPGPATH];
-	struct stat sb;
+	if (watch && cluster_cnt > 1)
+	{
+		puts("-w/--watch can only be used with a single data directory");
+		exit(1);
+	}
 
-	printf("Checking directory %s...\n", datadir);
+	if (unordered && sort_key != SORT_NONE)
+	{
+		puts("--unordered can't be used with --sort");
+		exit(1);
+	}
 
-	snprintf(path, MAXPGPATH, "%s/PG_VERSION", datadir);
-	if (stat(path, &sb) != 0)
+	if ((check_lag || fail_on_corrupt) && !check)
 	{
-		printf("%s is not a PostgreSQL directory\n", datadir);
+		puts("--max-lag-bytes and --fail-on-corrupt require --check");
 		exit(1);
 	}
 
-	fd = fopen(path, "r");
-	if (fd == NULL)
+	if (check && (watch || daemon_listen != NULL))
 	{
-		printf("Unable to read PG_VERSION file in %s\n", datadir);
-		fclose(fd);
+		puts("--check can't be used with -w/--watch or --daemon");
 		exit(1);
 	}
 
-	ret = fscanf(fd, "%ld.%ld", &file_major, &file_minor);
-	fclose(fd);
+	/*
+	 * The lag is measured as the WAL the slot retains, and a segment which
+	 * isn't archived only matters once it has gone from pg_wal.
+	 */
+	if (check_lag || wal_archive != NULL)
+		wal_retention = true;
 
-	if (ret != 2)
+	if (compare_live && (watch || cluster_cnt > 1))
 	{
-		printf("PG_VERSION file in %s does not contain a valid version number\n", datadir);
+		puts("--compare-live can only be used with a single data directory, and not with -w/--watch");
 		exit(1);
 	}
 
-	version_num = (file_major * 10000) + (file_minor * 100);
-
-	if (version_num < MIN_SUPPORTED_VERSION_NUM)
+	for (i = 0; i < cluster_cnt; i++)
 	{
-		printf("This data directory is for PostgreSQL %ld.%ld; %s supports %s or later\n",
-			   file_major,
-			   file_minor,
-			   progname,
-			   MIN_SUPPORTED_VERSION
-			);
-		exit(0);
+		if (clusters[i].is_archive &&
+			(watch || daemon_listen != NULL || cache_file != NULL || wal_retention ||
+			 spill_files || compare_live || db_names || io_engine != IO_ENGINE_SYNC))
+		{
+			printf("Archive or remote data directory \"%s\" can't be used with -w/--watch, --daemon, --cache, -r/--wal-retention, --wal-archive, --spill-files, --compare-live, --db-names or --io-engine=io_uring\n",
+				   clusters[i].datadir);
+			exit(1);
+		}
 	}
-}
 
+	if ((save_path != NULL || diff_path != NULL) &&
+		(watch || daemon_listen != NULL || check || cluster_cnt > 1))
+	{
+		puts("--save and --diff can only be used with a single data directory, and not with -w/--watch, --daemon or --check");
+		exit(1);
+	}
 
-static void
-ScanReplSlotDirs(const char *datadir)
-{
-	char slotdir_path[MAXPGPATH];
-	DIR			  *slotdir;
-	struct dirent *slotdir_ent;
-	int			   slotdir_cnt = 0;
+	if (summary &&
+		(watch || daemon_listen != NULL || check || save_path != NULL ||
+		 diff_path != NULL || sort_key != SORT_NONE))
+	{
+		puts("--summary can't be used with -w/--watch, --daemon, --check, --save, --diff or --sort");
+		exit(1);
+	}
 
-	snprintf(slotdir_path, MAXPGPATH,
-			 "%s/pg_replslot",
-			 datadir);
+	if (diff_path != NULL && output_format == OUTPUT_PROMETHEUS)
+	{
+		puts("--diff can't be used with -f/--format=prometheus");
+		exit(1);
+	}
 
-	slotdir = opendir(slotdir_path);
+	if (daemon_listen != NULL && (watch || output_path != NULL))
+	{
+		puts("--daemon can't be used with -w/--watch or -o/--output");
+		exit(1);
+	}
 
-	if (slotdir == NULL)
+	if (output_path != NULL && output_format == OUTPUT_TEXT)
 	{
-		printf("Unable to open directory '%s'\n", datadir);
+		puts("-o/--output requires a machine-readable -f/--format");
 		exit(1);
 	}
 
+	/* the slots of all remote hosts are fetched at once, up front */
+	FetchRemoteClusters(clusters, cluster_cnt, ssh_command);
 
-	while ((slotdir_ent = readdir(slotdir)) != NULL) {
-		struct stat statbuf;
-		char slotdir_ent_path[MAXPGPATH];
+	/*
+	 * With a single data directory, any problem with it ends the run as
+	 * before; with several, that directory is skipped and reflected in the
+	 * exit status.
+	 */
+	for (i = 0; i < cluster_cnt; i++)
+	{
+		int			ret = ValidatePgVersion(&clusters[i]);
 
-		if(strcmp(slotdir_ent->d_name, ".") == 0 || strcmp(slotdir_ent->d_name, "..") == 0)
+		if (ret < 0)
 			continue;
 
-		snprintf(slotdir_ent_path, MAXPGPATH,
-				 "%s/%s",
-				 slotdir_path,
-				 slotdir_ent->d_name);
+		if (cluster_cnt == 1)
+			exit(ret);
 
+		exit_status = Max(exit_status, ret);
+	}
 
-		if (stat(slotdir_ent_path, &statbuf) == 0 && !S_ISDIR(statbuf.st_mode))
-			continue;
+	error_pool = StringPoolCreate();
 
-		ReadReplSlotDir(slotdir_ent_path);
+	if (cache_file != NULL)
+		slot_cache = SlotCacheLoad(cache_file);
 
-		slotdir_cnt++;
-	}
+	if (wal_retention)
+	{
+		for (i = 0; i < cluster_cnt; i++)
+		{
+			if (clusters[i].valid)
+				clusters[i].wal_index = ScanDataDirWal(&clusters[i]);
 
-	closedir(slotdir);
+			/* the lag of its slots can't be checked, so the check can't pass */
+			if (clusters[i].valid && clusters[i].wal_index == NULL && check_lag)
+				exit_status = Max(exit_status, 1);
+		}
+	}
 
-	if (slotdir_cnt == 0)
+	if (wal_archive != NULL)
 	{
-		puts("No replication slots found");
-		exit(0);
+		wal_archive_index = ScanClustersWalArchive();
+		if (wal_archive_index == NULL)
+			exit(1);
+
+		if (verbose)
+			fprintf(output_format == OUTPUT_TEXT ? stdout : stderr,
+					"%i segment(s) found in WAL archive %s\n",
+					wal_archive_index->segment_cnt, wal_archive);
 	}
 
-	printf("%i replication slot(s) found\n\n", slotdir_cnt);
-
-	if (replslot_info_start != NULL)
+	/* a data directory whose databases can't be read is still scanned */
+	if (db_names)
 	{
-		ReplslotInfo *ptr = replslot_info_start;
-
-		do
+		for (i = 0; i < cluster_cnt; i++)
 		{
-			if (ptr->slotfile_parsed == false)
-			{
-				printf("Unable to parse slot \"%s\":\n%s\n", ptr->name, ptr->error);
-			}
-			else
-			{
-				int i;
-
-				printf("%s\n", ptr->name);
+			if (clusters[i].valid)
+				clusters[i].db_names = ReadDatabaseNames(&clusters[i]);
+		}
+	}
 
-				for (i = 0; i < strlen(ptr->name); i++)
-				{
-					putchar('-');
-				}
-				puts("");
+	/* the daemon fetches pg_replication_slots afresh for each scan */
+	if (compare_live && daemon_listen == NULL)
+	{
+		clusters[0].live_slots = FetchLiveSlots(live_conninfo);
+		if (clusters[0].live_slots == NULL)
+			exit(1);
+	}
 
-				printf("  Type: ");
-				if (ptr->type == RS_PHYSICAL )
-					puts("physical");
-				else
-					printf("logical; DB oid: %u", ptr->db_oid);
+	if (daemon_listen != NULL)
+	{
+		/* without --cache, keep the cache in memory between refreshes */
+		if (slot_cache == NULL)
+			slot_cache = SlotCacheLoad(NULL);
 
-				printf("  Persistency: %s\n",ptr-> persistency == RS_PERSISTENT ? "persistent" : "empheral");
-				printf("  Version: %u\n", ptr->version);
-				printf("  Length: %u\n", ptr->length);
+		DaemonMain(daemon_listen, refresh_interval, RefreshDaemonReport);
+	}
+	else if (watch)
+		WatchReplSlotDirs(&clusters[0]);
+	else
+		ScanReplSlotDirs();
 
-			}
-			ptr = ptr->next;
-		} while (ptr != NULL);
+	for (i = 0; i < cluster_cnt; i++)
+	{
+		if (!clusters[i].valid)
+			exit_status = Max(exit_status, 1);
 	}
 
-	puts("");
-}
+	if (snapshot_failed)
+		exit_status = Max(exit_status, 1);
 
+	if (check_status != CHECK_OK)
+		exit(check_status);
+
+	exit(exit_status);
+}
 
-/*
- * parts copied from RestoreSlotFromDisk()
- */
 
 static void
-ReadReplSlotDir(const char *replslot_dir)
+AddCluster(const char *datadir)
 {
-	ReplicationSlotOnDisk cp;
-	FILE *fd;
-	char		path[MAXPGPATH];
-	int			readBytes;
+	ClusterInfo *cluster;
+	struct stat statbuf;
 
-	ReplslotInfo *replslot_info_current;
+	if (cluster_cnt == clusters_size)
+	{
+		clusters_size = Max(clusters_size * 2, 8);
+		clusters = pg_realloc(clusters, clusters_size * sizeof(ClusterInfo));
+	}
 
-	snprintf(path, MAXPGPATH,
-			 "%s/state",
-			 replslot_dir);
+	cluster = &clusters[cluster_cnt++];
+	memset(cluster, 0, sizeof(ClusterInfo));
 
-	replslot_info_current = pg_malloc0(sizeof(ReplslotInfo));
+	cluster->datadir = pg_strdup(datadir);
+	cluster->slotdir_fd = -1;
+	snprintf(cluster->slotdir_path, MAXPGPATH,
+			 "%s/pg_replslot",
+			 datadir);
 
-	if (replslot_info_start == NULL)
+	/*
+	 * A regular file is taken to be a tar archive of a data directory; the
+	 * slots of a remote one are fetched as a tar archive too.
+	 */
+	if (ParseRemoteDataDir(datadir, &cluster->remote_host, &cluster->remote_dir))
 	{
-		replslot_info_start = replslot_info_current;
-		replslot_info_last = replslot_info_current;
+		/* it would be taken as an option by ssh */
+		if (cluster->remote_host[0] == '-')
+		{
+			printf("Invalid host in remote data directory \"%s\"\n", datadir);
+			exit(1);
+		}
+		cluster->is_archive = true;
 	}
 	else
-	{
-		replslot_info_last->next = replslot_info_current;
-	}
-
+		cluster->is_archive = stat(datadir, &statbuf) == 0 && S_ISREG(statbuf.st_mode);
+}
 
-	replslot_info_last = replslot_info_current;
-	replslot_info_last->next = NULL;
 
-	replslot_info_last->slotfile_parsed = true;
-	*replslot_info_last->error = '\0';
-	*replslot_info_last->name = '\0';
-	replslot_info_last->version = 0;
-	replslot_info_last->length = 0;
-	replslot_info_last->db_oid = InvalidOid;
-	replslot_info_last->persistency = RS_PERSISTENT;
-	replslot_info_last->next = NULL;
+/*
+ * Add the data directories listed in a file, one per line; blank lines
+ * and lines starting with '#' are ignored.
+ */
+static void
+ReadPgdataList(const char *filename)
+{
+	FILE	   *fd;
+	char		line[MAXPGPATH];
 
-	fd = fopen(path, "rb");
+	fd = fopen(filename, "r");
 	if (fd == NULL)
 	{
-		snprintf(
-			replslot_info_last->error, MAXLEN,
-			"Unable to open replication slot file %s:\n%s\n",
-			   path,
-			   strerror(errno)
-			);
-		replslot_info_last->slotfile_parsed = false;
-
-		fclose(fd);
-		return;
+		printf("Unable to open data directory list \"%s\": %s\n",
+			   filename, strerror(errno));
+		exit(1);
 	}
 
-	/* read part of statefile that's guaranteed to be version independent */
-	readBytes = fread(&cp, 1, ReplicationSlotOnDiskConstantSize, fd);
-	if (readBytes != ReplicationSlotOnDiskConstantSize)
+	while (fgets(line, sizeof(line), fd) != NULL)
 	{
-		fclose(fd);
-
-		snprintf(
-			replslot_info_last->error, MAXLEN,
-			"could not read file \"%s\", read %d of %u",
-			path, readBytes,
-			(uint32) ReplicationSlotOnDiskConstantSize);
-		return;
-	}
+		size_t		len = strlen(line);
+		char	   *start = line;
 
-	/* verify magic */
-	if (cp.magic != SLOT_MAGIC)
-	{
-		fclose(fd);
+		while (len > 0 && isspace((unsigned char) line[len - 1]))
+			line[--len] = '\0';
 
-		snprintf(
-			replslot_info_last->error, MAXLEN,
-			"replication slot file \"%s\" has wrong magic number: %u instead of %u",
-			path, cp.magic, SLOT_MAGIC);
-		return;
-	}
+		while (isspace((unsigned char) *start))
+			start++;
 
-	/* verify version */
-	if (cp.version < MIN_SLOT_VERSION || cp.version > MAX_SLOT_VERSION)
-	{
-		fclose(fd);
+		if (*start == '\0' || *start == '#')
+			continue;
 
-		snprintf(
-			replslot_info_last->error, MAXLEN,
-			"replication slot file \"%s\" has unsupported version %u",
-			path, cp.version);
-		return;
+		AddCluster(start);
 	}
 
-	/* boundary check on length */
-	if (cp.length != ReplicationSlotOnDiskV2Size)
-	{
-		fclose(fd);
+	fclose(fd);
+}
 
-		snprintf(
-			replslot_info_last->error, MAXLEN,
-			"replication slot file \"%s\" has corrupted length %u",
-			path, cp.length);
-		return;
-	}
 
-	/* Now that we know the size, read the entire file */
-	readBytes = fread((char *) &cp + ReplicationSlotOnDiskConstantSize,
-					  1,
-					  cp.length,
-					  fd);
-	if (readBytes != cp.length)
-	{
-		fclose(fd);
-		snprintf(
-			replslot_info_last->error, MAXLEN,
-			"could not read file \"%s\", read %d of %u",
-			path, readBytes, cp.length);
-		return;
-	}
 
+/*
+ * See also eponymous function in src/backend/utils/init/miscinit.c
+ *
+ * Returns -1 if the data directory can be scanned, otherwise the exit
+ * status the problem found warrants.
+ */
+static int
+ValidatePgVersion(ClusterInfo *cluster)
+{
+	FILE	   *fd;
+	int			ret;
+
+	long		file_major,
+				file_minor,
+				version_num;
 
-	strncpy(
-		replslot_info_last->name,
-		cp.slotdata.name.data,
-		MAXLEN);
+	const char *datadir = cluster->datadir;
+	char		path[MAXPGPATH];
+	char		version[32];
+	struct stat sb;
 
-	replslot_info_last->version = cp.version;
-	replslot_info_last->length =  cp.length;
+	if (output_format == OUTPUT_TEXT && !check)
+		printf("Checking %s %s...\n",
+			   cluster->is_archive && cluster->remote_host == NULL ? "archive" : "directory",
+			   datadir);
 
-	if (cp.slotdata.database == InvalidOid)
+	if (cluster->is_archive)
 	{
-		replslot_info_last->type = RS_PHYSICAL;
+		/*
+		 * The slots are read from the archive together with PG_VERSION; a
+		 * remote data directory's have already been fetched.
+		 */
+		if (cluster->remote_host == NULL)
+			cluster->archive = ReadSlotArchive(datadir);
+		if (cluster->archive == NULL)
+			return 1;
+
+		if (cluster->archive->pg_version == NULL)
+		{
+			printf("%s does not contain a PostgreSQL data directory\n", datadir);
+			return 1;
+		}
+
+		strlcpy(version, cluster->archive->pg_version, sizeof(version));
 	}
 	else
 	{
-		replslot_info_last->type = RS_LOGICAL;
-		replslot_info_last->db_oid = (uint32)cp.slotdata.database;
-	}
+		snprintf(path, MAXPGPATH, "%s/PG_VERSION", datadir);
+		if (stat(path, &sb) != 0)
+		{
+			printf("%s is not a PostgreSQL directory\n", datadir);
+			return 1;
+		}
 
-	replslot_info_last->persistency = cp.slotdata.persistency;
+		fd = fopen(path, "r");
+		if (fd == NULL || fgets(version, sizeof(version), fd) == NULL)
+		{
+			printf("Unable to read PG_VERSION file in %s\n", datadir);
+			if (fd != NULL)
+				fclose(fd);
+			return 1;
+		}
 
-	fclose(fd);
-}
+		fclose(fd);
+	}
 
+	ret = sscanf(version, "%ld.%ld", &file_major, &file_minor);
 
-static void
-do_usage(void)
-{
-	printf(_("%s: replication slot reader\n"), progname);
-	printf(_("Try \"%s --help\" for more information.\n"), progname);
-}
+	/* from PostgreSQL 10, PG_VERSION contains only the major version */
+	if (ret == 1 && file_major >= 10)
+	{
+		file_minor = 0;
+		ret = 2;
+	}
+
+	if (ret != 2)
+	{
+		printf("PG_VERSION file in %s does not contain a valid version number\n", datadir);
+		return 1;
+	}
+
+	version_num = (file_major * 10000) + (file_minor * 100);
+
+	if (version_num < MIN_SUPPORTED_VERSION_NUM)
+	{
+		printf("This data directory is for PostgreSQL %ld.%ld; %s supports %s or later\n",
+			   file_major,
+			   file_minor,
+			   progname,
+			   MIN_SUPPORTED_VERSION
+			);
+		return 0;
+	}
+
+	cluster->pg_version_num = (int) version_num;
+	cluster->valid = true;
+
+	return -1;
+}
+
+
+/*
+ * Index the segments in the data directory's WAL directory, which was
+ * renamed from pg_xlog to pg_wal in PostgreSQL 10.  Returns NULL, having
+ * reported why, if they can't be, leaving the WAL retention of the data
+ * directory's slots unknown.
+ */
+static WalSegmentIndex *
+ScanDataDirWal(const ClusterInfo *cluster)
+{
+	char		wal_dir[MAXPGPATH];
+	uint32		segment_size;
+
+	segment_size = ReadWalSegmentSize(cluster->datadir);
+	if (segment_size == 0)
+		return NULL;
+
+	snprintf(wal_dir, MAXPGPATH,
+			 "%s/%s",
+			 cluster->datadir,
+			 cluster->pg_version_num >= 100000 ? "pg_wal" : "pg_xlog");
+
+	return ScanWalSegments(wal_dir, segment_size);
+}
+
+
+/*
+ * Index the segments in the WAL archive, which are taken to be the size of
+ * those in the first data directory's WAL.
+ */
+static WalSegmentIndex *
+ScanClustersWalArchive(void)
+{
+	uint32		segment_size = DEFAULT_WAL_SEGMENT_SIZE;
+	int			i;
+
+	for (i = 0; i < cluster_cnt; i++)
+	{
+		if (clusters[i].wal_index != NULL)
+		{
+			segment_size = clusters[i].wal_index->segment_size;
+			break;
+		}
+	}
+
+	return ScanWalArchive(wal_archive, segment_size, s3_command);
+}
+
+
+/*
+ * Find the slot directories of every data directory being scanned, then
+ * read and output them all together.
+ */
+static void
+ScanReplSlotDirs(void)
+{
+	SlotDirEntry  *entries;
+	int			   entry_cnt;
+	instr_time	   scan_start;
+
+	PhaseStart(&scan_start);
+
+	entry_cnt = ListReplSlotDirs(&entries);
+
+	if (check)
+	{
+		check_status = CheckReplSlotDirs(entries, entry_cnt);
+
+		/* a check stopped early hasn't seen every slot, so keep the old cache */
+		if (check_status == CHECK_OK && slot_cache != NULL)
+			SlotCacheWrite(slot_cache);
+
+		CloseReplSlotDirs(entries, entry_cnt);
+		return;
+	}
+
+	if (verbose)
+		fprintf(output_format == OUTPUT_TEXT ? stdout : stderr,
+				"%i stat() call(s) avoided using d_type\n", stat_calls_avoided);
+
+	if (summary)
+		SummarizeReplSlotDirs(entries, entry_cnt);
+	else
+		ReadReplSlotDirs(entries, entry_cnt);
+
+	if (clusters[0].live_slots != NULL)
+		ReportUnmatchedLiveSlots(clusters[0].live_slots,
+								 output_format == OUTPUT_TEXT ? stdout : stderr);
+
+	if (slot_cache != NULL)
+	{
+		if (verbose)
+		{
+			int			hits;
+			int			misses;
+
+			SlotCacheGetStats(slot_cache, &hits, &misses);
+			fprintf(output_format == OUTPUT_TEXT ? stdout : stderr,
+					"%i slot(s) read from cache, %i state file(s) read\n",
+					hits, misses);
+		}
+
+		SlotCacheWrite(slot_cache);
+	}
+
+	if (collect_stats)
+	{
+		instr_time	scan_end;
+
+		INSTR_TIME_SET_CURRENT(scan_end);
+		INSTR_TIME_SUBTRACT(scan_end, scan_start);
+		PrintScanStats(&scan_end, entry_cnt);
+	}
+
+	CloseReplSlotDirs(entries, entry_cnt);
+}
+
+
+/*
+ * Open the slot directory of every data directory being scanned, and
+ * collect the slot directories in them into "*entries_p"; returns the
+ * number found.  The slot directories are left open for the state files
+ * to be read relative to, until CloseReplSlotDirs().
+ */
+static int
+ListReplSlotDirs(SlotDirEntry **entries_p)
+{
+	SlotDirEntry  *entries;
+	int			   entry_cnt = 0;
+	int			   entries_size = 64;
+	int			   i;
+	instr_time	   phase_start;
+
+	entries = pg_malloc(entries_size * sizeof(SlotDirEntry));
+
+	for (i = 0; i < cluster_cnt; i++)
+	{
+		ClusterInfo	  *cluster = &clusters[i];
+		struct dirent *slotdir_ent;
+
+		if (!cluster->valid)
+			continue;
+
+		if (cluster->archive != NULL)
+		{
+			int			j;
+
+			for (j = 0; j < cluster->archive->slot_cnt; j++)
+			{
+				if (entry_cnt == entries_size)
+				{
+					entries_size *= 2;
+					entries = pg_realloc(entries,
+										 entries_size * sizeof(SlotDirEntry));
+				}
+
+				entries[entry_cnt].cluster = cluster;
+				entries[entry_cnt].slot_name =
+					pg_strdup(cluster->archive->slots[j].slot_name);
+
+				entry_cnt++;
+			}
+
+			continue;
+		}
+
+		PhaseStart(&phase_start);
+		cluster->slotdir = opendir(cluster->slotdir_path);
+		PhaseEnd(PHASE_READDIR, &phase_start);
+
+		if (cluster->slotdir == NULL)
+		{
+			printf("Unable to open directory '%s'\n", cluster->datadir);
+
+			if (cluster_cnt == 1)
+				exit(1);
+
+			cluster->valid = false;
+			continue;
+		}
+
+		/* state files are opened relative to the still-open slot directory */
+		cluster->slotdir_fd = dirfd(cluster->slotdir);
+
+		/*
+		 * Collect the slot directories first, so the state files can be read
+		 * in parallel while still being reported in directory order.
+		 */
+		for (;;)
+		{
+			PhaseStart(&phase_start);
+			slotdir_ent = readdir(cluster->slotdir);
+			PhaseEnd(PHASE_READDIR, &phase_start);
+			CountEvent(COUNT_READDIR, 1);
+
+			if (slotdir_ent == NULL)
+				break;
+
+			if(strcmp(slotdir_ent->d_name, ".") == 0 || strcmp(slotdir_ent->d_name, "..") == 0)
+				continue;
+
+			if (!IsSlotDirEntry(cluster->slotdir, slotdir_ent))
+				continue;
+
+			if (entry_cnt == entries_size)
+			{
+				entries_size *= 2;
+				entries = pg_realloc(entries,
+									 entries_size * sizeof(SlotDirEntry));
+			}
+
+			entries[entry_cnt].cluster = cluster;
+			entries[entry_cnt].slot_name = pg_strdup(slotdir_ent->d_name);
+
+			entry_cnt++;
+		}
+	}
+
+	*entries_p = entries;
+
+	return entry_cnt;
+}
+
+
+/*
+ * Close the slot directories opened by ListReplSlotDirs(), and free the
+ * entries it collected.
+ */
+static void
+CloseReplSlotDirs(SlotDirEntry *entries, int entry_cnt)
+{
+	int			i;
+
+	for (i = 0; i < cluster_cnt; i++)
+	{
+		if (clusters[i].slotdir != NULL)
+		{
+			closedir(clusters[i].slotdir);
+			clusters[i].slotdir = NULL;
+			clusters[i].slotdir_fd = -1;
+		}
+	}
+
+	for (i = 0; i < entry_cnt; i++)
+		pg_free(entries[i].slot_name);
+	pg_free(entries);
+}
+
+
+/*
+ * Rescan the slots for --daemon, and render them into "json" and
+ * "prometheus".  Only state files which have changed since the previous
+ * scan are read, the rest being taken from the slot cache.
+ */
+static void
+RefreshDaemonReport(PQExpBuffer json, PQExpBuffer prometheus)
+{
+	SlotDirEntry *entries;
+	int			entry_cnt;
+	ReplslotArray replslot_array;
+	int			i;
+
+	if (wal_retention)
+	{
+		for (i = 0; i < cluster_cnt; i++)
+		{
+			if (!clusters[i].valid)
+				continue;
+
+			if (clusters[i].wal_index != NULL)
+				FreeWalSegmentIndex(clusters[i].wal_index);
+			clusters[i].wal_index = ScanDataDirWal(&clusters[i]);
+		}
+	}
+
+	/* if the archive can't be listed this time, the last listing is used */
+	if (wal_archive != NULL)
+	{
+		WalSegmentIndex *index = ScanClustersWalArchive();
+
+		if (index != NULL)
+		{
+			FreeWalSegmentIndex(wal_archive_index);
+			wal_archive_index = index;
+		}
+	}
+
+	/* databases may have been created or renamed since */
+	if (db_names)
+	{
+		for (i = 0; i < cluster_cnt; i++)
+		{
+			if (!clusters[i].valid)
+				continue;
+
+			if (clusters[i].db_names != NULL)
+				FreeDatabaseNames(clusters[i].db_names);
+			clusters[i].db_names = ReadDatabaseNames(&clusters[i]);
+		}
+	}
+
+	/* if the server can't be reached, the slots are served without live data */
+	if (compare_live)
+	{
+		if (clusters[0].live_slots != NULL)
+			FreeLiveSlots(clusters[0].live_slots);
+		clusters[0].live_slots = FetchLiveSlots(live_conninfo);
+	}
+
+	entry_cnt = ListReplSlotDirs(&entries);
+
+	ReplslotArrayInit(&replslot_array, entry_cnt);
+	ReadReplSlotDirsToArray(entries, entry_cnt, &replslot_array);
+
+	if (sort_key != SORT_NONE)
+		ReplslotArraySort(&replslot_array, sort_key);
+
+	OutputToBuffer(&replslot_array, OUTPUT_JSON, json);
+	OutputToBuffer(&replslot_array, OUTPUT_PROMETHEUS, prometheus);
+
+	if (verbose)
+	{
+		int			hits;
+		int			misses;
+
+		SlotCacheGetStats(slot_cache, &hits, &misses);
+		fprintf(stderr, "%i slot(s) read from cache, %i state file(s) read\n",
+				hits, misses);
+	}
+
+	SlotCacheWrite(slot_cache);
+
+	ReplslotArrayFree(&replslot_array);
+	StringPoolReset(error_pool);
+	CloseReplSlotDirs(entries, entry_cnt);
+}
+
+
+#ifdef __linux__
+
+/*
+ * Add an inotify watch on a slot directory, recording which slot it
+ * belongs to in the "watched_slots" table (indexed by watch descriptor).
+ */
+static void
+AddSlotWatch(int inotify_fd, const char *slotdir_path, const char *slot_name)
+{
+	char		path[MAXPGPATH];
+	int			wd;
+
+	snprintf(path, MAXPGPATH,
+			 "%s/%s",
+			 slotdir_path,
+			 slot_name);
+
+	/*
+	 * SaveSlotToPath() writes "state.tmp" and renames it over "state", so
+	 * IN_MOVED_TO catches a rewritten state file; IN_CLOSE_WRITE also
+	 * catches files written in place.
+	 */
+	wd = inotify_add_watch(inotify_fd, path,
+						   IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR);
+	if (wd < 0)
+	{
+		printf("Unable to watch directory '%s': %s\n", path, strerror(errno));
+		return;
+	}
+
+	if (wd >= watched_slots_size)
+	{
+		int			old_size = watched_slots_size;
+
+		watched_slots_size = Max(watched_slots_size * 2, wd + 1);
+		watched_slots = pg_realloc(watched_slots,
+								   watched_slots_size * sizeof(WatchedSlot));
+		memset(&watched_slots[old_size], 0,
+			   (watched_slots_size - old_size) * sizeof(WatchedSlot));
+	}
+
+	if (watched_slots[wd].slot_name != NULL)
+		pg_free(watched_slots[wd].slot_name);
+
+	watched_slots[wd].slot_name = pg_strdup(slot_name);
+	watched_slots[wd].changed = false;
+}
+
+
+static void
+RemoveSlotWatch(int wd)
+{
+	if (wd < 0 || wd >= watched_slots_size || watched_slots[wd].slot_name == NULL)
+		return;
+
+	pg_free(watched_slots[wd].slot_name);
+	watched_slots[wd].slot_name = NULL;
+	watched_slots[wd].changed = false;
+}
+
+
+/*
+ * Queue a watched slot for re-reading, unless it already is.
+ */
+static void
+MarkSlotChanged(int wd)
+{
+	if (wd < 0 || wd >= watched_slots_size || watched_slots[wd].slot_name == NULL)
+		return;
+
+	if (watched_slots[wd].changed)
+		return;
+
+	watched_slots[wd].changed = true;
+
+	if (changed_slots_cnt == changed_slots_size)
+	{
+		changed_slots_size = Max(changed_slots_size * 2, 64);
+		changed_slots = pg_realloc(changed_slots, changed_slots_size * sizeof(int));
+	}
+
+	changed_slots[changed_slots_cnt++] = wd;
+}
+
+
+static int
+FindSlotWatch(const char *slot_name)
+{
+	int			wd;
+
+	for (wd = 0; wd < watched_slots_size; wd++)
+	{
+		if (watched_slots[wd].slot_name != NULL &&
+			strcmp(watched_slots[wd].slot_name, slot_name) == 0)
+			return wd;
+	}
+
+	return -1;
+}
+
+
+/*
+ * slot.c creates and drops slot directories by renaming them from and to
+ * "<name>.tmp"; those intermediate names are not slots.
+ */
+static bool
+IsTempSlotDirName(const char *name)
+{
+	size_t		len = strlen(name);
+
+	return len >= 4 && strcmp(name + len - 4, ".tmp") == 0;
+}
+
+#endif
+
+/*
+ * Perform the initial scan, then watch pg_replslot for slots being created
+ * or dropped and each slot directory for its state file being rewritten,
+ * re-reading only the slots which changed.  Does not return.
+ */
+static void
+WatchReplSlotDirs(ClusterInfo *cluster)
+{
+#ifdef __linux__
+	const char *slotdir_path = cluster->slotdir_path;
+	int			inotify_fd;
+	int			slotdir_wd;
+	DIR		   *slotdir;
+	struct dirent *slotdir_ent;
+	char		buf[65536] pg_attribute_aligned(__alignof__(struct inotify_event));
+
+	inotify_fd = inotify_init1(IN_CLOEXEC);
+	if (inotify_fd < 0)
+	{
+		printf("Unable to initialize inotify: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	slotdir_wd = inotify_add_watch(inotify_fd, slotdir_path,
+								   IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE |
+								   IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR);
+	if (slotdir_wd < 0)
+	{
+		printf("Unable to watch directory '%s': %s\n", slotdir_path, strerror(errno));
+		exit(1);
+	}
+
+	slotdir = opendir(slotdir_path);
+	if (slotdir == NULL)
+	{
+		printf("Unable to open directory '%s'\n", cluster->datadir);
+		exit(1);
+	}
+
+	/*
+	 * Watches are placed before the initial scan, so no state file rewrite
+	 * can fall between the two.
+	 */
+	while ((slotdir_ent = readdir(slotdir)) != NULL)
+	{
+		if (strcmp(slotdir_ent->d_name, ".") == 0 || strcmp(slotdir_ent->d_name, "..") == 0)
+			continue;
+
+		if (IsTempSlotDirName(slotdir_ent->d_name) || !IsSlotDirEntry(slotdir, slotdir_ent))
+			continue;
+
+		AddSlotWatch(inotify_fd, slotdir_path, slotdir_ent->d_name);
+	}
+
+	ScanReplSlotDirs();
+	fflush(stdout);
+
+	/*
+	 * Slots are only re-read once they have changed, so the cache won't help,
+	 * unless every slot is read again to rewrite the output file.
+	 */
+	if (slot_cache != NULL && output_path == NULL)
+	{
+		SlotCacheFree(slot_cache);
+		slot_cache = NULL;
+	}
+
+	/* the initial scan closed its own handle on the directory */
+	cluster->slotdir = slotdir;
+	cluster->slotdir_fd = dirfd(slotdir);
+
+	for (;;)
+	{
+		ssize_t		len;
+		char	   *ptr;
+		bool		rescan = false;
+		int			wd;
+		int			i;
+		int			output_cnt = 0;
+
+		len = read(inotify_fd, buf, sizeof(buf));
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			printf("Unable to read inotify events: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		for (ptr = buf; ptr < buf + len;
+			 ptr += sizeof(struct inotify_event) + ((struct inotify_event *) ptr)->len)
+		{
+			const struct inotify_event *event = (const struct inotify_event *) ptr;
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				/* events were lost, so every watched slot must be re-read */
+				rescan = true;
+				continue;
+			}
+
+			if (event->wd == slotdir_wd)
+			{
+				if (event->mask & IN_DELETE_SELF)
+				{
+					printf("Directory '%s' was removed\n", slotdir_path);
+					exit(1);
+				}
+
+				if (event->len == 0 || IsTempSlotDirName(event->name) ||
+					!(event->mask & IN_ISDIR))
+					continue;
+
+				if (event->mask & (IN_MOVED_TO | IN_CREATE))
+				{
+					AddSlotWatch(inotify_fd, slotdir_path, event->name);
+
+					MarkSlotChanged(FindSlotWatch(event->name));
+				}
+				else if (event->mask & (IN_MOVED_FROM | IN_DELETE))
+				{
+					wd = FindSlotWatch(event->name);
+					if (wd >= 0)
+					{
+						fprintf(output_format == OUTPUT_TEXT ? stdout : stderr,
+								"Replication slot \"%s\" dropped\n", event->name);
+						inotify_rm_watch(inotify_fd, wd);
+						RemoveSlotWatch(wd);
+					}
+				}
+
+				continue;
+			}
+
+			if (event->mask & IN_IGNORED)
+			{
+				RemoveSlotWatch(event->wd);
+				continue;
+			}
+
+			if (event->len > 0 && strcmp(event->name, "state") == 0)
+				MarkSlotChanged(event->wd);
+		}
+
+		if (rescan)
+		{
+			changed_slots_cnt = 0;
+
+			for (wd = 0; wd < watched_slots_size; wd++)
+			{
+				watched_slots[wd].changed = false;
+				MarkSlotChanged(wd);
+			}
+		}
+
+		/* WAL will have been added and removed since the last refresh */
+		if (wal_retention && changed_slots_cnt > 0)
+		{
+			if (cluster->wal_index != NULL)
+				FreeWalSegmentIndex(cluster->wal_index);
+			cluster->wal_index = ScanDataDirWal(cluster);
+
+			if (wal_archive != NULL)
+			{
+				WalSegmentIndex *index = ScanClustersWalArchive();
+
+				if (index != NULL)
+				{
+					FreeWalSegmentIndex(wal_archive_index);
+					wal_archive_index = index;
+				}
+			}
+		}
+
+		/*
+		 * An output file must always hold every slot, so it is rewritten
+		 * with a full scan; with --cache, only the changed slots are
+		 * actually read.
+		 */
+		if (output_path != NULL && changed_slots_cnt > 0)
+		{
+			for (i = 0; i < changed_slots_cnt; i++)
+				watched_slots[changed_slots[i]].changed = false;
+			changed_slots_cnt = 0;
+
+			ScanReplSlotDirs();
+
+			cluster->slotdir = slotdir;
+			cluster->slotdir_fd = dirfd(slotdir);
+		}
+
+		/* re-read each changed slot once, however many events it had */
+		for (i = 0; i < changed_slots_cnt; i++)
+		{
+			ReplslotInfo replslot_info;
+
+			wd = changed_slots[i];
+			watched_slots[wd].changed = false;
+
+			/* dropped since it was marked */
+			if (watched_slots[wd].slot_name == NULL)
+				continue;
+
+			memset(&replslot_info, 0, sizeof(ReplslotInfo));
+			ReadReplSlotDir(cluster, watched_slots[wd].slot_name,
+							&replslot_info);
+
+			if (!ReplslotMatchesFilter(&replslot_info, &slot_filter))
+				continue;
+
+			if (output_cnt++ == 0)
+				OutputUpdateBegin();
+
+			OutputSlot(&replslot_info);
+		}
+
+		if (output_cnt > 0)
+			OutputEnd();
+
+		StringPoolReset(error_pool);
+
+		changed_slots_cnt = 0;
+
+		fflush(stdout);
+	}
+#else
+	puts("-w/--watch is only supported on Linux");
+	exit(1);
+#endif
+}
+
+
+/*
+ * Determine whether a pg_replslot entry is a directory, using the entry
+ * type readdir() provides where possible and only falling back to stat()
+ * when the filesystem doesn't report it (or for symbolic links, which
+ * stat() follows).
+ *
+ * As before, an entry which cannot be stat()ed is treated as a slot
+ * directory, so the failure is reported when its state file is read.
+ */
+static bool
+IsSlotDirEntry(DIR *slotdir, struct dirent *slotdir_ent)
+{
+	struct stat statbuf;
+	instr_time	phase_start;
+	int			ret;
+
+#ifdef DT_UNKNOWN
+	if (slotdir_ent->d_type != DT_UNKNOWN && slotdir_ent->d_type != DT_LNK)
+	{
+		stat_calls_avoided++;
+		return slotdir_ent->d_type == DT_DIR;
+	}
+#endif
+
+	PhaseStart(&phase_start);
+	ret = fstatat(dirfd(slotdir), slotdir_ent->d_name, &statbuf, 0);
+	PhaseEnd(PHASE_STAT, &phase_start);
+	CountEvent(COUNT_STAT, 1);
+
+	if (ret == 0 && !S_ISDIR(statbuf.st_mode))
+		return false;
+
+	return true;
+}
+
+
+/*
+ * With --spill-files, count the files a logical slot's directory holds
+ * for transactions whose changes have been spilled to disk, and total
+ * their sizes.  Each is named after the transaction and the start of the
+ * WAL segment whose changes it holds, which gives the range of WAL the
+ * spilled changes come from; only the directory is read, never the files
+ * themselves.
+ */
+static void
+ScanSpillFiles(ClusterInfo *cluster, const char *slot_name,
+			   ReplslotInfo *replslot_info)
+{
+	DIR		   *dir;
+	struct dirent *ent;
+	instr_time	phase_start;
+	int			dir_fd;
+
+	dir_fd = openat(cluster->slotdir_fd, slot_name, O_RDONLY | O_DIRECTORY);
+	if (dir_fd < 0)
+		return;
+
+	dir = fdopendir(dir_fd);
+	if (dir == NULL)
+	{
+		close(dir_fd);
+		return;
+	}
+
+	replslot_info->spill_known = true;
+
+	for (;;)
+	{
+		struct stat statbuf;
+		XLogRecPtr	lsn;
+		int			ret;
+
+		PhaseStart(&phase_start);
+		ent = readdir(dir);
+		PhaseEnd(PHASE_READDIR, &phase_start);
+		CountEvent(COUNT_READDIR, 1);
+
+		if (ent == NULL)
+			break;
+
+		if (!ParseSpillFileName(ent->d_name, &lsn))
+			continue;
+
+		PhaseStart(&phase_start);
+		ret = fstatat(dir_fd, ent->d_name, &statbuf, AT_SYMLINK_NOFOLLOW);
+		PhaseEnd(PHASE_STAT, &phase_start);
+		CountEvent(COUNT_STAT, 1);
+
+		/* the transaction may have finished, and its files been removed */
+		if (ret != 0)
+			continue;
+
+		replslot_info->spill_file_cnt++;
+		replslot_info->spill_bytes += statbuf.st_size;
+
+		if (XLogRecPtrIsInvalid(replslot_info->spill_min_lsn) ||
+			lsn < replslot_info->spill_min_lsn)
+			replslot_info->spill_min_lsn = lsn;
+		if (lsn > replslot_info->spill_max_lsn)
+			replslot_info->spill_max_lsn = lsn;
+	}
+
+	closedir(dir);
+}
+
+
+/*
+ * Spill files are named "xid-<xid>-lsn-<hi>-<lo>.spill"; see
+ * ReorderBufferSerializedPath() in src/backend/replication/logical/reorderbuffer.c
+ */
+static bool
+ParseSpillFileName(const char *name, XLogRecPtr *lsn)
+{
+	TransactionId xid;
+	uint32		hi;
+	uint32		lo;
+	int			len = 0;
+
+	if (sscanf(name, "xid-%u-lsn-%X-%X.spill%n", &xid, &hi, &lo, &len) != 3 ||
+		len == 0 || name[len] != '\0')
+		return false;
+
+	*lsn = ((XLogRecPtr) hi << 32) | lo;
+	return true;
+}
+
+
+/*
+ * With --stats, note the start of a timed phase.
+ */
+static void
+PhaseStart(instr_time *start)
+{
+	if (collect_stats)
+		INSTR_TIME_SET_CURRENT(*start);
+}
+
+
+/*
+ * With --stats, add the time since "start" to the total for "phase".
+ * May be called from several threads at once; the totals are the sum of
+ * the time each thread spent in the phase.
+ */
+static void
+PhaseEnd(ScanPhase phase, const instr_time *start)
+{
+	instr_time	elapsed;
+
+	if (!collect_stats)
+		return;
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, *start);
+
+	pthread_mutex_lock(&scan_stats_lock);
+	INSTR_TIME_ADD(scan_stats.phase_times[phase], elapsed);
+	pthread_mutex_unlock(&scan_stats_lock);
+}
+
+
+/*
+ * With --stats, add "n" to "counter".  May be called from several threads
+ * at once.
+ */
+static void
+CountEvent(ScanCounter counter, uint64 n)
+{
+	if (!collect_stats)
+		return;
+
+	pthread_mutex_lock(&scan_stats_lock);
+	scan_stats.counters[counter] += n;
+	pthread_mutex_unlock(&scan_stats_lock);
+}
+
+
+/*
+ * Write the statistics collected by --stats to stderr, so they can't be
+ * mixed up with the report itself; as a single-line JSON object in the
+ * machine-readable formats.
+ */
+static void
+PrintScanStats(const instr_time *total, int slot_cnt)
+{
+	int			cache_hits = 0;
+	int			cache_misses = 0;
+	int			i;
+
+	if (slot_cache != NULL)
+		SlotCacheGetStats(slot_cache, &cache_hits, &cache_misses);
+
+	if (output_format != OUTPUT_TEXT)
+	{
+		fprintf(stderr, "{\"stats\": {\"slots\": %i, \"cache_hits\": %i, \"stat_avoided\": %i",
+				slot_cnt, cache_hits, stat_calls_avoided);
+
+		for (i = 0; i < NUM_SCAN_COUNTERS; i++)
+			fprintf(stderr, ", \"%s\": " UINT64_FORMAT,
+					scan_counter_names[i], scan_stats.counters[i]);
+
+		fprintf(stderr, ", \"time_ms\": {\"total\": %.3f",
+				INSTR_TIME_GET_MILLISEC(*total));
+
+		for (i = 0; i < NUM_SCAN_PHASES; i++)
+			fprintf(stderr, ", \"%s\": %.3f", scan_phase_names[i],
+					INSTR_TIME_GET_MILLISEC(scan_stats.phase_times[i]));
+
+		fprintf(stderr, "}}}\n");
+		return;
+	}
+
+	fprintf(stderr, "Scan statistics:\n");
+	fprintf(stderr, "  slots:            %12i\n", slot_cnt);
+	fprintf(stderr, "  parse failures:   %12llu\n",
+			(unsigned long long) scan_stats.counters[COUNT_PARSE_FAILURE]);
+	if (slot_cache != NULL)
+		fprintf(stderr, "  from cache:       %12i\n", cache_hits);
+	fprintf(stderr, "  readdir() calls:  %12llu\n",
+			(unsigned long long) scan_stats.counters[COUNT_READDIR]);
+	fprintf(stderr, "  stat() calls:     %12llu (%i avoided using d_type)\n",
+			(unsigned long long) scan_stats.counters[COUNT_STAT], stat_calls_avoided);
+	fprintf(stderr, "  open() calls:     %12llu\n",
+			(unsigned long long) scan_stats.counters[COUNT_OPEN]);
+	fprintf(stderr, "  read() calls:     %12llu\n",
+			(unsigned long long) scan_stats.counters[COUNT_READ]);
+	fprintf(stderr, "  bytes read:       %12llu\n",
+			(unsigned long long) scan_stats.counters[COUNT_BYTES_READ]);
+	if (io_engine == IO_ENGINE_URING)
+		fprintf(stderr, "  io_uring submits: %12llu\n",
+				(unsigned long long) scan_stats.counters[COUNT_URING_SUBMIT]);
+
+	fprintf(stderr, "  time:             %12.3f ms\n", INSTR_TIME_GET_MILLISEC(*total));
+
+	for (i = 0; i < NUM_SCAN_PHASES; i++)
+		fprintf(stderr, "    %-14s %12.3f ms\n", scan_phase_names[i],
+				INSTR_TIME_GET_MILLISEC(scan_stats.phase_times[i]));
+
+	if (num_jobs > 1 && io_engine == IO_ENGINE_SYNC)
+		fprintf(stderr, "  (the time for each phase is the total over %i jobs)\n", num_jobs);
+}
+
+
+/*
+ * Read and output the state file of each collected slot directory,
+ * omitting slots which don't match the filter options.
+ *
+ * Unless the slots have to be collected first, they are streamed: with a
+ * single job, each slot is output as soon as it has been read, so only one
+ * ReplslotInfo is needed however many slots there are, and with several,
+ * a pool of "num_jobs" worker threads reads the slots through a bounded
+ * window as they are output.  Otherwise all the slots are read, by the
+ * worker threads or with --io-engine=io_uring by this thread through
+ * batched io_uring submissions, then output in the order the directories
+ * were found or in the order given by --sort.  With --diff, only the slots
+ * which differ from the snapshot are output, and with --save the slots
+ * read are written to a new snapshot.
+ */
+static void
+ReadReplSlotDirs(SlotDirEntry *entries, int entry_cnt)
+{
+	ReplslotArray replslot_array;
+	instr_time	phase_start;
+	bool		stream;
+	int			i;
+
+	/*
+	 * Slots can be streamed to the output unless they need to be sorted,
+	 * read through io_uring, counted after filtering for the text report's
+	 * header, or kept for a snapshot.
+	 */
+	stream = io_engine == IO_ENGINE_SYNC &&
+		sort_key == SORT_NONE &&
+		!(output_format == OUTPUT_TEXT && ReplslotFilterIsSet(&slot_filter)) &&
+		save_path == NULL && diff_path == NULL;
+
+	if (stream && num_jobs > 1 && entry_cnt > 1)
+	{
+		StreamReplSlotDirs(entries, entry_cnt);
+		return;
+	}
+
+	if (stream)
+	{
+		ReplslotInfo replslot_info;
+
+		PhaseStart(&phase_start);
+		OutputBegin(entry_cnt);
+		PhaseEnd(PHASE_FORMAT, &phase_start);
+
+		for (i = 0; i < entry_cnt; i++)
+		{
+			ReadReplSlotDir(entries[i].cluster, entries[i].slot_name,
+							&replslot_info);
+
+			if (ReplslotMatchesFilter(&replslot_info, &slot_filter))
+			{
+				PhaseStart(&phase_start);
+				OutputSlot(&replslot_info);
+				PhaseEnd(PHASE_FORMAT, &phase_start);
+			}
+
+			if (replslot_info.error != NULL)
+				StringPoolReset(error_pool);
+		}
+
+		PhaseStart(&phase_start);
+		OutputEnd();
+		PhaseEnd(PHASE_FORMAT, &phase_start);
+		return;
+	}
+
+	ReplslotArrayInit(&replslot_array, entry_cnt);
+
+	ReadReplSlotDirsToArray(entries, entry_cnt, &replslot_array);
+
+	if (sort_key != SORT_NONE)
+		ReplslotArraySort(&replslot_array, sort_key);
+
+	PhaseStart(&phase_start);
+
+	if (diff_path != NULL)
+	{
+		Snapshot   *snapshot = SnapshotOpen(diff_path);
+
+		if (snapshot != NULL)
+		{
+			SnapshotDiff(snapshot, &replslot_array);
+			SnapshotClose(snapshot);
+		}
+		else
+			snapshot_failed = true;
+	}
+	else
+	{
+		OutputBegin(replslot_array.slot_cnt);
+
+		for (i = 0; i < replslot_array.slot_cnt; i++)
+			OutputSlot(&replslot_array.slots[i]);
+
+		OutputEnd();
+	}
+
+	PhaseEnd(PHASE_FORMAT, &phase_start);
+
+	/* the snapshot just diffed against may be the one replaced */
+	if (save_path != NULL && !SnapshotWrite(save_path, &replslot_array))
+		snapshot_failed = true;
+
+	ReplslotArrayFree(&replslot_array);
+	StringPoolReset(error_pool);
+}
+
+
+/*
+ * Stream the slots, read by a pool of worker threads, to the output; see
+ * ReplslotPipeline.
+ *
+ * The error strings of slots which couldn't be parsed are kept until the
+ * end, as a worker may be adding one to the pool at any time.
+ */
+static void
+StreamReplSlotDirs(SlotDirEntry *entries, int entry_cnt)
+{
+	ReplslotPipeline pipeline;
+	pthread_t  *workers;
+	int			num_workers = Min(num_jobs, entry_cnt);
+	instr_time	phase_start;
+	int			i;
+
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.slot_read, NULL);
+	pthread_cond_init(&pipeline.slot_free, NULL);
+	pipeline.entries = entries;
+	pipeline.entry_cnt = entry_cnt;
+	pipeline.next_entry = 0;
+	pipeline.window_size = Min(num_jobs * PIPELINE_SLOTS_PER_JOB, entry_cnt);
+	pipeline.window = pg_malloc(pipeline.window_size * sizeof(ReplslotInfo));
+	pipeline.unordered = unordered;
+	pipeline.window_read = pg_malloc0(pipeline.window_size * sizeof(bool));
+	pipeline.next_output = 0;
+	pipeline.free_slots = pg_malloc(pipeline.window_size * sizeof(int));
+	pipeline.free_cnt = pipeline.window_size;
+	pipeline.read_slots = pg_malloc(pipeline.window_size * sizeof(int));
+	pipeline.read_head = 0;
+	pipeline.read_cnt = 0;
+
+	for (i = 0; i < pipeline.window_size; i++)
+		pipeline.free_slots[i] = i;
+
+	PhaseStart(&phase_start);
+	OutputBegin(entry_cnt);
+	PhaseEnd(PHASE_FORMAT, &phase_start);
+
+	workers = pg_malloc(num_workers * sizeof(pthread_t));
+
+	for (i = 0; i < num_workers; i++)
+	{
+		int			ret = pthread_create(&workers[i], NULL,
+										 StreamReplSlotDirsWorker, &pipeline);
+
+		if (ret != 0)
+		{
+			printf("Unable to create worker thread: %s\n", strerror(ret));
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < entry_cnt; i++)
+	{
+		int			slot;
+
+		pthread_mutex_lock(&pipeline.lock);
+
+		if (pipeline.unordered)
+		{
+			while (pipeline.read_cnt == 0)
+				pthread_cond_wait(&pipeline.slot_read, &pipeline.lock);
+
+			slot = pipeline.read_slots[pipeline.read_head];
+			pipeline.read_head = (pipeline.read_head + 1) % pipeline.window_size;
+			pipeline.read_cnt--;
+		}
+		else
+		{
+			slot = pipeline.next_output % pipeline.window_size;
+
+			while (!pipeline.window_read[slot])
+				pthread_cond_wait(&pipeline.slot_read, &pipeline.lock);
+		}
+
+		pthread_mutex_unlock(&pipeline.lock);
+
+		if (ReplslotMatchesFilter(&pipeline.window[slot], &slot_filter))
+		{
+			PhaseStart(&phase_start);
+			OutputSlot(&pipeline.window[slot]);
+			PhaseEnd(PHASE_FORMAT, &phase_start);
+		}
+
+		pthread_mutex_lock(&pipeline.lock);
+
+		if (pipeline.unordered)
+			pipeline.free_slots[pipeline.free_cnt++] = slot;
+		else
+		{
+			pipeline.window_read[slot] = false;
+			pipeline.next_output++;
+		}
+
+		pthread_cond_broadcast(&pipeline.slot_free);
+		pthread_mutex_unlock(&pipeline.lock);
+	}
+
+	for (i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+
+	PhaseStart(&phase_start);
+	OutputEnd();
+	PhaseEnd(PHASE_FORMAT, &phase_start);
+
+	pthread_cond_destroy(&pipeline.slot_free);
+	pthread_cond_destroy(&pipeline.slot_read);
+	pthread_mutex_destroy(&pipeline.lock);
+	pg_free(pipeline.read_slots);
+	pg_free(pipeline.free_slots);
+	pg_free(pipeline.window_read);
+	pg_free(pipeline.window);
+	pg_free(workers);
+
+	StringPoolReset(error_pool);
+}
+
+
+static void *
+StreamReplSlotDirsWorker(void *arg)
+{
+	ReplslotPipeline *pipeline = (ReplslotPipeline *) arg;
+
+	for (;;)
+	{
+		int			entry_num;
+		int			slot;
+
+		pthread_mutex_lock(&pipeline->lock);
+
+		while (pipeline->next_entry < pipeline->entry_cnt &&
+			   !PipelineHasFreeSlot(pipeline))
+			pthread_cond_wait(&pipeline->slot_free, &pipeline->lock);
+
+		if (pipeline->next_entry >= pipeline->entry_cnt)
+		{
+			pthread_mutex_unlock(&pipeline->lock);
+			break;
+		}
+
+		entry_num = pipeline->next_entry++;
+
+		if (pipeline->unordered)
+			slot = pipeline->free_slots[--pipeline->free_cnt];
+		else
+			slot = entry_num % pipeline->window_size;
+
+		pthread_mutex_unlock(&pipeline->lock);
+
+		ReadReplSlotDir(pipeline->entries[entry_num].cluster,
+						pipeline->entries[entry_num].slot_name,
+						&pipeline->window[slot]);
+
+		pthread_mutex_lock(&pipeline->lock);
+
+		if (pipeline->unordered)
+		{
+			pipeline->read_slots[(pipeline->read_head + pipeline->read_cnt) %
+								 pipeline->window_size] = slot;
+			pipeline->read_cnt++;
+		}
+		else
+			pipeline->window_read[slot] = true;
+
+		pthread_cond_signal(&pipeline->slot_read);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Whether a worker may claim the next entry; called with the pipeline's
+ * lock held.
+ */
+static bool
+PipelineHasFreeSlot(const ReplslotPipeline *pipeline)
+{
+	if (pipeline->unordered)
+		return pipeline->free_cnt > 0;
+
+	return pipeline->next_entry < pipeline->next_output + pipeline->window_size;
+}
+
+
+/*
+ * With --check, read the slots matching the filter options until one of
+ * them fails a check, and return the exit status that warrants.  Nothing
+ * is output unless a check fails, and the remaining slots aren't read.
+ */
+static int
+CheckReplSlotDirs(SlotDirEntry *entries, int entry_cnt)
+{
+	ReplslotInfo replslot_info;
+	int			status = CHECK_OK;
+	int			i;
+
+	for (i = 0; i < entry_cnt && status == CHECK_OK; i++)
+	{
+		ReadReplSlotDir(entries[i].cluster, entries[i].slot_name,
+						&replslot_info);
+
+		if (ReplslotMatchesFilter(&replslot_info, &slot_filter))
+			status = CheckReplSlot(&replslot_info);
+
+		if (replslot_info.error != NULL)
+			StringPoolReset(error_pool);
+	}
+
+	return status;
+}
+
+
+/*
+ * With --summary, read the slots matching the filter options and output
+ * only the oldest horizons in each data directory, without the slots
+ * themselves being kept.
+ */
+static void
+SummarizeReplSlotDirs(SlotDirEntry *entries, int entry_cnt)
+{
+	SlotHorizons *horizons;
+	instr_time	phase_start;
+	int			i;
+
+	horizons = pg_malloc(cluster_cnt * sizeof(SlotHorizons));
+	for (i = 0; i < cluster_cnt; i++)
+		SlotHorizonsInit(&horizons[i], &clusters[i]);
+
+	if (io_engine != IO_ENGINE_SYNC)
+	{
+		ReplslotArray replslot_array;
+
+		/* io_uring reads into an array anyway */
+		ReplslotArrayInit(&replslot_array, entry_cnt);
+		ReadReplSlotDirsToArray(entries, entry_cnt, &replslot_array);
+
+		for (i = 0; i < replslot_array.slot_cnt; i++)
+		{
+			const ReplslotInfo *replslot_info = &replslot_array.slots[i];
+
+			SlotHorizonsAdd(&horizons[replslot_info->cluster - clusters], replslot_info);
+		}
+
+		ReplslotArrayFree(&replslot_array);
+	}
+	else if (num_jobs == 1 || entry_cnt <= 1)
+	{
+		ReplslotInfo replslot_info;
+
+		for (i = 0; i < entry_cnt; i++)
+		{
+			ReadReplSlotDir(entries[i].cluster, entries[i].slot_name,
+							&replslot_info);
+
+			if (ReplslotMatchesFilter(&replslot_info, &slot_filter))
+				SlotHorizonsAdd(&horizons[entries[i].cluster - clusters], &replslot_info);
+
+			if (replslot_info.error != NULL)
+				StringPoolReset(error_pool);
+		}
+	}
+	else
+	{
+		ReplslotSummaryQueue queue;
+		pthread_t  *workers;
+		int			num_workers = Min(num_jobs, entry_cnt);
+
+		pthread_mutex_init(&queue.lock, NULL);
+		queue.entries = entries;
+		queue.entry_cnt = entry_cnt;
+		queue.next_entry = 0;
+		queue.horizons = horizons;
+
+		workers = pg_malloc(num_workers * sizeof(pthread_t));
+
+		for (i = 0; i < num_workers; i++)
+		{
+			int			ret = pthread_create(&workers[i], NULL,
+											 SummarizeReplSlotDirsWorker, &queue);
+
+			if (ret != 0)
+			{
+				printf("Unable to create worker thread: %s\n", strerror(ret));
+				exit(1);
+			}
+		}
+
+		for (i = 0; i < num_workers; i++)
+			pthread_join(workers[i], NULL);
+
+		pthread_mutex_destroy(&queue.lock);
+		pg_free(workers);
+	}
+
+	PhaseStart(&phase_start);
+	OutputSummary(horizons, cluster_cnt);
+	PhaseEnd(PHASE_FORMAT, &phase_start);
+
+	pg_free(horizons);
+	StringPoolReset(error_pool);
+}
+
+
+static void *
+SummarizeReplSlotDirsWorker(void *arg)
+{
+	ReplslotSummaryQueue *queue = (ReplslotSummaryQueue *) arg;
+	SlotHorizons *horizons;
+	ReplslotInfo replslot_info;
+	int			i;
+
+	horizons = pg_malloc(cluster_cnt * sizeof(SlotHorizons));
+	for (i = 0; i < cluster_cnt; i++)
+		SlotHorizonsInit(&horizons[i], &clusters[i]);
+
+	for (;;)
+	{
+		int			entry_num;
+
+		pthread_mutex_lock(&queue->lock);
+		entry_num = queue->next_entry++;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (entry_num >= queue->entry_cnt)
+			break;
+
+		ReadReplSlotDir(queue->entries[entry_num].cluster,
+						queue->entries[entry_num].slot_name,
+						&replslot_info);
+
+		if (ReplslotMatchesFilter(&replslot_info, &slot_filter))
+			SlotHorizonsAdd(&horizons[queue->entries[entry_num].cluster - clusters],
+							&replslot_info);
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	for (i = 0; i < cluster_cnt; i++)
+		SlotHorizonsMerge(&queue->horizons[i], &horizons[i]);
+	pthread_mutex_unlock(&queue->lock);
+
+	pg_free(horizons);
+
+	return NULL;
+}
+
+
+static int
+CheckReplSlot(const ReplslotInfo *replslot_info)
+{
+	if (!replslot_info->slotfile_parsed)
+	{
+		if (!fail_on_corrupt)
+			return CHECK_OK;
+
+		fprintf(stderr, "Slot \"%s\" in %s can't be parsed: %s\n",
+				replslot_info->name, replslot_info->cluster->datadir,
+				replslot_info->error);
+		return CHECK_CORRUPT;
+	}
+
+	if (!check_lag)
+		return CHECK_OK;
+
+	if (!replslot_info->wal_retention_known)
+	{
+		fprintf(stderr, "The WAL retained by slot \"%s\" in %s is unknown\n",
+				replslot_info->name, replslot_info->cluster->datadir);
+		return CHECK_UNSCANNED;
+	}
+
+	if (replslot_info->wal_segment_missing)
+	{
+		fprintf(stderr, "Slot \"%s\" in %s requires WAL segment %s, which has been removed\n",
+				replslot_info->name, replslot_info->cluster->datadir,
+				replslot_info->oldest_wal_segment);
+		return CHECK_LAG;
+	}
+
+	if (replslot_info->wal_retained_bytes > max_lag_bytes)
+	{
+		fprintf(stderr, "Slot \"%s\" in %s retains " UINT64_FORMAT " bytes of WAL, more than " UINT64_FORMAT "\n",
+				replslot_info->name, replslot_info->cluster->datadir,
+				replslot_info->wal_retained_bytes, max_lag_bytes);
+		return CHECK_LAG;
+	}
+
+	return CHECK_OK;
+}
+
+
+/*
+ * Read the state file of each collected slot directory into
+ * "replslot_array", in directory order, dropping slots which don't match
+ * the filter options.
+ */
+static void
+ReadReplSlotDirsToArray(SlotDirEntry *entries, int entry_cnt,
+						ReplslotArray *replslot_array)
+{
+	int			i;
+
+#ifdef USE_LIBURING
+	if (io_engine == IO_ENGINE_URING)
+	{
+		ReadReplSlotDirsUring(entries, entry_cnt,
+							  ReplslotArrayExtend(replslot_array, entry_cnt));
+		ReplslotArrayFilter(replslot_array, &slot_filter);
+	}
+	else
+#endif
+	if (num_jobs == 1 || entry_cnt <= 1)
+	{
+		/* slots which don't match the filter are dropped straight away */
+		for (i = 0; i < entry_cnt; i++)
+		{
+			ReplslotInfo *replslot_info = ReplslotArrayExtend(replslot_array, 1);
+
+			ReadReplSlotDir(entries[i].cluster, entries[i].slot_name,
+							replslot_info);
+
+			if (!ReplslotMatchesFilter(replslot_info, &slot_filter))
+				replslot_array->slot_cnt--;
+		}
+	}
+	else
+	{
+		ReplslotWorkQueue queue;
+		pthread_t  *workers;
+		int			num_workers = Min(num_jobs, entry_cnt);
+
+		pthread_mutex_init(&queue.lock, NULL);
+		queue.entries = entries;
+		queue.replslot_infos = ReplslotArrayExtend(replslot_array, entry_cnt);
+		queue.entry_cnt = entry_cnt;
+		queue.next_entry = 0;
+
+		workers = pg_malloc(num_workers * sizeof(pthread_t));
+
+		for (i = 0; i < num_workers; i++)
+		{
+			int			ret = pthread_create(&workers[i], NULL,
+											 ReadReplSlotDirsWorker, &queue);
+
+			if (ret != 0)
+			{
+				printf("Unable to create worker thread: %s\n", strerror(ret));
+				exit(1);
+			}
+		}
+
+		for (i = 0; i < num_workers; i++)
+			pthread_join(workers[i], NULL);
+
+		pthread_mutex_destroy(&queue.lock);
+		pg_free(workers);
+
+		ReplslotArrayFilter(replslot_array, &slot_filter);
+	}
+}
+
+
+static void *
+ReadReplSlotDirsWorker(void *arg)
+{
+	ReplslotWorkQueue *queue = (ReplslotWorkQueue *) arg;
+
+	for (;;)
+	{
+		int			entry_num;
+
+		pthread_mutex_lock(&queue->lock);
+		entry_num = queue->next_entry++;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (entry_num >= queue->entry_cnt)
+			break;
+
+		ReadReplSlotDir(queue->entries[entry_num].cluster,
+						queue->entries[entry_num].slot_name,
+						&queue->replslot_infos[entry_num]);
+	}
+
+	return NULL;
+}
+
+
+#ifdef USE_LIBURING
+
+/*
+ * A state file being read through io_uring.
+ */
+typedef struct UringSlotRead
+{
+	ClusterInfo *cluster;
+	ReplslotInfo *replslot_info;
+	int			fd;
+	int			res;			/* result of the last operation */
+	bool		statbuf_valid;
+	struct stat statbuf;
+	char		state_path[MAXPGPATH];
+	char		path[MAXPGPATH];
+	ReplslotStateBuf buf;
+} UringSlotRead;
+
+/*
+ * Read the state files of "entry_cnt" slot directories into the matching
+ * entries of "replslot_infos" using io_uring.
+ *
+ * The slots are handled in batches of URING_BATCH_SIZE: the openat() of
+ * every state file in the batch is submitted at once, then for each file
+ * opened a read() linked to a close(), so each batch costs two
+ * submissions rather than three system calls per slot.  The close() is
+ * hard-linked, so it happens even if the read fails.
+ */
+static void
+ReadReplSlotDirsUring(SlotDirEntry *entries, int entry_cnt,
+					  ReplslotInfo *replslot_infos)
+{
+	struct io_uring ring;
+	UringSlotRead *reads;
+	instr_time	phase_start;
+	int			start;
+	int			ret;
+
+	/* each slot in a batch needs two submission queue entries at most */
+	ret = io_uring_queue_init(URING_BATCH_SIZE * 2, &ring, 0);
+	if (ret < 0)
+	{
+		printf("Unable to set up io_uring: %s\n", strerror(-ret));
+		exit(1);
+	}
+
+	reads = pg_malloc(URING_BATCH_SIZE * sizeof(UringSlotRead));
+
+	for (start = 0; start < entry_cnt; start += URING_BATCH_SIZE)
+	{
+		int			batch_cnt = Min(URING_BATCH_SIZE, entry_cnt - start);
+		int			pending = 0;
+		int			i;
+
+		for (i = 0; i < batch_cnt; i++)
+		{
+			UringSlotRead *rd = &reads[i];
+			struct io_uring_sqe *sqe;
+
+			rd->cluster = entries[start + i].cluster;
+			rd->replslot_info = &replslot_infos[start + i];
+			rd->fd = -1;
+
+			if (StartReplSlotRead(rd->cluster, entries[start + i].slot_name,
+								  rd->state_path, rd->path,
+								  &rd->statbuf, &rd->statbuf_valid,
+								  rd->replslot_info))
+			{
+				rd->replslot_info = NULL;
+				continue;
+			}
+
+			sqe = io_uring_get_sqe(&ring);
+			io_uring_prep_openat(sqe, rd->cluster->slotdir_fd, rd->state_path,
+								 O_RDONLY | PG_BINARY, 0);
+			io_uring_sqe_set_data(sqe, rd);
+			CountEvent(COUNT_OPEN, 1);
+			pending++;
+		}
+
+		PhaseStart(&phase_start);
+		ReapUringCompletions(&ring, pending);
+		PhaseEnd(PHASE_READ, &phase_start);
+		pending = 0;
+
+		for (i = 0; i < batch_cnt; i++)
+		{
+			UringSlotRead *rd = &reads[i];
+			struct io_uring_sqe *sqe;
+
+			/* taken from the cache */
+			if (rd->replslot_info == NULL)
+				continue;
+
+			if (rd->res < 0)
+			{
+				SetReplslotError(
+					rd->replslot_info,
+					"Unable to open replication slot file %s:\n%s\n",
+					rd->path,
+					strerror(-rd->res));
+				rd->replslot_info = NULL;
+				continue;
+			}
+
+			rd->fd = rd->res;
+
+			sqe = io_uring_get_sqe(&ring);
+			io_uring_prep_read(sqe, rd->fd, rd->buf.data, sizeof(rd->buf), 0);
+			io_uring_sqe_set_data(sqe, rd);
+			io_uring_sqe_set_flags(sqe, IOSQE_IO_HARDLINK);
+			CountEvent(COUNT_READ, 1);
+
+			sqe = io_uring_get_sqe(&ring);
+			io_uring_prep_close(sqe, rd->fd);
+			io_uring_sqe_set_data(sqe, NULL);
+
+			pending += 2;
+		}
+
+		PhaseStart(&phase_start);
+		ReapUringCompletions(&ring, pending);
+		PhaseEnd(PHASE_READ, &phase_start);
+
+		for (i = 0; i < batch_cnt; i++)
+		{
+			UringSlotRead *rd = &reads[i];
+
+			if (rd->replslot_info == NULL)
+				continue;
+
+			if (rd->res < 0)
+			{
+				SetReplslotError(
+					rd->replslot_info,
+					"could not read file \"%s\": %s",
+					rd->path, strerror(-rd->res));
+				continue;
+			}
+
+			CountEvent(COUNT_BYTES_READ, rd->res);
+
+			/*
+			 * A state file is read in full by a single read() in practice; a
+			 * short one is reported as such, as with pread().
+			 */
+			FinishReplSlotRead(rd->cluster, rd->path, &rd->buf, rd->res,
+							   rd->statbuf_valid ? &rd->statbuf : NULL,
+							   rd->replslot_info);
+		}
+	}
+
+	pg_free(reads);
+	io_uring_queue_exit(&ring);
+}
+
+
+/*
+ * Submit the queued operations and wait for "pending" of them to
+ * complete, recording each one's result in its UringSlotRead.
+ */
+static void
+ReapUringCompletions(struct io_uring *ring, int pending)
+{
+	int			ret;
+
+	if (pending == 0)
+		return;
+
+	ret = io_uring_submit(ring);
+	CountEvent(COUNT_URING_SUBMIT, 1);
+	if (ret < 0)
+	{
+		printf("Unable to submit to io_uring: %s\n", strerror(-ret));
+		exit(1);
+	}
+
+	while (pending > 0)
+	{
+		struct io_uring_cqe *cqe;
+		UringSlotRead *rd;
+
+		ret = io_uring_wait_cqe(ring, &cqe);
+		if (ret == -EINTR)
+			continue;
+
+		if (ret < 0)
+		{
+			printf("Unable to wait for io_uring completion: %s\n", strerror(-ret));
+			exit(1);
+		}
+
+		rd = (UringSlotRead *) io_uring_cqe_get_data(cqe);
+		if (rd != NULL)
+			rd->res = cqe->res;
+
+		io_uring_cqe_seen(ring, cqe);
+		pending--;
+	}
+}
+
+#endif							/* USE_LIBURING */
+
+
+/*
+ * parts copied from RestoreSlotFromDisk()
+ *
+ * The state file is opened relative to the cluster's pg_replslot directory
+ * descriptor and read in a single pread() call; the full path is
+ * only used for error messages.
+ *
+ * Only touches the ReplslotInfo it is given, so may be called from
+ * several threads at once.
+ */
+
+static void
+ReadReplSlotDir(ClusterInfo *cluster, const char *slot_name,
+				ReplslotInfo *replslot_info)
+{
+	ReplslotStateBuf buf;
+	int			fd;
+	struct stat statbuf;
+	bool		statbuf_valid;
+	char		state_path[MAXPGPATH];
+	char		path[MAXPGPATH];
+	ssize_t		readBytes = 0;
+	instr_time	phase_start;
+
+	if (StartReplSlotRead(cluster, slot_name, state_path, path,
+						  &statbuf, &statbuf_valid, replslot_info))
+		return;
+
+	if (cluster->archive != NULL)
+	{
+		const ArchivedSlot *slot = SlotArchiveLookup(cluster->archive, slot_name);
+
+		FinishReplSlotRead(cluster, path, &slot->buf, slot->len, NULL,
+						   replslot_info);
+		return;
+	}
+
+	PhaseStart(&phase_start);
+
+	fd = openat(cluster->slotdir_fd, state_path, O_RDONLY | PG_BINARY);
+	CountEvent(COUNT_OPEN, 1);
+	if (fd < 0)
+	{
+		PhaseEnd(PHASE_READ, &phase_start);
+		SetReplslotError(
+			replslot_info,
+			"Unable to open replication slot file %s:\n%s\n",
+			   path,
+			   strerror(errno)
+			);
+		return;
+	}
+
+	/*
+	 * The whole buffer is asked for in one go; a well-formed state file is
+	 * smaller, so pread() only needs to be repeated if less has been read
+	 * than the file's header says it holds.
+	 */
+	while ((size_t) readBytes < sizeof(buf) &&
+		   ((size_t) readBytes < ReplicationSlotOnDiskConstantSize ||
+			(size_t) readBytes < ReplicationSlotOnDiskConstantSize + buf.cp.length))
+	{
+		ssize_t		ret = pread(fd, buf.data + readBytes,
+								sizeof(buf) - readBytes,
+								readBytes);
+
+		CountEvent(COUNT_READ, 1);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0)
+		{
+			SetReplslotError(
+				replslot_info,
+				"could not read file \"%s\": %s",
+				path, strerror(errno));
+			close(fd);
+			PhaseEnd(PHASE_READ, &phase_start);
+			return;
+		}
+
+		if (ret == 0)
+			break;
+
+		readBytes += ret;
+	}
+
+	CountEvent(COUNT_BYTES_READ, readBytes);
+
+	/* the file actually read may have replaced the one looked up */
+	if (slot_cache != NULL)
+	{
+		statbuf_valid = fstat(fd, &statbuf) == 0;
+		CountEvent(COUNT_STAT, 1);
+	}
+
+	close(fd);
+
+	PhaseEnd(PHASE_READ, &phase_start);
+
+	FinishReplSlotRead(cluster, path, &buf, readBytes,
+					   statbuf_valid ? &statbuf : NULL, replslot_info);
+}
+
+
+/*
+ * Set up "replslot_info" for reading the state file of "slot_name", whose
+ * path relative to the slot directory and full path are returned in
+ * "state_path" and "path" (both MAXPGPATH bytes).
+ *
+ * With --cache, the state file is stat()ed first; if it hasn't been
+ * replaced since the slot was cached, the slot is taken from the cache
+ * and true is returned, in which case the state file needn't be read.
+ * Otherwise "statbuf_valid" says whether "statbuf" holds the result.
+ */
+static bool
+StartReplSlotRead(ClusterInfo *cluster, const char *slot_name,
+				  char *state_path, char *path,
+				  struct stat *statbuf, bool *statbuf_valid,
+				  ReplslotInfo *replslot_info)
+{
+	instr_time	phase_start;
+	int			ret;
+
+	snprintf(state_path, MAXPGPATH,
+			 "%s/state",
+			 slot_name);
+
+	snprintf(path, MAXPGPATH,
+			 "%s/%s",
+			 cluster->slotdir_path,
+			 state_path);
+
+	replslot_info->cluster = cluster;
+	replslot_info->slotfile_parsed = true;
+	replslot_info->error = NULL;
+	/* until the state file has been read, report the slot by its directory name */
+	strlcpy(replslot_info->name, slot_name, NAMEDATALEN);
+	replslot_info->version = 0;
+	replslot_info->length = 0;
+	replslot_info->db_oid = InvalidOid;
+	replslot_info->persistency = RS_PERSISTENT;
+	replslot_info->xmin = InvalidTransactionId;
+	replslot_info->catalog_xmin = InvalidTransactionId;
+	replslot_info->restart_lsn = InvalidXLogRecPtr;
+	replslot_info->confirmed_flush = InvalidXLogRecPtr;
+	*replslot_info->plugin = '\0';
+	replslot_info->wal_retention_known = false;
+	replslot_info->wal_retained_bytes = 0;
+	replslot_info->wal_retained_segments = 0;
+	replslot_info->wal_segment_missing = false;
+	*replslot_info->oldest_wal_segment = '\0';
+	replslot_info->wal_archive_known = false;
+	replslot_info->live_known = false;
+	replslot_info->live_found = false;
+	replslot_info->spill_known = false;
+	replslot_info->spill_file_cnt = 0;
+	replslot_info->spill_bytes = 0;
+	replslot_info->spill_min_lsn = InvalidXLogRecPtr;
+	replslot_info->spill_max_lsn = InvalidXLogRecPtr;
+
+	/* spill files come and go independently of the state file, so aren't cached */
+	if (spill_files)
+		ScanSpillFiles(cluster, slot_name, replslot_info);
+
+	*statbuf_valid = false;
+
+	if (slot_cache == NULL)
+		return false;
+
+	PhaseStart(&phase_start);
+	ret = fstatat(cluster->slotdir_fd, state_path, statbuf, 0);
+	PhaseEnd(PHASE_STAT, &phase_start);
+	CountEvent(COUNT_STAT, 1);
+
+	if (ret != 0)
+		return false;
+
+	*statbuf_valid = true;
+
+	if (!SlotCacheLookup(slot_cache, path, statbuf, replslot_info))
+		return false;
+
+	if (cluster->wal_index != NULL)
+		CalcWalRetention(cluster->wal_index, replslot_info);
+
+	if (wal_archive_index != NULL)
+		CalcWalArchive(wal_archive_index, replslot_info);
+
+	if (db_names)
+		SetDatabaseName(cluster->db_names, replslot_info);
+
+	if (cluster->live_slots != NULL)
+		CompareLiveSlot(cluster->live_slots, replslot_info);
+
+	SlotCacheStore(slot_cache, path, statbuf, replslot_info);
+
+	return true;
+}
+
+
+/*
+ * Validate the "readBytes" bytes of state file read into "buf" and fill in
+ * "replslot_info" from them.  If "statbuf" is given, it identifies the
+ * file the contents came from, for the slot to be cached.
+ */
+static void
+FinishReplSlotRead(ClusterInfo *cluster, const char *path,
+				   const ReplslotStateBuf *buf, ssize_t readBytes,
+				   const struct stat *statbuf, ReplslotInfo *replslot_info)
+{
+	const ReplslotFormat *format;
+	char		error[MAXLEN];
+	instr_time	phase_start;
+
+	PhaseStart(&phase_start);
+
+	format = ValidateReplSlotState(buf, readBytes, path, cluster->pg_version_num,
+								   error);
+	if (format == NULL)
+	{
+		SetReplslotError(replslot_info, "%s", error);
+		PhaseEnd(PHASE_VALIDATE, &phase_start);
+		return;
+	}
+
+	replslot_info->version = buf->cp.version;
+	replslot_info->length = buf->cp.length;
+
+	DecodeReplslotState(format, buf->data + ReplicationSlotOnDiskConstantSize,
+						replslot_info);
+
+	if (cluster->wal_index != NULL)
+		CalcWalRetention(cluster->wal_index, replslot_info);
+
+	if (wal_archive_index != NULL)
+		CalcWalArchive(wal_archive_index, replslot_info);
+
+	if (db_names)
+		SetDatabaseName(cluster->db_names, replslot_info);
+
+	if (cluster->live_slots != NULL)
+		CompareLiveSlot(cluster->live_slots, replslot_info);
+
+	if (slot_cache != NULL && statbuf != NULL)
+		SlotCacheStore(slot_cache, path, statbuf, replslot_info);
+
+	PhaseEnd(PHASE_VALIDATE, &phase_start);
+}
+
+
+/*
+ * Mark a slot as unparseable, recording the reason in the error string
+ * pool.
+ */
+static void
+SetReplslotError(ReplslotInfo *replslot_info, const char *fmt,...)
+{
+	char		error[MAXLEN];
+	va_list		args;
+
+	va_start(args, fmt);
+	vsnprintf(error, sizeof(error), fmt, args);
+	va_end(args);
+
+	replslot_info->slotfile_parsed = false;
+	replslot_info->error = StringPoolAdd(error_pool, error);
+
+	CountEvent(COUNT_PARSE_FAILURE, 1);
+}
+
+
+static void
+do_usage(void)
+{
+	printf(_("%s: replication slot reader\n"), progname);
+	printf(_("Try \"%s --help\" for more information.\n"), progname);
+}
 
 static void
 do_help(void)
@@ -430,9 +2922,42 @@ do_help(void)
 	printf(	 "\n");
 	printf(_("General options:\n"));
 	printf(_("	-?, --help							show this help, then exit\n"));
+	printf(_("	-v, --verbose						show additional scan details\n"));
 	printf(_("	-V, --version						output version information, then exit\n"));
 	printf(	 "\n");
 	printf(_("General configuration options:\n"));
-	printf(_("	-D, --pgdata=DIR					PostgreSQL data directory to examine\n"));
+	printf(_("	--cache=FILE						reuse slots parsed by a previous run if unchanged\n"));
+	printf(_("	--check								output nothing; exit with 2 or 3 if a check below fails\n"));
+	printf(_("	--compare-live=CONNSTR				compare with pg_replication_slots on the running server\n"));
+	printf(_("	--db-names							show logical slots' database names, read from pg_database\n"));
+	printf(_("	--daemon=ADDR						serve the slots over HTTP on [HOST:]PORT or a Unix socket\n"));
+	printf(_("	--diff=FILE							show only the slots changed since the snapshot in FILE\n"));
+	printf(_("	-D, --pgdata=DIR					PostgreSQL data directory, tar archive or HOST:DIR to examine (may be repeated)\n"));
+	printf(_("	-f, --format=FORMAT					output format (text, json, csv, tsv or prometheus)\n"));
+	printf(_("	-j, --jobs=NUM						number of threads to read slot files with\n"));
+	printf(_("	--io-engine=ENGINE					read slot files with sync (default) or io_uring\n"));
+	printf(_("	-L, --pgdata-list=FILE				read further data directories from FILE\n"));
+	printf(_("	-o, --output=FILE					write the report to FILE, replacing it atomically\n"));
+	printf(_("	--refresh-interval=SECS				with --daemon, rescan the slots this often (default 10)\n"));
+	printf(_("	--s3-command=CMD					run CMD to list an s3:// WAL archive (default \"aws s3api\")\n"));
+	printf(_("	--save=FILE							write a snapshot of the slots to FILE\n"));
+	printf(_("	--spill-files						show the number and size of each slot's spill files\n"));
+	printf(_("	--ssh-command=CMD					run CMD to connect to a HOST:DIR (default \"ssh -o BatchMode=yes\")\n"));
+	printf(_("	--stats								show timings and I/O call counts for the scan\n"));
+	printf(_("	--summary							show only the oldest restart_lsn, xmin and catalog_xmin\n"));
+	printf(_("	--unordered							with --jobs, output slots in the order they are read\n"));
+	printf(_("	--wal-archive=PATH					check each slot's required segment is in this directory or s3:// prefix\n"));
+	printf(_("	-r, --wal-retention					show how much WAL in pg_wal each slot retains\n"));
+	printf(_("	-w, --watch							after scanning, report slots as their state changes\n"));
+	printf(	 "\n");
+	printf(_("Check options:\n"));
+	printf(_("	--fail-on-corrupt					fail with exit status 2 if a state file can't be parsed\n"));
+	printf(_("	--max-lag-bytes=BYTES				fail with exit status 3 if a slot retains more WAL than this\n"));
+	printf(	 "\n");
+	printf(_("Filtering and sorting options:\n"));
+	printf(_("	--db-oid=OID						only show logical slots for this database\n"));
+	printf(_("	--plugin=NAME						only show logical slots using this output plugin\n"));
+	printf(_("	--type=TYPE							only show physical or logical slots\n"));
+	printf(_("	--sort=KEY							sort by name, restart_lsn, catalog_xmin, type or spill_bytes\n"));
 	printf(	 "\n");
 }
@@ -9,14 +9,20 @@
 #define PG_REPLSLOT_READER_H
 
 #include <getopt_long.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "postgres.h"
 #include "fmgr.h"
 
 #include "libpq-fe.h"
+#include "pqexpbuffer.h"
 #include "postgres_fe.h"
 
+#include "access/transam.h"
 #include "access/xlog.h"
+#include "portability/instr_time.h"
+#include "port/pg_crc32c.h"
 
 #define RR_VERSION "0.1"
 /* replication slots available from PostgreSQL 9.4 */
@@ -25,12 +31,62 @@
 
 #define MAXLEN 1024
 
+/* WAL segment files */
+#define WAL_SEGMENT_NAME_LEN		24
+#define DEFAULT_WAL_SEGMENT_SIZE	(16 * 1024 * 1024)
+#define MIN_WAL_SEGMENT_SIZE		(1024 * 1024)
+#define MAX_WAL_SEGMENT_SIZE		(1024 * 1024 * 1024)
+#define IsValidWalSegmentSize(size) \
+	((size) >= MIN_WAL_SEGMENT_SIZE && (size) <= MAX_WAL_SEGMENT_SIZE && \
+	 ((size) & ((size) - 1)) == 0)
+#define WalSegmentsPerXLogId(segment_size) \
+	(UINT64CONST(0x100000000) / (segment_size))
+
+/*
+ * global/pg_control.  Where in it ControlFileData's fields are varies from
+ * release to release, but those giving the sizes the cluster was built
+ * with always follow floatFormat, which holds CONTROL_FLOAT_FORMAT, and
+ * which is within its first CONTROL_READ_SIZE bytes.
+ *
+ * See src/include/catalog/pg_control.h
+ */
+#define CONTROL_FILE_SIZE			8192
+#define CONTROL_READ_SIZE			512
+#define CONTROL_FLOAT_FORMAT		1234567.0
+
+typedef struct ControlFileSizes
+{
+	double		floatFormat;
+	uint32		blcksz;
+	uint32		relseg_size;
+	uint32		xlog_blcksz;
+	uint32		xlog_seg_size;
+} ControlFileSizes;
+
+/* for printing XLogRecPtr values as %X/%X; provided by PostgreSQL 14 and later */
+#ifndef LSN_FORMAT_ARGS
+#define LSN_FORMAT_ARGS(lsn) ((uint32) ((lsn) >> 32)), ((uint32) (lsn))
+#endif
+
+/* upper limit for -j/--jobs */
+#define MAX_JOBS 256
+#define URING_BATCH_SIZE 256
+
 typedef enum ReplicationSlotType
 {
 	RS_PHYSICAL,
 	RS_LOGICAL
 } ReplicationSlotType;
 
+typedef enum OutputFormat
+{
+	OUTPUT_TEXT,
+	OUTPUT_JSON,
+	OUTPUT_CSV,
+	OUTPUT_TSV,
+	OUTPUT_PROMETHEUS
+} OutputFormat;
+
 
 /* ------------------------------------------------------------------------
  *	Below copied from:
@@ -57,13 +113,22 @@ typedef enum ReplicationSlotType
 #define SLOT_MAGIC		0x1051CA1		/* format identifier */
 
 /*
- * As of 2016-04, there is only one format version (number 2) in existence
- * in all PostgreSQL release versions and in the development code since slots
- * were introduced in 9.4; format version 1 was deprecated with 9.4rc1
- * (commit ec5896aed3c01da24c1f335f138817e9890d68b6).
+ * Format version 2 is written by PostgreSQL 9.4 to 13; format version 1 was
+ * deprecated with 9.4rc1 (commit ec5896aed3c01da24c1f335f138817e9890d68b6).
+ * PostgreSQL 14 to 16 write version 3, which adds two-phase decoding, and
+ * PostgreSQL 17 version 5, which adds failover slots (version 4 only ever
+ * existed during 17's development).
+ *
+ * The layout also changed without the version changing: 13 added
+ * "invalidated_at", which 16 replaced with "invalidated", so 13 writes a
+ * longer version 2, and 14 to 15 and 16 write version 3 of the same length
+ * but with different contents.  See slotformat.c for their layouts.
  */
 #define MIN_SLOT_VERSION	2		/* earliest slot format version we know about */
-#define MAX_SLOT_VERSION	2		/* latest slot format version we know about */
+#define MAX_SLOT_VERSION	5		/* latest slot format version we know about */
+
+#define SLOT_VERSION_TWO_PHASE	3	/* first version with two_phase */
+#define SLOT_VERSION_FAILOVER	5	/* first version with synced and failover */
 
 
 /*
@@ -82,7 +147,31 @@ typedef enum ReplicationSlotPersistency
 } ReplicationSlotPersistency;
 
 /*
- * On-Disk data of a replication slot, preserved across restarts.
+ * Slots can be invalidated, e.g. due to max_slot_wal_keep_size. If so, the
+ * 'invalidated' field is set to a value other than _NONE.
+ *
+ * As in PostgreSQL 16 and 17; PostgreSQL 18 made these bit flags, which
+ * leaves RS_INVAL_WAL_REMOVED and RS_INVAL_HORIZON unchanged, and stores
+ * wal_level_insufficient as RS_INVAL_WAL_LEVEL_FLAG and the new
+ * idle_timeout as RS_INVAL_IDLE_TIMEOUT_FLAG.
+ */
+typedef enum ReplicationSlotInvalidationCause
+{
+	RS_INVAL_NONE,
+	/* required WAL has been removed */
+	RS_INVAL_WAL_REMOVED,
+	/* required rows have been removed */
+	RS_INVAL_HORIZON,
+	/* wal_level insufficient for slot */
+	RS_INVAL_WAL_LEVEL,
+} ReplicationSlotInvalidationCause;
+
+#define RS_INVAL_WAL_LEVEL_FLAG		(1 << 2)
+#define RS_INVAL_IDLE_TIMEOUT_FLAG	(1 << 3)
+
+/*
+ * On-Disk data of a replication slot, preserved across restarts, as in
+ * PostgreSQL 9.4 to 12.
  */
 typedef struct ReplicationSlotPersistentData
 {
@@ -123,9 +212,109 @@ typedef struct ReplicationSlotPersistentData
 	NameData	plugin;
 } ReplicationSlotPersistentData;
 
+/*
+ * The slot data of format version 2 as in PostgreSQL 13, which is longer.
+ */
+typedef struct ReplicationSlotPersistentData13
+{
+	NameData	name;
+	Oid			database;
+	ReplicationSlotPersistency persistency;
+	TransactionId xmin;
+	TransactionId catalog_xmin;
+	XLogRecPtr	restart_lsn;
+
+	/* restart_lsn is copied here when the slot is invalidated */
+	XLogRecPtr	invalidated_at;
+
+	XLogRecPtr	confirmed_flush;
+	NameData	plugin;
+} ReplicationSlotPersistentData13;
+
+/*
+ * The slot data of format version 3, as in PostgreSQL 14 and 15;
+ * "two_phase_at" was called "initial_consistent_point" in 14.
+ */
+typedef struct ReplicationSlotPersistentDataV3
+{
+	NameData	name;
+	Oid			database;
+	ReplicationSlotPersistency persistency;
+	TransactionId xmin;
+	TransactionId catalog_xmin;
+	XLogRecPtr	restart_lsn;
+	XLogRecPtr	invalidated_at;
+	XLogRecPtr	confirmed_flush;
+
+	/*
+	 * LSN at which we enabled two_phase commit for this slot or LSN at which
+	 * we found a consistent point at the time of slot creation.
+	 */
+	XLogRecPtr	two_phase_at;
+
+	/*
+	 * Allow decoding of prepared transactions?
+	 */
+	bool		two_phase;
+
+	NameData	plugin;
+} ReplicationSlotPersistentDataV3;
+
+/*
+ * The slot data of format version 3 as in PostgreSQL 16, which is the same
+ * length as in 14 and 15.
+ */
+typedef struct ReplicationSlotPersistentData16
+{
+	NameData	name;
+	Oid			database;
+	ReplicationSlotPersistency persistency;
+	TransactionId xmin;
+	TransactionId catalog_xmin;
+	XLogRecPtr	restart_lsn;
+
+	/* RS_INVAL_NONE if valid, or the reason for having been invalidated */
+	ReplicationSlotInvalidationCause invalidated;
+
+	XLogRecPtr	confirmed_flush;
+	XLogRecPtr	two_phase_at;
+	bool		two_phase;
+	NameData	plugin;
+} ReplicationSlotPersistentData16;
+
+/*
+ * The slot data of format version 5, as in PostgreSQL 17.
+ */
+typedef struct ReplicationSlotPersistentDataV5
+{
+	NameData	name;
+	Oid			database;
+	ReplicationSlotPersistency persistency;
+	TransactionId xmin;
+	TransactionId catalog_xmin;
+	XLogRecPtr	restart_lsn;
+	ReplicationSlotInvalidationCause invalidated;
+	XLogRecPtr	confirmed_flush;
+	XLogRecPtr	two_phase_at;
+	bool		two_phase;
+	NameData	plugin;
+
+	/*
+	 * Was this slot synchronized from the primary server?
+	 */
+	char		synced;
+
+	/*
+	 * Is this a failover slot (sync candidate for standbys)? Only relevant
+	 * for logical slots on the primary server.
+	 */
+	bool		failover;
+} ReplicationSlotPersistentDataV5;
+
 
 /*
- * Replication slot on-disk data structure.
+ * Replication slot on-disk data structure, with the slot data of format
+ * version 2.
  */
 typedef struct ReplicationSlotOnDisk
 {
@@ -148,4 +337,382 @@ typedef struct ReplicationSlotOnDisk
 } ReplicationSlotOnDisk;
 
 
+/* ------------------------------------------------------------------------
+ *	pg_replslot_reader's own structures
+ * ------------------------------------------------------------------------
+ */
+
+/* larger than any known state file, so a longer one is detected as such */
+#define SLOT_STATE_BUFSIZE	512
+
+/*
+ * Buffer a state file is read into; only the version independent part is
+ * accessed through "cp", the rest being decoded according to its format.
+ */
+typedef union ReplslotStateBuf
+{
+	ReplicationSlotOnDisk cp;
+	char		data[SLOT_STATE_BUFSIZE];
+} ReplslotStateBuf;
+
+/*
+ * Where each field is in the slot data of one state file format, as
+ * written by PostgreSQL releases "min_version_num" to "max_version_num"
+ * (0 if still current), identified by its version and length.  An offset
+ * of -1 means the format doesn't have the field.
+ */
+typedef struct ReplslotFormat
+{
+	uint32		version;
+	uint32		length;
+	int			min_version_num;
+	int			max_version_num;
+
+	int16		name;
+	int16		database;
+	int16		persistency;
+	int16		xmin;
+	int16		catalog_xmin;
+	int16		restart_lsn;
+	int16		invalidated_at;	/* PostgreSQL 13 to 15 */
+	int16		invalidated;	/* PostgreSQL 16 onwards */
+	int16		confirmed_flush;
+	int16		two_phase_at;
+	int16		two_phase;
+	int16		plugin;
+	int16		synced;
+	int16		failover;
+} ReplslotFormat;
+
+typedef struct ReplslotInfo
+{
+	const struct ClusterInfo *cluster;	/* data directory the slot is in */
+	bool slotfile_parsed;
+	const char *error;			/* in the error string pool; NULL if parsed */
+	char name[NAMEDATALEN];
+	ReplicationSlotType type;
+	uint32 version;
+	uint32 length;
+	uint32 db_oid;
+	ReplicationSlotPersistency persistency;
+	TransactionId xmin;
+	TransactionId catalog_xmin;
+	XLogRecPtr restart_lsn;
+	uint32 invalidated;			/* RS_INVAL_NONE unless invalidated */
+	XLogRecPtr invalidated_at;	/* PostgreSQL 13 to 15 only */
+	XLogRecPtr confirmed_flush;
+	char plugin[NAMEDATALEN];
+	XLogRecPtr two_phase_at;	/* from format version 3 */
+	bool two_phase;
+	bool synced;				/* from format version 5 */
+	bool failover;
+
+	/* set by CalcWalRetention() */
+	bool wal_retention_known;
+	bool wal_segment_missing;
+	uint64 wal_retained_bytes;
+	int wal_retained_segments;
+	char oldest_wal_segment[WAL_SEGMENT_NAME_LEN + 1];
+
+	/* set by CalcWalArchive() */
+	bool wal_archive_known;
+	bool wal_archive_missing;
+	char archive_wal_segment[WAL_SEGMENT_NAME_LEN + 1];
+
+	/* set by CompareLiveSlot() */
+	bool live_known;
+	bool live_found;			/* the slot is in pg_replication_slots */
+	bool live_active;
+	XLogRecPtr live_restart_lsn;
+	XLogRecPtr live_confirmed_flush;
+
+	/* set by ScanSpillFiles() */
+	bool spill_known;
+	uint64 spill_file_cnt;
+	uint64 spill_bytes;
+	XLogRecPtr spill_min_lsn;	/* start of the oldest WAL segment spilled */
+	XLogRecPtr spill_max_lsn;	/* start of the newest */
+
+	/* set by SetDatabaseName(); NULL if unknown */
+	const char *db_name;
+} ReplslotInfo;
+
+/*
+ * A growable, contiguous array of slots.
+ */
+typedef struct ReplslotArray
+{
+	ReplslotInfo *slots;
+	int			slot_cnt;
+	int			slot_size;
+} ReplslotArray;
+
+typedef enum ReplslotSortKey
+{
+	SORT_NONE,
+	SORT_NAME,
+	SORT_RESTART_LSN,
+	SORT_CATALOG_XMIN,
+	SORT_TYPE,
+	SORT_SPILL_BYTES
+} ReplslotSortKey;
+
+/*
+ * Criteria given by the filter options; "type" is -1, "db_oid" InvalidOid
+ * and "plugin" NULL if not filtered on.
+ */
+typedef struct ReplslotFilter
+{
+	int			type;
+	Oid			db_oid;
+	const char *plugin;
+} ReplslotFilter;
+
+/*
+ * How a slot differs between a --diff snapshot and the current scan; a
+ * created slot's "old_" fields, and a dropped slot's current ones, are
+ * invalid.
+ */
+typedef enum ReplslotChange
+{
+	SLOT_CHANGED,
+	SLOT_CREATED,
+	SLOT_DROPPED
+} ReplslotChange;
+
+typedef struct ReplslotDiff
+{
+	ReplslotChange change;
+	const char *name;
+	ReplicationSlotType type;
+	XLogRecPtr	old_restart_lsn;
+	XLogRecPtr	restart_lsn;
+	XLogRecPtr	old_confirmed_flush;
+	XLogRecPtr	confirmed_flush;
+	TransactionId old_xmin;
+	TransactionId xmin;
+	TransactionId old_catalog_xmin;
+	TransactionId catalog_xmin;
+} ReplslotDiff;
+
+/*
+ * The oldest horizons among the slots of a data directory, with the slots
+ * holding them, for --summary; see horizon.c.
+ */
+typedef struct SlotHorizons
+{
+	const struct ClusterInfo *cluster;
+	int			slot_cnt;
+	int			unparsed_cnt;
+	XLogRecPtr	restart_lsn;
+	char		restart_lsn_slot[NAMEDATALEN];
+	TransactionId xmin;
+	char		xmin_slot[NAMEDATALEN];
+	TransactionId catalog_xmin;
+	char		catalog_xmin_slot[NAMEDATALEN];
+} SlotHorizons;
+
+typedef struct StringPool StringPool;
+
+typedef struct SlotCache SlotCache;
+
+typedef struct NameHash NameHash;
+
+typedef struct LiveSlotSet LiveSlotSet;
+
+typedef struct Snapshot Snapshot;
+
+typedef struct DatabaseNames DatabaseNames;
+
+typedef struct WalSegment
+{
+	XLogSegNo	segno;
+	TimeLineID	tli;
+} WalSegment;
+
+/*
+ * The WAL segments present in a directory, sorted by segment number and
+ * timeline; distinct_cnt[i] is the number of distinct segment numbers
+ * from segments[i] onwards.
+ */
+typedef struct WalSegmentIndex
+{
+	uint32		segment_size;
+	int			segment_cnt;
+	WalSegment *segments;
+	int		   *distinct_cnt;
+} WalSegmentIndex;
+
+/*
+ * The state file of a slot found in a tar archive, of which up to
+ * SLOT_STATE_BUFSIZE bytes are kept.
+ */
+typedef struct ArchivedSlot
+{
+	char	   *slot_name;
+	ssize_t		len;
+	ReplslotStateBuf buf;
+} ArchivedSlot;
+
+/*
+ * What is needed from a data directory in a tar archive: its PG_VERSION,
+ * and the state files in its pg_replslot, indexed by slot name.
+ */
+typedef struct SlotArchive
+{
+	char	   *pg_version;		/* NULL if the archive had none */
+	ArchivedSlot *slots;
+	int			slot_cnt;
+	int			slots_size;
+	NameHash   *by_name;
+} SlotArchive;
+
+/*
+ * A data directory being scanned.  "valid" is cleared if it turns out not
+ * to be usable, in which case it is skipped.
+ */
+typedef struct ClusterInfo
+{
+	const char *datadir;
+	bool		valid;
+	int			pg_version_num;
+	DIR		   *slotdir;
+	int			slotdir_fd;
+	char		slotdir_path[MAXPGPATH];
+	WalSegmentIndex *wal_index;
+	LiveSlotSet *live_slots;	/* with --compare-live */
+	bool		is_archive;		/* "datadir" is a tar archive, or remote */
+	SlotArchive *archive;		/* its contents, once read */
+	char	   *remote_host;	/* if "datadir" is HOST:DIR */
+	char	   *remote_dir;
+	DatabaseNames *db_names;	/* with --db-names */
+} ClusterInfo;
+
+
+/* pg_replslot_reader.c */
+extern bool wal_retention;
+extern int	cluster_cnt;
+extern bool compare_live;
+extern bool spill_files;
+extern bool db_names;
+extern const char *wal_archive;
+
+/* archive.c */
+extern SlotArchive *ReadSlotArchive(const char *path);
+extern SlotArchive *ReadSlotArchiveFd(int fd, const char *path);
+extern const ArchivedSlot *SlotArchiveLookup(const SlotArchive *archive,
+											 const char *slot_name);
+extern void FreeSlotArchive(SlotArchive *archive);
+
+/* remote.c */
+extern bool ParseRemoteDataDir(const char *datadir, char **host, char **dir);
+extern void FetchRemoteClusters(ClusterInfo *clusters, int cluster_cnt,
+								const char *ssh_command);
+extern pid_t SpawnCommand(const char *command, int *fd);
+extern void AppendShellQuoted(PQExpBuffer buf, const char *str);
+
+/* catalog.c */
+extern DatabaseNames *ReadDatabaseNames(const ClusterInfo *cluster);
+extern const char *LookupDatabaseName(const DatabaseNames *names, Oid oid);
+extern void SetDatabaseName(const DatabaseNames *names, ReplslotInfo *replslot_info);
+extern void FreeDatabaseNames(DatabaseNames *names);
+
+/* daemon.c */
+typedef void (*DaemonRefreshFunc) (PQExpBuffer json, PQExpBuffer prometheus);
+
+extern void DaemonMain(const char *listen_addr, int refresh_interval,
+					   DaemonRefreshFunc refresh);
+
+/* horizon.c */
+extern void SlotHorizonsInit(SlotHorizons *horizons, const ClusterInfo *cluster);
+extern void SlotHorizonsAdd(SlotHorizons *horizons, const ReplslotInfo *replslot_info);
+extern void SlotHorizonsMerge(SlotHorizons *into, const SlotHorizons *from);
+
+/* live.c */
+extern LiveSlotSet *FetchLiveSlots(const char *conninfo);
+extern void CompareLiveSlot(LiveSlotSet *live_slots, ReplslotInfo *replslot_info);
+extern void ReportUnmatchedLiveSlots(const LiveSlotSet *live_slots, FILE *fp);
+extern void FreeLiveSlots(LiveSlotSet *live_slots);
+
+/* output.c */
+extern OutputFormat output_format;
+extern const char *output_path;
+
+extern bool ParseOutputFormat(const char *name, OutputFormat *format);
+extern void OutputBegin(int slot_cnt);
+extern void OutputUpdateBegin(void);
+extern void OutputSlot(const ReplslotInfo *ptr);
+extern void OutputEnd(void);
+extern void OutputToBuffer(const ReplslotArray *array, OutputFormat format,
+						   PQExpBuffer buf);
+extern void OutputDiffBegin(int diff_cnt, double elapsed);
+extern void OutputDiff(const ReplslotDiff *diff);
+extern void OutputSummary(const SlotHorizons *horizons, int horizons_cnt);
+
+/* slotarray.c */
+extern void ReplslotArrayInit(ReplslotArray *array, int size_hint);
+extern ReplslotInfo *ReplslotArrayExtend(ReplslotArray *array, int cnt);
+extern void ReplslotArrayReset(ReplslotArray *array);
+extern void ReplslotArrayFree(ReplslotArray *array);
+extern void ReplslotArrayFilter(ReplslotArray *array, const ReplslotFilter *filter);
+extern void ReplslotArraySort(ReplslotArray *array, ReplslotSortKey sort_key);
+extern bool ReplslotFilterIsSet(const ReplslotFilter *filter);
+extern bool ReplslotMatchesFilter(const ReplslotInfo *replslot_info,
+								  const ReplslotFilter *filter);
+extern bool ParseSortKey(const char *name, ReplslotSortKey *sort_key);
+extern StringPool *StringPoolCreate(void);
+extern const char *StringPoolAdd(StringPool *pool, const char *str);
+extern void StringPoolReset(StringPool *pool);
+extern NameHash *NameHashCreate(int size_hint);
+extern void NameHashInsert(NameHash *hash, const char *key, int value);
+extern int	NameHashLookup(const NameHash *hash, const char *key);
+extern void NameHashFree(NameHash *hash);
+
+/* slotformat.c */
+extern const ReplslotFormat *LookupReplslotFormat(uint32 version, uint32 length,
+												  int pg_version_num);
+extern const ReplslotFormat *ReplslotFormatForPgVersion(int pg_version_num);
+extern bool ReplslotFormatExists(uint32 version, uint32 length);
+extern const ReplslotFormat *ValidateReplSlotState(const ReplslotStateBuf *buf,
+												   ssize_t readBytes, const char *path,
+												   int pg_version_num, char *error);
+extern const char *InvalidationCauseName(uint32 invalidated);
+extern void DecodeReplslotState(const ReplslotFormat *format, const char *slotdata,
+								ReplslotInfo *replslot_info);
+
+/* slotcache.c */
+extern SlotCache *SlotCacheLoad(const char *filename);
+extern bool SlotCacheLookup(SlotCache *cache, const char *path,
+							const struct stat *statbuf, ReplslotInfo *replslot_info);
+extern void SlotCacheStore(SlotCache *cache, const char *path,
+						   const struct stat *statbuf, const ReplslotInfo *replslot_info);
+extern void SlotCacheWrite(SlotCache *cache);
+extern void SlotCacheFree(SlotCache *cache);
+extern void SlotCacheGetStats(const SlotCache *cache, int *hits, int *misses);
+
+/* snapshot.c */
+extern bool SnapshotWrite(const char *filename, const ReplslotArray *array);
+extern Snapshot *SnapshotOpen(const char *filename);
+extern void SnapshotDiff(Snapshot *snapshot, const ReplslotArray *array);
+extern void SnapshotClose(Snapshot *snapshot);
+
+/* walseg.c */
+extern bool ParseWalSegmentName(const char *name, uint32 segment_size,
+								TimeLineID *tli, XLogSegNo *segno);
+extern void FormatWalSegmentName(char *buf, TimeLineID tli, XLogSegNo segno,
+								 uint32 segment_size);
+extern uint32 ReadWalSegmentSize(const char *datadir);
+extern WalSegmentIndex *ScanWalSegments(const char *wal_dir, uint32 segment_size);
+extern WalSegmentIndex *BuildWalSegmentIndex(char **names, int names_cnt,
+											 uint32 segment_size);
+extern void FreeWalSegmentIndex(WalSegmentIndex *index);
+extern int	WalSegmentIndexLookup(const WalSegmentIndex *index, XLogSegNo segno);
+extern void CalcWalRetention(const WalSegmentIndex *index, ReplslotInfo *replslot_info);
+
+/* walarchive.c */
+extern WalSegmentIndex *ScanWalArchive(const char *archive, uint32 segment_size,
+									   const char *s3_command);
+extern void CalcWalArchive(const WalSegmentIndex *index, ReplslotInfo *replslot_info);
+
+
 #endif	 /* PG_REPLSLOT_READER_H */
@@ -0,0 +1,315 @@
+/*
+ * remote.c
+ *
+ * Fetching of slot state from data directories on other hosts, given to
+ * -D as HOST:DIR.
+ *
+ * Rather than fetching PG_VERSION and each state file with a request of
+ * its own, a single command run over ssh lists the state files and
+ * writes them, together with PG_VERSION, to its standard output as a tar
+ * archive, which is read just like an archive on disk.  Fetching a host's
+ * slots therefore takes one connection and one round trip, however many
+ * slots it has.
+ *
+ * The hosts are fetched from concurrently, up to MAX_REMOTE_FETCHES at a
+ * time, each by a thread which starts the command and reads its output,
+ * so the time taken is that of the slowest host rather than the sum of
+ * all of them.  Everything is fetched before any of the slots are read.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "pg_replslot_reader.h"
+
+/* ssh connections open at once */
+#define MAX_REMOTE_FETCHES	64
+
+/*
+ * Run in the remote data directory; "find" rather than a glob, so the
+ * command line doesn't grow with the number of slots.
+ */
+#define REMOTE_TAR_COMMAND \
+	"{ echo PG_VERSION; find pg_replslot -mindepth 2 -maxdepth 2 -name state; } | tar -cf - -T -"
+
+typedef struct RemoteFetchQueue
+{
+	pthread_mutex_t lock;
+	ClusterInfo *clusters;
+	int			cluster_cnt;
+	int			next_cluster;
+	const char *ssh_command;
+} RemoteFetchQueue;
+
+/*
+ * Held while starting a command, so no other thread forks between a pipe
+ * being created and being marked close-on-exec.
+ */
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *FetchRemoteClustersWorker(void *arg);
+static SlotArchive *FetchRemoteCluster(const ClusterInfo *cluster,
+									   const char *ssh_command);
+
+
+/*
+ * Whether "datadir" is given as HOST:DIR, as with scp; a local path which
+ * happens to contain a colon is taken to be local.  Sets "host" and "dir",
+ * which are allocated, if so.
+ */
+bool
+ParseRemoteDataDir(const char *datadir, char **host, char **dir)
+{
+	const char *colon = strchr(datadir, ':');
+	struct stat statbuf;
+
+	if (colon == NULL || colon == datadir || colon[1] == '\0')
+		return false;
+
+	/* "./a:b" or "/a:b" is a local path */
+	if (memchr(datadir, '/', colon - datadir) != NULL)
+		return false;
+
+	if (stat(datadir, &statbuf) == 0)
+		return false;
+
+	*host = pg_malloc(colon - datadir + 1);
+	memcpy(*host, datadir, colon - datadir);
+	(*host)[colon - datadir] = '\0';
+	*dir = pg_strdup(colon + 1);
+
+	return true;
+}
+
+
+/*
+ * Fetch the slots of each remote cluster in "clusters" into its "archive",
+ * which is left NULL, having reported why, if that isn't possible.
+ */
+void
+FetchRemoteClusters(ClusterInfo *clusters, int cluster_cnt, const char *ssh_command)
+{
+	RemoteFetchQueue queue;
+	pthread_t  *workers;
+	int			remote_cnt = 0;
+	int			num_workers;
+	int			i;
+
+	for (i = 0; i < cluster_cnt; i++)
+	{
+		if (clusters[i].remote_host != NULL)
+			remote_cnt++;
+	}
+
+	if (remote_cnt == 0)
+		return;
+
+	pthread_mutex_init(&queue.lock, NULL);
+	queue.clusters = clusters;
+	queue.cluster_cnt = cluster_cnt;
+	queue.next_cluster = 0;
+	queue.ssh_command = ssh_command;
+
+	num_workers = Min(remote_cnt, MAX_REMOTE_FETCHES);
+	workers = pg_malloc(num_workers * sizeof(pthread_t));
+
+	for (i = 0; i < num_workers; i++)
+	{
+		if (pthread_create(&workers[i], NULL, FetchRemoteClustersWorker, &queue) != 0)
+		{
+			fprintf(stderr, "Unable to create thread\n");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+
+	pg_free(workers);
+	pthread_mutex_destroy(&queue.lock);
+}
+
+
+static void *
+FetchRemoteClustersWorker(void *arg)
+{
+	RemoteFetchQueue *queue = (RemoteFetchQueue *) arg;
+
+	for (;;)
+	{
+		ClusterInfo *cluster = NULL;
+
+		pthread_mutex_lock(&queue->lock);
+		while (queue->next_cluster < queue->cluster_cnt)
+		{
+			ClusterInfo *candidate = &queue->clusters[queue->next_cluster++];
+
+			if (candidate->remote_host != NULL)
+			{
+				cluster = candidate;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&queue->lock);
+
+		if (cluster == NULL)
+			break;
+
+		cluster->archive = FetchRemoteCluster(cluster, queue->ssh_command);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Run the tar command on "cluster"'s host and read the archive it writes;
+ * anything the command writes to stderr is passed through.
+ */
+static SlotArchive *
+FetchRemoteCluster(const ClusterInfo *cluster, const char *ssh_command)
+{
+	PQExpBufferData remote_command;
+	PQExpBufferData command;
+	SlotArchive *archive;
+	pid_t		pid;
+	int			fd;
+	int			status;
+
+	initPQExpBuffer(&remote_command);
+	appendPQExpBufferStr(&remote_command, "cd ");
+	AppendShellQuoted(&remote_command, cluster->remote_dir);
+	appendPQExpBufferStr(&remote_command, " && " REMOTE_TAR_COMMAND);
+
+	initPQExpBuffer(&command);
+	appendPQExpBuffer(&command, "%s ", ssh_command);
+	AppendShellQuoted(&command, cluster->remote_host);
+	appendPQExpBufferChar(&command, ' ');
+	AppendShellQuoted(&command, remote_command.data);
+
+	pid = SpawnCommand(command.data, &fd);
+
+	termPQExpBuffer(&remote_command);
+	termPQExpBuffer(&command);
+
+	if (pid < 0)
+	{
+		fprintf(stderr, "Unable to run ssh for \"%s\": %s\n",
+				cluster->datadir, strerror(errno));
+		return NULL;
+	}
+
+	/*
+	 * Reads to the end of the output and closes "fd"; the command only gets
+	 * SIGPIPE if the archive turned out to be unreadable, when the exit
+	 * status doesn't matter.
+	 */
+	archive = ReadSlotArchiveFd(fd, cluster->datadir);
+
+	while (waitpid(pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			status = -1;
+			break;
+		}
+	}
+
+	if (status != 0)
+	{
+		if (WIFEXITED(status))
+			fprintf(stderr, "The command fetching \"%s\" exited with status %i\n",
+					cluster->datadir, WEXITSTATUS(status));
+		else
+			fprintf(stderr, "The command fetching \"%s\" was terminated abnormally\n",
+					cluster->datadir);
+
+		if (archive != NULL)
+			FreeSlotArchive(archive);
+		archive = NULL;
+	}
+
+	return archive;
+}
+
+
+/*
+ * Start "command" with the shell, stdin from /dev/null and stdout to a
+ * pipe whose read end is returned in "fd"; returns the child's pid, or -1.
+ */
+pid_t
+SpawnCommand(const char *command, int *fd)
+{
+	int			pipe_fds[2];
+	pid_t		pid;
+
+	pthread_mutex_lock(&spawn_lock);
+
+	if (pipe(pipe_fds) != 0)
+	{
+		pthread_mutex_unlock(&spawn_lock);
+		return -1;
+	}
+
+	/* otherwise other commands hold the write end open, and EOF never comes */
+	fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+
+	pid = fork();
+
+	if (pid == 0)
+	{
+		int			null_fd = open("/dev/null", O_RDONLY);
+
+		if (null_fd >= 0)
+			dup2(null_fd, STDIN_FILENO);
+		dup2(pipe_fds[1], STDOUT_FILENO);
+
+		execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+		_exit(127);
+	}
+
+	pthread_mutex_unlock(&spawn_lock);
+
+	close(pipe_fds[1]);
+
+	if (pid < 0)
+	{
+		close(pipe_fds[0]);
+		return -1;
+	}
+
+	*fd = pipe_fds[0];
+
+	return pid;
+}
+
+
+/*
+ * Append "str" as a single word for the shell.
+ */
+void
+AppendShellQuoted(PQExpBuffer buf, const char *str)
+{
+	const char *p;
+
+	appendPQExpBufferChar(buf, '\'');
+
+	for (p = str; *p != '\0'; p++)
+	{
+		if (*p == '\'')
+			appendPQExpBufferStr(buf, "'\\''");
+		else
+			appendPQExpBufferChar(buf, *p);
+	}
+
+	appendPQExpBufferChar(buf, '\'');
+}
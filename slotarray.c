@@ -0,0 +1,446 @@
+/*
+ * slotarray.c
+ *
+ * Storage, filtering and sorting for parsed slots.
+ *
+ * Slots are kept in a single contiguous, growable array of fixed-size
+ * ReplslotInfo entries.  Error messages, which only failed slots have,
+ * are kept out of the entries themselves and stored in a shared string
+ * pool, a chain of large blocks which are carved up as needed and only
+ * released all at once.
+ *
+ * Slots are looked up by name, e.g. to join them with another set of
+ * slots, through a NameHash, an open-addressing hash table mapping names
+ * to integer values (typically array indexes).
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pg_replslot_reader.h"
+
+#define STRING_POOL_BLOCK_SIZE 8192
+
+typedef struct StringPoolBlock
+{
+	struct StringPoolBlock *next;
+	size_t		used;
+	size_t		size;
+	char		data[FLEXIBLE_ARRAY_MEMBER];
+} StringPoolBlock;
+
+struct StringPool
+{
+	pthread_mutex_t lock;
+	StringPoolBlock *blocks;
+};
+
+typedef struct NameHashEntry
+{
+	const char *key;			/* NULL if unused */
+	int			value;
+} NameHashEntry;
+
+struct NameHash
+{
+	NameHashEntry *entries;
+	uint32		size;			/* always a power of 2 */
+	uint32		used;
+};
+
+static int	ReplslotCmp(const void *a, const void *b, void *arg);
+static uint32 NameHashString(const char *key);
+static NameHashEntry *NameHashFind(const NameHash *hash, const char *key);
+
+
+void
+ReplslotArrayInit(ReplslotArray *array, int size_hint)
+{
+	array->slot_cnt = 0;
+	array->slot_size = Max(size_hint, 16);
+	array->slots = pg_malloc(array->slot_size * sizeof(ReplslotInfo));
+}
+
+
+/*
+ * Append "cnt" zeroed entries to the array, returning the first of them.
+ *
+ * The array may be moved, so pointers into it do not survive this call.
+ */
+ReplslotInfo *
+ReplslotArrayExtend(ReplslotArray *array, int cnt)
+{
+	ReplslotInfo *slots;
+
+	if (array->slot_cnt + cnt > array->slot_size)
+	{
+		while (array->slot_cnt + cnt > array->slot_size)
+			array->slot_size *= 2;
+
+		array->slots = pg_realloc(array->slots,
+								  array->slot_size * sizeof(ReplslotInfo));
+	}
+
+	slots = &array->slots[array->slot_cnt];
+	memset(slots, 0, cnt * sizeof(ReplslotInfo));
+	array->slot_cnt += cnt;
+
+	return slots;
+}
+
+
+void
+ReplslotArrayReset(ReplslotArray *array)
+{
+	array->slot_cnt = 0;
+}
+
+
+void
+ReplslotArrayFree(ReplslotArray *array)
+{
+	pg_free(array->slots);
+	array->slots = NULL;
+	array->slot_cnt = 0;
+	array->slot_size = 0;
+}
+
+
+/*
+ * Remove the slots which don't match "filter", keeping the rest in order.
+ */
+void
+ReplslotArrayFilter(ReplslotArray *array, const ReplslotFilter *filter)
+{
+	int			i;
+	int			kept = 0;
+
+	if (!ReplslotFilterIsSet(filter))
+		return;
+
+	for (i = 0; i < array->slot_cnt; i++)
+	{
+		if (!ReplslotMatchesFilter(&array->slots[i], filter))
+			continue;
+
+		if (kept != i)
+			array->slots[kept] = array->slots[i];
+		kept++;
+	}
+
+	array->slot_cnt = kept;
+}
+
+
+void
+ReplslotArraySort(ReplslotArray *array, ReplslotSortKey sort_key)
+{
+	qsort_arg(array->slots, array->slot_cnt, sizeof(ReplslotInfo),
+			  ReplslotCmp, &sort_key);
+}
+
+
+bool
+ReplslotFilterIsSet(const ReplslotFilter *filter)
+{
+	return filter->type >= 0 || filter->db_oid != InvalidOid ||
+		filter->plugin != NULL;
+}
+
+
+/*
+ * Slots which couldn't be parsed always match, as what they would have
+ * been filtered on is unknown.  Filtering on database or plugin implies
+ * logical slots only.
+ */
+bool
+ReplslotMatchesFilter(const ReplslotInfo *replslot_info, const ReplslotFilter *filter)
+{
+	if (replslot_info->slotfile_parsed == false)
+		return true;
+
+	if (filter->type >= 0 && replslot_info->type != (ReplicationSlotType) filter->type)
+		return false;
+
+	if (filter->db_oid != InvalidOid &&
+		(replslot_info->type != RS_LOGICAL || replslot_info->db_oid != filter->db_oid))
+		return false;
+
+	if (filter->plugin != NULL &&
+		(replslot_info->type != RS_LOGICAL || strcmp(replslot_info->plugin, filter->plugin) != 0))
+		return false;
+
+	return true;
+}
+
+
+/*
+ * Parse the argument to --sort; returns false if not recognized.
+ */
+bool
+ParseSortKey(const char *name, ReplslotSortKey *sort_key)
+{
+	if (strcmp(name, "name") == 0)
+		*sort_key = SORT_NAME;
+	else if (strcmp(name, "restart_lsn") == 0)
+		*sort_key = SORT_RESTART_LSN;
+	else if (strcmp(name, "catalog_xmin") == 0)
+		*sort_key = SORT_CATALOG_XMIN;
+	else if (strcmp(name, "type") == 0)
+		*sort_key = SORT_TYPE;
+	else if (strcmp(name, "spill_bytes") == 0)
+		*sort_key = SORT_SPILL_BYTES;
+	else
+		return false;
+
+	return true;
+}
+
+
+/*
+ * Slots without a value for the sort key (including unparseable ones)
+ * sort after those with one; ties are broken by name so the order is
+ * always the same.
+ */
+static int
+ReplslotCmp(const void *a, const void *b, void *arg)
+{
+	const ReplslotInfo *sa = (const ReplslotInfo *) a;
+	const ReplslotInfo *sb = (const ReplslotInfo *) b;
+	ReplslotSortKey sort_key = *(ReplslotSortKey *) arg;
+
+	if (sort_key != SORT_NAME && sa->slotfile_parsed != sb->slotfile_parsed)
+		return sa->slotfile_parsed ? -1 : 1;
+
+	if (sa->slotfile_parsed && sb->slotfile_parsed)
+	{
+		switch (sort_key)
+		{
+			case SORT_NONE:
+			case SORT_NAME:
+				break;
+			case SORT_RESTART_LSN:
+				if (XLogRecPtrIsInvalid(sa->restart_lsn) != XLogRecPtrIsInvalid(sb->restart_lsn))
+					return XLogRecPtrIsInvalid(sa->restart_lsn) ? 1 : -1;
+				if (sa->restart_lsn != sb->restart_lsn)
+					return sa->restart_lsn < sb->restart_lsn ? -1 : 1;
+				break;
+			case SORT_CATALOG_XMIN:
+				if (TransactionIdIsValid(sa->catalog_xmin) != TransactionIdIsValid(sb->catalog_xmin))
+					return TransactionIdIsValid(sa->catalog_xmin) ? -1 : 1;
+				/*
+				 * Modulo 2^32, as TransactionIdPrecedes() does, so the oldest
+				 * still comes first after wraparound; the catalog_xmins of
+				 * one cluster are never 2^31 apart, so the order is total.
+				 */
+				if (sa->catalog_xmin != sb->catalog_xmin)
+					return (int32) (sa->catalog_xmin - sb->catalog_xmin) < 0 ? -1 : 1;
+				break;
+			case SORT_TYPE:
+				if (sa->type != sb->type)
+					return sa->type == RS_PHYSICAL ? -1 : 1;
+				break;
+			case SORT_SPILL_BYTES:
+				/* largest first, as the point is to find what fills the disk */
+				if (sa->spill_bytes != sb->spill_bytes)
+					return sa->spill_bytes > sb->spill_bytes ? -1 : 1;
+				break;
+		}
+	}
+
+	return strcmp(sa->name, sb->name);
+}
+
+
+StringPool *
+StringPoolCreate(void)
+{
+	StringPool *pool = pg_malloc0(sizeof(StringPool));
+
+	pthread_mutex_init(&pool->lock, NULL);
+
+	return pool;
+}
+
+
+/*
+ * Copy a string into the pool.  May be called from several threads at
+ * once.
+ */
+const char *
+StringPoolAdd(StringPool *pool, const char *str)
+{
+	size_t		len = strlen(str) + 1;
+	StringPoolBlock *block;
+	char	   *copy;
+
+	pthread_mutex_lock(&pool->lock);
+
+	block = pool->blocks;
+
+	if (block == NULL || block->size - block->used < len)
+	{
+		size_t		size = Max(len, STRING_POOL_BLOCK_SIZE);
+
+		block = pg_malloc(offsetof(StringPoolBlock, data) + size);
+		block->next = pool->blocks;
+		block->used = 0;
+		block->size = size;
+		pool->blocks = block;
+	}
+
+	copy = block->data + block->used;
+	memcpy(copy, str, len);
+	block->used += len;
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return copy;
+}
+
+
+/*
+ * Release every string in the pool, keeping one block for reuse.
+ */
+void
+StringPoolReset(StringPool *pool)
+{
+	StringPoolBlock *block;
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (pool->blocks != NULL)
+	{
+		block = pool->blocks->next;
+
+		while (block != NULL)
+		{
+			StringPoolBlock *next = block->next;
+
+			pg_free(block);
+			block = next;
+		}
+
+		pool->blocks->next = NULL;
+		pool->blocks->used = 0;
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+/*
+ * Create a hash table sized for "size_hint" names.  Names are not copied,
+ * so must outlive the table.
+ */
+NameHash *
+NameHashCreate(int size_hint)
+{
+	NameHash   *hash = pg_malloc(sizeof(NameHash));
+
+	hash->size = 16;
+	while (hash->size < (uint32) size_hint * 2)
+		hash->size *= 2;
+
+	hash->used = 0;
+	hash->entries = pg_malloc0(hash->size * sizeof(NameHashEntry));
+
+	return hash;
+}
+
+
+/*
+ * Map "key" to "value", replacing any value it already had.
+ */
+void
+NameHashInsert(NameHash *hash, const char *key, int value)
+{
+	NameHashEntry *entry;
+
+	/* keep the table at most half full */
+	if ((hash->used + 1) * 2 > hash->size)
+	{
+		NameHashEntry *old_entries = hash->entries;
+		uint32		old_size = hash->size;
+		uint32		i;
+
+		hash->size *= 2;
+		hash->entries = pg_malloc0(hash->size * sizeof(NameHashEntry));
+
+		for (i = 0; i < old_size; i++)
+		{
+			if (old_entries[i].key != NULL)
+				*NameHashFind(hash, old_entries[i].key) = old_entries[i];
+		}
+
+		pg_free(old_entries);
+	}
+
+	entry = NameHashFind(hash, key);
+
+	if (entry->key == NULL)
+	{
+		entry->key = key;
+		hash->used++;
+	}
+
+	entry->value = value;
+}
+
+
+/*
+ * Returns the value "key" is mapped to, or -1 if it isn't in the table.
+ */
+int
+NameHashLookup(const NameHash *hash, const char *key)
+{
+	const NameHashEntry *entry = NameHashFind(hash, key);
+
+	return entry->key != NULL ? entry->value : -1;
+}
+
+
+void
+NameHashFree(NameHash *hash)
+{
+	pg_free(hash->entries);
+	pg_free(hash);
+}
+
+
+/*
+ * FNV-1a.
+ */
+static uint32
+NameHashString(const char *key)
+{
+	uint32		h = 2166136261u;
+
+	for (; *key != '\0'; key++)
+	{
+		h ^= (unsigned char) *key;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+
+/*
+ * Find the entry for "key", or the unused entry where it would go.
+ */
+static NameHashEntry *
+NameHashFind(const NameHash *hash, const char *key)
+{
+	uint32		mask = hash->size - 1;
+	uint32		i = NameHashString(key) & mask;
+
+	while (hash->entries[i].key != NULL &&
+		   strcmp(hash->entries[i].key, key) != 0)
+		i = (i + 1) & mask;
+
+	return &hash->entries[i];
+}
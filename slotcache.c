@@ -0,0 +1,454 @@
+/*
+ * slotcache.c
+ *
+ * Persistent cache of parsed slot state files, used with --cache.
+ *
+ * PostgreSQL rewrites a slot's state file by writing a temporary file
+ * and renaming it into place, so a state file whose inode, size and
+ * modification time are unchanged since the last run still has the same
+ * contents, and the slot parsed from it last time can be reused without
+ * reading the file.  Only slots which were parsed successfully are
+ * cached; anything wrong with a state file is reported afresh each run.
+ *
+ * The cache file holds a header followed by one record per slot, each
+ * followed by the path of its state file.  It is replaced atomically on
+ * each run and protected by a CRC-32C, so a damaged or foreign file is
+ * simply treated as an empty cache.
+ *
+ * Without a file name, the cache is kept in memory only, which lets
+ * --daemon re-read only the slots which changed since its last scan.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pg_replslot_reader.h"
+
+#define SLOT_CACHE_MAGIC	0x52524331	/* "RRC1" */
+#define SLOT_CACHE_VERSION	3
+
+typedef struct SlotCacheHeader
+{
+	uint32		magic;
+	uint32		version;
+	pg_crc32c	checksum;		/* of everything after the header */
+	uint32		entry_cnt;
+} SlotCacheHeader;
+
+/*
+ * What is stored for each slot; followed in the file by "path_len" bytes
+ * of path, without a terminator.
+ */
+typedef struct SlotCacheRecord
+{
+	/* identity of the state file the slot was parsed from */
+	uint64		ino;
+	uint64		dev;
+	int64		size;
+	int64		mtime_sec;
+	int64		mtime_nsec;
+
+	uint32		path_len;
+	uint32		type;
+	uint32		version;
+	uint32		length;
+	uint32		db_oid;
+	uint32		persistency;
+	TransactionId xmin;
+	TransactionId catalog_xmin;
+	XLogRecPtr	restart_lsn;
+	uint32		invalidated;
+	XLogRecPtr	invalidated_at;
+	XLogRecPtr	confirmed_flush;
+	XLogRecPtr	two_phase_at;
+	bool		two_phase;
+	bool		synced;
+	bool		failover;
+	char		name[NAMEDATALEN];
+	char		plugin[NAMEDATALEN];
+} SlotCacheRecord;
+
+typedef struct SlotCacheEntry
+{
+	char	   *path;
+	SlotCacheRecord record;
+} SlotCacheEntry;
+
+struct SlotCache
+{
+	char	   *filename;
+
+	/* entries loaded from the cache file, sorted by path */
+	SlotCacheEntry *loaded;
+	int			loaded_cnt;
+
+	/* entries for the cache file to be written at the end of the run */
+	pthread_mutex_t lock;
+	SlotCacheEntry *stored;
+	int			stored_cnt;
+	int			stored_size;
+
+	int			hits;
+	int			misses;
+};
+
+static void SlotCacheRead(SlotCache *cache);
+static void SlotCacheRotate(SlotCache *cache);
+static void SetCacheRecordKey(SlotCacheRecord *record, const struct stat *statbuf);
+static int	SlotCacheEntryCmp(const void *a, const void *b);
+
+
+/*
+ * Load the cache file "filename"; a cache file which doesn't exist yet,
+ * or can't be used, results in an empty cache.  If "filename" is NULL,
+ * the cache starts empty and is never written out.
+ */
+SlotCache *
+SlotCacheLoad(const char *filename)
+{
+	SlotCache  *cache = pg_malloc0(sizeof(SlotCache));
+
+	pthread_mutex_init(&cache->lock, NULL);
+
+	if (filename != NULL)
+	{
+		cache->filename = pg_strdup(filename);
+		SlotCacheRead(cache);
+	}
+
+	qsort(cache->loaded, cache->loaded_cnt, sizeof(SlotCacheEntry),
+		  SlotCacheEntryCmp);
+
+	return cache;
+}
+
+
+static void
+SlotCacheRead(SlotCache *cache)
+{
+	SlotCacheHeader header;
+	char	   *data;
+	char	   *ptr;
+	size_t		data_len;
+	pg_crc32c	checksum;
+	struct stat statbuf;
+	FILE	   *fd;
+	int			i;
+
+	fd = fopen(cache->filename, "rb");
+	if (fd == NULL)
+		return;
+
+	if (fstat(fileno(fd), &statbuf) != 0 ||
+		(size_t) statbuf.st_size < sizeof(SlotCacheHeader) ||
+		fread(&header, sizeof(SlotCacheHeader), 1, fd) != 1 ||
+		header.magic != SLOT_CACHE_MAGIC ||
+		header.version != SLOT_CACHE_VERSION)
+	{
+		fclose(fd);
+		return;
+	}
+
+	data_len = statbuf.st_size - sizeof(SlotCacheHeader);
+	data = pg_malloc(Max(data_len, 1));
+
+	if (fread(data, 1, data_len, fd) != data_len)
+	{
+		fclose(fd);
+		pg_free(data);
+		return;
+	}
+
+	fclose(fd);
+
+	INIT_CRC32C(checksum);
+	COMP_CRC32C(checksum, data, data_len);
+	FIN_CRC32C(checksum);
+
+	if (!EQ_CRC32C(checksum, header.checksum))
+	{
+		pg_free(data);
+		return;
+	}
+
+	cache->loaded = pg_malloc(Max(header.entry_cnt, 1) * sizeof(SlotCacheEntry));
+
+	for (ptr = data, i = 0; i < header.entry_cnt; i++)
+	{
+		SlotCacheEntry *entry = &cache->loaded[i];
+
+		if ((size_t) (data + data_len - ptr) < sizeof(SlotCacheRecord))
+			break;
+
+		/* records aren't aligned within the file */
+		memcpy(&entry->record, ptr, sizeof(SlotCacheRecord));
+		ptr += sizeof(SlotCacheRecord);
+
+		if ((size_t) (data + data_len - ptr) < entry->record.path_len)
+			break;
+
+		entry->path = pg_malloc(entry->record.path_len + 1);
+		memcpy(entry->path, ptr, entry->record.path_len);
+		entry->path[entry->record.path_len] = '\0';
+		ptr += entry->record.path_len;
+
+		cache->loaded_cnt++;
+	}
+
+	pg_free(data);
+}
+
+
+/*
+ * If the cache has a slot parsed from the state file at "path", and the
+ * file is the same one it was parsed from, fill in "replslot_info" from
+ * it and return true.  May be called from several threads at once.
+ */
+bool
+SlotCacheLookup(SlotCache *cache, const char *path, const struct stat *statbuf,
+				ReplslotInfo *replslot_info)
+{
+	SlotCacheEntry key;
+	SlotCacheEntry *entry;
+	SlotCacheRecord current;
+	bool		found;
+
+	key.path = (char *) path;
+	entry = bsearch(&key, cache->loaded, cache->loaded_cnt,
+					sizeof(SlotCacheEntry), SlotCacheEntryCmp);
+
+	SetCacheRecordKey(&current, statbuf);
+
+	found = entry != NULL &&
+		entry->record.ino == current.ino &&
+		entry->record.dev == current.dev &&
+		entry->record.size == current.size &&
+		entry->record.mtime_sec == current.mtime_sec &&
+		entry->record.mtime_nsec == current.mtime_nsec;
+
+	pthread_mutex_lock(&cache->lock);
+	if (found)
+		cache->hits++;
+	else
+		cache->misses++;
+	pthread_mutex_unlock(&cache->lock);
+
+	if (!found)
+		return false;
+
+	strlcpy(replslot_info->name, entry->record.name, NAMEDATALEN);
+	replslot_info->type = (ReplicationSlotType) entry->record.type;
+	replslot_info->version = entry->record.version;
+	replslot_info->length = entry->record.length;
+	replslot_info->db_oid = entry->record.db_oid;
+	replslot_info->persistency = (ReplicationSlotPersistency) entry->record.persistency;
+	replslot_info->xmin = entry->record.xmin;
+	replslot_info->catalog_xmin = entry->record.catalog_xmin;
+	replslot_info->restart_lsn = entry->record.restart_lsn;
+	replslot_info->invalidated = entry->record.invalidated;
+	replslot_info->invalidated_at = entry->record.invalidated_at;
+	replslot_info->confirmed_flush = entry->record.confirmed_flush;
+	replslot_info->two_phase_at = entry->record.two_phase_at;
+	replslot_info->two_phase = entry->record.two_phase;
+	replslot_info->synced = entry->record.synced;
+	replslot_info->failover = entry->record.failover;
+	strlcpy(replslot_info->plugin, entry->record.plugin, NAMEDATALEN);
+
+	return true;
+}
+
+
+/*
+ * Record a successfully parsed slot, and the identity of the state file
+ * it was parsed from, for the cache file to be written.  May be called
+ * from several threads at once.
+ */
+void
+SlotCacheStore(SlotCache *cache, const char *path, const struct stat *statbuf,
+			   const ReplslotInfo *replslot_info)
+{
+	SlotCacheEntry entry;
+
+	memset(&entry.record, 0, sizeof(SlotCacheRecord));
+	SetCacheRecordKey(&entry.record, statbuf);
+
+	entry.record.path_len = strlen(path);
+	entry.record.type = replslot_info->type;
+	entry.record.version = replslot_info->version;
+	entry.record.length = replslot_info->length;
+	entry.record.db_oid = replslot_info->db_oid;
+	entry.record.persistency = replslot_info->persistency;
+	entry.record.xmin = replslot_info->xmin;
+	entry.record.catalog_xmin = replslot_info->catalog_xmin;
+	entry.record.restart_lsn = replslot_info->restart_lsn;
+	entry.record.invalidated = replslot_info->invalidated;
+	entry.record.invalidated_at = replslot_info->invalidated_at;
+	entry.record.confirmed_flush = replslot_info->confirmed_flush;
+	entry.record.two_phase_at = replslot_info->two_phase_at;
+	entry.record.two_phase = replslot_info->two_phase;
+	entry.record.synced = replslot_info->synced;
+	entry.record.failover = replslot_info->failover;
+	strlcpy(entry.record.name, replslot_info->name, NAMEDATALEN);
+	strlcpy(entry.record.plugin, replslot_info->plugin, NAMEDATALEN);
+
+	entry.path = pg_strdup(path);
+
+	pthread_mutex_lock(&cache->lock);
+
+	if (cache->stored_cnt == cache->stored_size)
+	{
+		cache->stored_size = Max(cache->stored_size * 2, 64);
+		cache->stored = pg_realloc(cache->stored,
+								   cache->stored_size * sizeof(SlotCacheEntry));
+	}
+
+	cache->stored[cache->stored_cnt++] = entry;
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*
+ * Replace the cache file with the slots stored during this run.  The
+ * stored slots then become the ones looked up, so a long-running process
+ * can go on using the cache for later scans.
+ */
+void
+SlotCacheWrite(SlotCache *cache)
+{
+	SlotCacheHeader header;
+	char		tmp_filename[MAXPGPATH];
+	FILE	   *fd;
+	int			i;
+
+	if (cache->filename == NULL)
+	{
+		SlotCacheRotate(cache);
+		return;
+	}
+
+	snprintf(tmp_filename, MAXPGPATH, "%s.tmp", cache->filename);
+
+	fd = fopen(tmp_filename, "wb");
+	if (fd == NULL)
+	{
+		fprintf(stderr, "Unable to create cache file \"%s\": %s\n",
+				tmp_filename, strerror(errno));
+		SlotCacheRotate(cache);
+		return;
+	}
+
+	header.magic = SLOT_CACHE_MAGIC;
+	header.version = SLOT_CACHE_VERSION;
+	header.entry_cnt = cache->stored_cnt;
+
+	INIT_CRC32C(header.checksum);
+	for (i = 0; i < cache->stored_cnt; i++)
+	{
+		COMP_CRC32C(header.checksum, &cache->stored[i].record, sizeof(SlotCacheRecord));
+		COMP_CRC32C(header.checksum, cache->stored[i].path,
+					cache->stored[i].record.path_len);
+	}
+	FIN_CRC32C(header.checksum);
+
+	fwrite(&header, sizeof(SlotCacheHeader), 1, fd);
+
+	for (i = 0; i < cache->stored_cnt; i++)
+	{
+		fwrite(&cache->stored[i].record, sizeof(SlotCacheRecord), 1, fd);
+		fwrite(cache->stored[i].path, 1, cache->stored[i].record.path_len, fd);
+	}
+
+	if (ferror(fd) || fclose(fd) != 0)
+	{
+		fprintf(stderr, "Unable to write cache file \"%s\": %s\n",
+				tmp_filename, strerror(errno));
+		unlink(tmp_filename);
+	}
+	else if (rename(tmp_filename, cache->filename) != 0)
+	{
+		fprintf(stderr, "Unable to rename cache file \"%s\" to \"%s\": %s\n",
+				tmp_filename, cache->filename, strerror(errno));
+		unlink(tmp_filename);
+	}
+
+	SlotCacheRotate(cache);
+}
+
+
+/*
+ * Make the stored slots the ones looked up from now on.
+ */
+static void
+SlotCacheRotate(SlotCache *cache)
+{
+	int			i;
+
+	for (i = 0; i < cache->loaded_cnt; i++)
+		pg_free(cache->loaded[i].path);
+	pg_free(cache->loaded);
+
+	cache->loaded = cache->stored;
+	cache->loaded_cnt = cache->stored_cnt;
+
+	qsort(cache->loaded, cache->loaded_cnt, sizeof(SlotCacheEntry),
+		  SlotCacheEntryCmp);
+
+	cache->stored = NULL;
+	cache->stored_cnt = 0;
+	cache->stored_size = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+}
+
+
+void
+SlotCacheFree(SlotCache *cache)
+{
+	int			i;
+
+	for (i = 0; i < cache->loaded_cnt; i++)
+		pg_free(cache->loaded[i].path);
+	for (i = 0; i < cache->stored_cnt; i++)
+		pg_free(cache->stored[i].path);
+
+	pg_free(cache->loaded);
+	pg_free(cache->stored);
+	pthread_mutex_destroy(&cache->lock);
+	if (cache->filename != NULL)
+		pg_free(cache->filename);
+	pg_free(cache);
+}
+
+
+void
+SlotCacheGetStats(const SlotCache *cache, int *hits, int *misses)
+{
+	*hits = cache->hits;
+	*misses = cache->misses;
+}
+
+
+static void
+SetCacheRecordKey(SlotCacheRecord *record, const struct stat *statbuf)
+{
+	record->ino = (uint64) statbuf->st_ino;
+	record->dev = (uint64) statbuf->st_dev;
+	record->size = (int64) statbuf->st_size;
+	record->mtime_sec = (int64) statbuf->st_mtim.tv_sec;
+	record->mtime_nsec = (int64) statbuf->st_mtim.tv_nsec;
+}
+
+
+static int
+SlotCacheEntryCmp(const void *a, const void *b)
+{
+	return strcmp(((const SlotCacheEntry *) a)->path,
+				  ((const SlotCacheEntry *) b)->path);
+}
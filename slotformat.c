@@ -0,0 +1,359 @@
+/*
+ * slotformat.c
+ *
+ * Validation of slot state files, and decoding of their version
+ * dependent part.
+ *
+ * Each state file format PostgreSQL has written is described by an entry
+ * in "replslot_formats", giving the offset of each field in the slot data
+ * as laid out by the compiler for that format's struct.  A state file is
+ * decoded with the entry for its version and length, which must also be
+ * a format written by the data directory's PostgreSQL release; the fields
+ * are then extracted straight from the buffer the file was read into.
+ *
+ * Nothing here does any I/O: the state file has already been read into
+ * a buffer, however it was read, which is also what lets fuzz_slotstate.c
+ * exercise it with arbitrary input.
+ *
+ * Supporting a new format means copying its ReplicationSlotPersistentData
+ * into pg_replslot_reader.h and adding an entry here.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pg_replslot_reader.h"
+
+#define V2_FIELD(field)		offsetof(ReplicationSlotPersistentData, field)
+#define V13_FIELD(field)	offsetof(ReplicationSlotPersistentData13, field)
+#define V3_FIELD(field)		offsetof(ReplicationSlotPersistentDataV3, field)
+#define V16_FIELD(field)	offsetof(ReplicationSlotPersistentData16, field)
+#define V5_FIELD(field)		offsetof(ReplicationSlotPersistentDataV5, field)
+
+/*
+ * PostgreSQL 14 to 15 and 16 write version 3 state files of the same
+ * length, so these are told apart only by the data directory's release.
+ */
+static const ReplslotFormat replslot_formats[] = {
+	/* PostgreSQL 9.4 to 12 */
+	{2, sizeof(ReplicationSlotPersistentData), 90400, 120000,
+		V2_FIELD(name), V2_FIELD(database), V2_FIELD(persistency),
+		V2_FIELD(xmin), V2_FIELD(catalog_xmin), V2_FIELD(restart_lsn), -1, -1,
+		V2_FIELD(confirmed_flush), -1, -1, V2_FIELD(plugin), -1, -1},
+
+	/* PostgreSQL 13 */
+	{2, sizeof(ReplicationSlotPersistentData13), 130000, 130000,
+		V13_FIELD(name), V13_FIELD(database), V13_FIELD(persistency),
+		V13_FIELD(xmin), V13_FIELD(catalog_xmin), V13_FIELD(restart_lsn),
+		V13_FIELD(invalidated_at), -1, V13_FIELD(confirmed_flush), -1, -1,
+		V13_FIELD(plugin), -1, -1},
+
+	/* PostgreSQL 14 and 15 */
+	{3, sizeof(ReplicationSlotPersistentDataV3), 140000, 150000,
+		V3_FIELD(name), V3_FIELD(database), V3_FIELD(persistency),
+		V3_FIELD(xmin), V3_FIELD(catalog_xmin), V3_FIELD(restart_lsn),
+		V3_FIELD(invalidated_at), -1, V3_FIELD(confirmed_flush),
+		V3_FIELD(two_phase_at), V3_FIELD(two_phase), V3_FIELD(plugin), -1, -1},
+
+	/* PostgreSQL 16 */
+	{3, sizeof(ReplicationSlotPersistentData16), 160000, 160000,
+		V16_FIELD(name), V16_FIELD(database), V16_FIELD(persistency),
+		V16_FIELD(xmin), V16_FIELD(catalog_xmin), V16_FIELD(restart_lsn),
+		-1, V16_FIELD(invalidated), V16_FIELD(confirmed_flush),
+		V16_FIELD(two_phase_at), V16_FIELD(two_phase), V16_FIELD(plugin), -1, -1},
+
+	/* PostgreSQL 17 onwards */
+	{5, sizeof(ReplicationSlotPersistentDataV5), 170000, 0,
+		V5_FIELD(name), V5_FIELD(database), V5_FIELD(persistency),
+		V5_FIELD(xmin), V5_FIELD(catalog_xmin), V5_FIELD(restart_lsn),
+		-1, V5_FIELD(invalidated), V5_FIELD(confirmed_flush),
+		V5_FIELD(two_phase_at), V5_FIELD(two_phase), V5_FIELD(plugin),
+		V5_FIELD(synced), V5_FIELD(failover)},
+};
+
+#define NUM_REPLSLOT_FORMATS lengthof(replslot_formats)
+
+static void CopyName(char *dest, const char *src);
+
+
+/*
+ * Find the format of a state file with the given version and length, as
+ * written by the PostgreSQL release "pg_version_num"; NULL if none.
+ */
+const ReplslotFormat *
+LookupReplslotFormat(uint32 version, uint32 length, int pg_version_num)
+{
+	int			i;
+
+	for (i = 0; i < NUM_REPLSLOT_FORMATS; i++)
+	{
+		const ReplslotFormat *format = &replslot_formats[i];
+
+		if (format->version == version && format->length == length &&
+			pg_version_num >= format->min_version_num &&
+			(format->max_version_num == 0 || pg_version_num <= format->max_version_num))
+			return format;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * The format the PostgreSQL release "pg_version_num" writes, if known.
+ */
+const ReplslotFormat *
+ReplslotFormatForPgVersion(int pg_version_num)
+{
+	int			i;
+
+	for (i = 0; i < NUM_REPLSLOT_FORMATS; i++)
+	{
+		const ReplslotFormat *format = &replslot_formats[i];
+
+		if (pg_version_num >= format->min_version_num &&
+			(format->max_version_num == 0 || pg_version_num <= format->max_version_num))
+			return format;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Whether any PostgreSQL release writes state files with this version and
+ * length.
+ */
+bool
+ReplslotFormatExists(uint32 version, uint32 length)
+{
+	int			i;
+
+	for (i = 0; i < NUM_REPLSLOT_FORMATS; i++)
+	{
+		if (replslot_formats[i].version == version &&
+			replslot_formats[i].length == length)
+			return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Run the checks RestoreSlotFromDisk() makes on the raw contents of a
+ * state file, including verifying its checksum, and return the format
+ * to decode it with; on failure, the reason is written to "error", of
+ * MAXLEN bytes, and NULL returned.
+ */
+const ReplslotFormat *
+ValidateReplSlotState(const ReplslotStateBuf *buf, ssize_t readBytes,
+					  const char *path, int pg_version_num, char *error)
+{
+	const ReplicationSlotOnDisk *cp = &buf->cp;
+	const ReplslotFormat *format;
+	pg_crc32c	checksum;
+
+	/* check the part of statefile that's guaranteed to be version independent */
+	if ((size_t) readBytes < ReplicationSlotOnDiskConstantSize)
+	{
+		snprintf(error, MAXLEN,
+			"could not read file \"%s\", read %d of %u",
+			path, (int) readBytes,
+			(uint32) ReplicationSlotOnDiskConstantSize);
+		return NULL;
+	}
+
+	/* verify magic */
+	if (cp->magic != SLOT_MAGIC)
+	{
+		snprintf(error, MAXLEN,
+			"replication slot file \"%s\" has wrong magic number: %u instead of %u",
+			path, cp->magic, SLOT_MAGIC);
+		return NULL;
+	}
+
+	/* verify version */
+	if (cp->version < MIN_SLOT_VERSION || cp->version > MAX_SLOT_VERSION)
+	{
+		snprintf(error, MAXLEN,
+			"replication slot file \"%s\" has unsupported version %u",
+			path, cp->version);
+		return NULL;
+	}
+
+	/* boundary check on length */
+	if (!ReplslotFormatExists(cp->version, cp->length))
+	{
+		snprintf(error, MAXLEN,
+			"replication slot file \"%s\" has corrupted length %u",
+			path, cp->length);
+		return NULL;
+	}
+
+	/* the format must also be the one the data directory's release writes */
+	format = LookupReplslotFormat(cp->version, cp->length, pg_version_num);
+	if (format == NULL)
+	{
+		char		pg_version[16];
+
+		if (pg_version_num >= 100000)
+			snprintf(pg_version, sizeof(pg_version), "%i", pg_version_num / 10000);
+		else
+			snprintf(pg_version, sizeof(pg_version), "%i.%i",
+					 pg_version_num / 10000, pg_version_num / 100 % 100);
+
+		snprintf(error, MAXLEN,
+			"replication slot file \"%s\" has version %u, which PostgreSQL %s does not write",
+			path, cp->version, pg_version);
+		return NULL;
+	}
+
+	/* verify the version-dependent part was read in full */
+	if ((size_t) readBytes != ReplicationSlotOnDiskConstantSize + cp->length)
+	{
+		snprintf(error, MAXLEN,
+			"could not read file \"%s\", read %d of %u",
+			path, (int) (readBytes - ReplicationSlotOnDiskConstantSize),
+			cp->length);
+		return NULL;
+	}
+
+	/*
+	 * PostgreSQL 9.4 checksummed slot files with the older CRC-32
+	 * algorithm rather than CRC-32C, so their checksums are not verified.
+	 */
+	if (pg_version_num < 90500)
+		return format;
+
+	/*
+	 * now verify the CRC; COMP_CRC32C() uses the SSE 4.2 or ARMv8 CRC
+	 * instructions where the CPU has them
+	 */
+	INIT_CRC32C(checksum);
+	COMP_CRC32C(checksum,
+				(const char *) cp + SnapBuildOnDiskNotChecksummedSize,
+				ReplicationSlotOnDiskConstantSize - SnapBuildOnDiskNotChecksummedSize +
+				cp->length);
+	FIN_CRC32C(checksum);
+
+	if (!EQ_CRC32C(checksum, cp->checksum))
+	{
+		snprintf(error, MAXLEN,
+			"checksum mismatch for replication slot file \"%s\": is %u, should be %u",
+			path, checksum, cp->checksum);
+		return NULL;
+	}
+
+	return format;
+}
+
+
+/*
+ * Set the parsed fields of "replslot_info" from the slot data of a state
+ * file in "format", which has already been validated.  The data need not
+ * be aligned.
+ */
+void
+DecodeReplslotState(const ReplslotFormat *format, const char *slotdata,
+					ReplslotInfo *replslot_info)
+{
+	Oid			database;
+
+	CopyName(replslot_info->name, slotdata + format->name);
+
+	memcpy(&database, slotdata + format->database, sizeof(Oid));
+
+	if (database == InvalidOid)
+	{
+		replslot_info->type = RS_PHYSICAL;
+	}
+	else
+	{
+		replslot_info->type = RS_LOGICAL;
+		replslot_info->db_oid = (uint32) database;
+	}
+
+	memcpy(&replslot_info->persistency, slotdata + format->persistency,
+		   sizeof(ReplicationSlotPersistency));
+	memcpy(&replslot_info->xmin, slotdata + format->xmin, sizeof(TransactionId));
+	memcpy(&replslot_info->catalog_xmin, slotdata + format->catalog_xmin,
+		   sizeof(TransactionId));
+	memcpy(&replslot_info->restart_lsn, slotdata + format->restart_lsn,
+		   sizeof(XLogRecPtr));
+	memcpy(&replslot_info->confirmed_flush, slotdata + format->confirmed_flush,
+		   sizeof(XLogRecPtr));
+
+	/*
+	 * Before PostgreSQL 16, the only cause was WAL removal, upon which
+	 * restart_lsn is moved to invalidated_at; see ReplicationSlotIsInvalid()
+	 * in those releases.
+	 */
+	replslot_info->invalidated = RS_INVAL_NONE;
+	replslot_info->invalidated_at = InvalidXLogRecPtr;
+	if (format->invalidated_at >= 0)
+	{
+		memcpy(&replslot_info->invalidated_at, slotdata + format->invalidated_at,
+			   sizeof(XLogRecPtr));
+		if (!XLogRecPtrIsInvalid(replslot_info->invalidated_at) &&
+			XLogRecPtrIsInvalid(replslot_info->restart_lsn))
+			replslot_info->invalidated = RS_INVAL_WAL_REMOVED;
+	}
+	if (format->invalidated >= 0)
+		memcpy(&replslot_info->invalidated, slotdata + format->invalidated,
+			   sizeof(uint32));
+
+	CopyName(replslot_info->plugin, slotdata + format->plugin);
+
+	replslot_info->two_phase_at = InvalidXLogRecPtr;
+	if (format->two_phase_at >= 0)
+		memcpy(&replslot_info->two_phase_at, slotdata + format->two_phase_at,
+			   sizeof(XLogRecPtr));
+
+	replslot_info->two_phase = format->two_phase >= 0 && slotdata[format->two_phase] != 0;
+	replslot_info->synced = format->synced >= 0 && slotdata[format->synced] != 0;
+	replslot_info->failover = format->failover >= 0 && slotdata[format->failover] != 0;
+}
+
+
+/*
+ * The name pg_replication_slots.invalidation_reason gives the cause a slot
+ * was invalidated for, in the values of any release; NULL if not
+ * invalidated.
+ */
+const char *
+InvalidationCauseName(uint32 invalidated)
+{
+	switch (invalidated)
+	{
+		case RS_INVAL_NONE:
+			return NULL;
+		case RS_INVAL_WAL_REMOVED:
+			return "wal_removed";
+		case RS_INVAL_HORIZON:
+			return "rows_removed";
+		case RS_INVAL_WAL_LEVEL:
+		case RS_INVAL_WAL_LEVEL_FLAG:
+			return "wal_level_insufficient";
+		case RS_INVAL_IDLE_TIMEOUT_FLAG:
+			return "idle_timeout";
+		default:
+			return "unknown";
+	}
+}
+
+
+/*
+ * Copy a NameData field, which is not necessarily terminated if corrupt.
+ */
+static void
+CopyName(char *dest, const char *src)
+{
+	size_t		len = strnlen(src, NAMEDATALEN - 1);
+
+	memcpy(dest, src, len);
+	dest[len] = '\0';
+}
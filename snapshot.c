@@ -0,0 +1,376 @@
+/*
+ * snapshot.c
+ *
+ * Snapshots of the parsed slots, for --save and --diff.
+ *
+ * A snapshot file holds a header, recording when it was taken, followed
+ * by a fixed-size record for each slot which could be parsed.  The
+ * records are 8-byte aligned, so --diff maps the file and uses them where
+ * they lie, with a NameHash over the names in the mapping; the only work
+ * proportional to the number of slots is verifying the checksum and
+ * building the hash table.
+ *
+ * Like the cache file, a snapshot is replaced atomically and protected by
+ * a CRC-32C; unlike it, a snapshot which can't be used is an error.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "pg_replslot_reader.h"
+
+#define SNAPSHOT_MAGIC		0x52525331	/* "RRS1" */
+#define SNAPSHOT_VERSION	1
+
+typedef struct SnapshotHeader
+{
+	uint32		magic;
+	uint32		version;
+	pg_crc32c	checksum;		/* of the records */
+	uint32		slot_cnt;
+	int64		taken_at;		/* microseconds since the Unix epoch */
+} SnapshotHeader;
+
+typedef struct SnapshotRecord
+{
+	char		name[NAMEDATALEN];
+	XLogRecPtr	restart_lsn;
+	XLogRecPtr	confirmed_flush;
+	TransactionId xmin;
+	TransactionId catalog_xmin;
+	uint32		type;
+	uint32		db_oid;
+} SnapshotRecord;
+
+/*
+ * A snapshot mapped by --diff; "matched" records, for each of its slots,
+ * whether a slot from the current scan has been compared with it.
+ */
+struct Snapshot
+{
+	void	   *map;
+	size_t		map_len;
+	const SnapshotHeader *header;
+	const SnapshotRecord *records;
+	NameHash   *by_name;
+	bool	   *matched;
+};
+
+static int64 CurrentTimeMicros(void);
+static bool SlotChanged(const ReplslotDiff *diff);
+
+
+/*
+ * Write the parsed slots in "array" to a new snapshot "filename"; returns
+ * false, having reported why, on failure.
+ */
+bool
+SnapshotWrite(const char *filename, const ReplslotArray *array)
+{
+	SnapshotHeader header;
+	SnapshotRecord *records;
+	char		tmp_filename[MAXPGPATH];
+	FILE	   *fd;
+	int			i;
+
+	records = pg_malloc0(Max(array->slot_cnt, 1) * sizeof(SnapshotRecord));
+
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.slot_cnt = 0;
+	header.taken_at = CurrentTimeMicros();
+
+	for (i = 0; i < array->slot_cnt; i++)
+	{
+		const ReplslotInfo *replslot_info = &array->slots[i];
+		SnapshotRecord *record = &records[header.slot_cnt];
+
+		if (!replslot_info->slotfile_parsed)
+			continue;
+
+		strlcpy(record->name, replslot_info->name, NAMEDATALEN);
+		record->restart_lsn = replslot_info->restart_lsn;
+		record->confirmed_flush = replslot_info->confirmed_flush;
+		record->xmin = replslot_info->xmin;
+		record->catalog_xmin = replslot_info->catalog_xmin;
+		record->type = replslot_info->type;
+		record->db_oid = replslot_info->db_oid;
+
+		header.slot_cnt++;
+	}
+
+	INIT_CRC32C(header.checksum);
+	COMP_CRC32C(header.checksum, records, header.slot_cnt * sizeof(SnapshotRecord));
+	FIN_CRC32C(header.checksum);
+
+	snprintf(tmp_filename, MAXPGPATH, "%s.tmp", filename);
+
+	fd = fopen(tmp_filename, "wb");
+	if (fd == NULL)
+	{
+		fprintf(stderr, "Unable to create snapshot file \"%s\": %s\n",
+				tmp_filename, strerror(errno));
+		pg_free(records);
+		return false;
+	}
+
+	fwrite(&header, sizeof(SnapshotHeader), 1, fd);
+	fwrite(records, sizeof(SnapshotRecord), header.slot_cnt, fd);
+
+	pg_free(records);
+
+	if (ferror(fd) || fclose(fd) != 0)
+	{
+		fprintf(stderr, "Unable to write snapshot file \"%s\": %s\n",
+				tmp_filename, strerror(errno));
+		unlink(tmp_filename);
+		return false;
+	}
+
+	if (rename(tmp_filename, filename) != 0)
+	{
+		fprintf(stderr, "Unable to rename snapshot file \"%s\" to \"%s\": %s\n",
+				tmp_filename, filename, strerror(errno));
+		unlink(tmp_filename);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Map the snapshot "filename" and index its slots by name; returns NULL,
+ * having reported why, if it can't be used.
+ */
+Snapshot *
+SnapshotOpen(const char *filename)
+{
+	Snapshot   *snapshot;
+	const SnapshotHeader *header;
+	const SnapshotRecord *records;
+	struct stat statbuf;
+	pg_crc32c	checksum;
+	void	   *map;
+	int			fd;
+	uint32		i;
+
+	fd = open(filename, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Unable to open snapshot file \"%s\": %s\n",
+				filename, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &statbuf) != 0)
+	{
+		fprintf(stderr, "Unable to stat snapshot file \"%s\": %s\n",
+				filename, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if ((size_t) statbuf.st_size < sizeof(SnapshotHeader))
+	{
+		fprintf(stderr, "Snapshot file \"%s\" is truncated\n", filename);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+	{
+		fprintf(stderr, "Unable to map snapshot file \"%s\": %s\n",
+				filename, strerror(errno));
+		return NULL;
+	}
+
+	header = (const SnapshotHeader *) map;
+	records = (const SnapshotRecord *) ((const char *) map + sizeof(SnapshotHeader));
+
+	if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION)
+	{
+		fprintf(stderr, "File \"%s\" is not a snapshot written by this version of pg_replslot_reader\n",
+				filename);
+		munmap(map, statbuf.st_size);
+		return NULL;
+	}
+
+	if ((size_t) statbuf.st_size !=
+		sizeof(SnapshotHeader) + (size_t) header->slot_cnt * sizeof(SnapshotRecord))
+	{
+		fprintf(stderr, "Snapshot file \"%s\" has the wrong size for %u slot(s)\n",
+				filename, header->slot_cnt);
+		munmap(map, statbuf.st_size);
+		return NULL;
+	}
+
+	INIT_CRC32C(checksum);
+	COMP_CRC32C(checksum, records, header->slot_cnt * sizeof(SnapshotRecord));
+	FIN_CRC32C(checksum);
+
+	if (!EQ_CRC32C(checksum, header->checksum))
+	{
+		fprintf(stderr, "Checksum mismatch in snapshot file \"%s\"\n", filename);
+		munmap(map, statbuf.st_size);
+		return NULL;
+	}
+
+	snapshot = pg_malloc(sizeof(Snapshot));
+	snapshot->map = map;
+	snapshot->map_len = statbuf.st_size;
+	snapshot->header = header;
+	snapshot->records = records;
+	snapshot->by_name = NameHashCreate(header->slot_cnt);
+	snapshot->matched = pg_malloc0(Max(header->slot_cnt, 1) * sizeof(bool));
+
+	/* the names are used as keys where they lie in the mapping */
+	for (i = 0; i < header->slot_cnt; i++)
+	{
+		if (memchr(records[i].name, '\0', NAMEDATALEN) == NULL)
+			continue;
+
+		NameHashInsert(snapshot->by_name, records[i].name, i);
+	}
+
+	return snapshot;
+}
+
+
+/*
+ * Output the slots which differ between "snapshot" and the slots in
+ * "array": those created since or whose positions or horizons have moved,
+ * in the order of "array", followed by those dropped since.  Slots which can't currently be parsed
+ * can't be compared, so are neither reported nor treated as dropped.
+ */
+void
+SnapshotDiff(Snapshot *snapshot, const ReplslotArray *array)
+{
+	ReplslotDiff *diffs;
+	int			diff_cnt = 0;
+	double		elapsed;
+	uint32		i;
+
+	diffs = pg_malloc(Max(array->slot_cnt + snapshot->header->slot_cnt, 1) *
+					  sizeof(ReplslotDiff));
+
+	for (i = 0; i < array->slot_cnt; i++)
+	{
+		const ReplslotInfo *replslot_info = &array->slots[i];
+		ReplslotDiff *diff = &diffs[diff_cnt];
+		int			record_num = NameHashLookup(snapshot->by_name, replslot_info->name);
+
+		if (record_num >= 0)
+			snapshot->matched[record_num] = true;
+
+		if (!replslot_info->slotfile_parsed)
+			continue;
+
+		diff->name = replslot_info->name;
+		diff->type = replslot_info->type;
+		diff->restart_lsn = replslot_info->restart_lsn;
+		diff->confirmed_flush = replslot_info->confirmed_flush;
+		diff->xmin = replslot_info->xmin;
+		diff->catalog_xmin = replslot_info->catalog_xmin;
+
+		if (record_num < 0)
+		{
+			diff->change = SLOT_CREATED;
+			diff->old_restart_lsn = InvalidXLogRecPtr;
+			diff->old_confirmed_flush = InvalidXLogRecPtr;
+			diff->old_xmin = InvalidTransactionId;
+			diff->old_catalog_xmin = InvalidTransactionId;
+		}
+		else
+		{
+			const SnapshotRecord *record = &snapshot->records[record_num];
+
+			diff->change = SLOT_CHANGED;
+			diff->old_restart_lsn = record->restart_lsn;
+			diff->old_confirmed_flush = record->confirmed_flush;
+			diff->old_xmin = record->xmin;
+			diff->old_catalog_xmin = record->catalog_xmin;
+
+			if (!SlotChanged(diff))
+				continue;
+		}
+
+		diff_cnt++;
+	}
+
+	for (i = 0; i < snapshot->header->slot_cnt; i++)
+	{
+		const SnapshotRecord *record = &snapshot->records[i];
+		ReplslotDiff *diff = &diffs[diff_cnt];
+
+		if (snapshot->matched[i] || memchr(record->name, '\0', NAMEDATALEN) == NULL)
+			continue;
+
+		diff->change = SLOT_DROPPED;
+		diff->name = record->name;
+		diff->type = (ReplicationSlotType) record->type;
+		diff->old_restart_lsn = record->restart_lsn;
+		diff->old_confirmed_flush = record->confirmed_flush;
+		diff->old_xmin = record->xmin;
+		diff->old_catalog_xmin = record->catalog_xmin;
+		diff->restart_lsn = InvalidXLogRecPtr;
+		diff->confirmed_flush = InvalidXLogRecPtr;
+		diff->xmin = InvalidTransactionId;
+		diff->catalog_xmin = InvalidTransactionId;
+
+		diff_cnt++;
+	}
+
+	elapsed = (double) (CurrentTimeMicros() - snapshot->header->taken_at) / 1000000.0;
+
+	OutputDiffBegin(diff_cnt, elapsed);
+
+	for (i = 0; i < diff_cnt; i++)
+		OutputDiff(&diffs[i]);
+
+	OutputEnd();
+
+	pg_free(diffs);
+}
+
+
+void
+SnapshotClose(Snapshot *snapshot)
+{
+	NameHashFree(snapshot->by_name);
+	munmap(snapshot->map, snapshot->map_len);
+	pg_free(snapshot->matched);
+	pg_free(snapshot);
+}
+
+
+static int64
+CurrentTimeMicros(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (int64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static bool
+SlotChanged(const ReplslotDiff *diff)
+{
+	return diff->restart_lsn != diff->old_restart_lsn ||
+		diff->confirmed_flush != diff->old_confirmed_flush ||
+		diff->xmin != diff->old_xmin ||
+		diff->catalog_xmin != diff->old_catalog_xmin;
+}
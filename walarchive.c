@@ -0,0 +1,362 @@
+/*
+ * walarchive.c
+ *
+ * Index of the WAL segments in a WAL archive, for --wal-archive, to tell
+ * whether the segment each slot requires could still be restored once it
+ * has been removed from pg_wal.
+ *
+ * The archive is either a directory, which is searched recursively, as
+ * tools such as barman and pgBackRest keep segments in subdirectories, or
+ * an S3 prefix given as s3://BUCKET/PREFIX.  An S3 prefix is listed with
+ * the AWS CLI's list-objects-v2, which fetches S3_LIST_PAGE_SIZE keys per
+ * request, following the continuation token from one page to the next,
+ * and writes each page out as it arrives; the keys are read as they come
+ * rather than the listing being held in memory.
+ *
+ * Archived segments are often compressed, or renamed with a checksum, so
+ * any file whose name begins with a segment file name is taken to be that
+ * segment, other than partial segments and backup history files.  As the
+ * sizes of such files say nothing of the segment size, that of the data
+ * directory's WAL is assumed.  The archive is listed once, into a
+ * WalSegmentIndex, which is then binary-searched for each slot.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "pg_replslot_reader.h"
+
+/* keys fetched per ListObjectsV2 request; 1000 is the most S3 returns */
+#define S3_LIST_PAGE_SIZE	1000
+
+/* how deep to look for segments below the archive directory */
+#define MAX_ARCHIVE_DEPTH	8
+
+typedef struct ArchiveNames
+{
+	char	  **names;
+	int			names_cnt;
+	int			names_size;
+} ArchiveNames;
+
+static bool ScanArchiveDir(const char *path, int depth, ArchiveNames *names);
+static bool ListS3Archive(const char *url, const char *s3_command, ArchiveNames *names);
+static void AddArchivedName(ArchiveNames *names, const char *name, size_t len);
+
+
+/*
+ * Index the segments in the WAL archive "archive", a directory or an S3
+ * URL, taking them to be "segment_size" bytes long.  Returns NULL, having
+ * reported why, if the archive can't be listed.
+ */
+WalSegmentIndex *
+ScanWalArchive(const char *archive, uint32 segment_size, const char *s3_command)
+{
+	ArchiveNames names;
+	bool		ok;
+	int			i;
+
+	names.names_cnt = 0;
+	names.names_size = 256;
+	names.names = pg_malloc(names.names_size * sizeof(char *));
+
+	if (strncmp(archive, "s3://", 5) == 0)
+		ok = ListS3Archive(archive, s3_command, &names);
+	else
+		ok = ScanArchiveDir(archive, 0, &names);
+
+	if (!ok)
+	{
+		for (i = 0; i < names.names_cnt; i++)
+			pg_free(names.names[i]);
+		pg_free(names.names);
+		return NULL;
+	}
+
+	return BuildWalSegmentIndex(names.names, names.names_cnt, segment_size);
+}
+
+
+/*
+ * Work out whether the segment containing a slot's restart_lsn is in the
+ * archive, and the name it has (or would have, on the newest timeline
+ * archived).
+ */
+void
+CalcWalArchive(const WalSegmentIndex *index, ReplslotInfo *replslot_info)
+{
+	XLogSegNo	segno;
+	int			pos;
+	int			i;
+
+	replslot_info->wal_archive_known = true;
+	replslot_info->wal_archive_missing = false;
+	*replslot_info->archive_wal_segment = '\0';
+
+	/* a slot which hasn't reserved WAL doesn't require any */
+	if (XLogRecPtrIsInvalid(replslot_info->restart_lsn))
+		return;
+
+	segno = replslot_info->restart_lsn / index->segment_size;
+	pos = WalSegmentIndexLookup(index, segno);
+
+	if (pos == index->segment_cnt || index->segments[pos].segno != segno)
+	{
+		replslot_info->wal_archive_missing = true;
+		FormatWalSegmentName(replslot_info->archive_wal_segment,
+							 index->segment_cnt > 0 ?
+							 index->segments[index->segment_cnt - 1].tli : 1,
+							 segno, index->segment_size);
+		return;
+	}
+
+	/* as in CalcWalRetention(), the latest timeline's segment is used */
+	for (i = pos; i + 1 < index->segment_cnt && index->segments[i + 1].segno == segno; i++)
+		;
+
+	FormatWalSegmentName(replslot_info->archive_wal_segment,
+						 index->segments[i].tli, segno, index->segment_size);
+}
+
+
+/*
+ * Collect the segments in the archive directory "path" and those below it.
+ */
+static bool
+ScanArchiveDir(const char *path, int depth, ArchiveNames *names)
+{
+	DIR		   *dir;
+	struct dirent *de;
+
+	dir = opendir(path);
+	if (dir == NULL)
+	{
+		fprintf(stderr, "Unable to open WAL archive directory \"%s\": %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	while ((de = readdir(dir)) != NULL)
+	{
+		bool		is_dir = de->d_type == DT_DIR;
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		if (de->d_type == DT_UNKNOWN || de->d_type == DT_LNK)
+		{
+			struct stat statbuf;
+
+			if (fstatat(dirfd(dir), de->d_name, &statbuf, 0) != 0)
+				continue;
+
+			is_dir = S_ISDIR(statbuf.st_mode);
+		}
+
+		if (is_dir)
+		{
+			char		subdir[MAXPGPATH];
+
+			if (depth + 1 >= MAX_ARCHIVE_DEPTH ||
+				snprintf(subdir, MAXPGPATH, "%s/%s", path, de->d_name) >= MAXPGPATH)
+				continue;
+
+			if (!ScanArchiveDir(subdir, depth + 1, names))
+			{
+				closedir(dir);
+				return false;
+			}
+			continue;
+		}
+
+		AddArchivedName(names, de->d_name, strlen(de->d_name));
+	}
+
+	closedir(dir);
+
+	return true;
+}
+
+
+/*
+ * Collect the segments under the S3 URL "url", reading the keys listed by
+ * "s3_command" one per line.
+ */
+static bool
+ListS3Archive(const char *url, const char *s3_command, ArchiveNames *names)
+{
+	const char *bucket = url + strlen("s3://");
+	const char *prefix = strchr(bucket, '/');
+	PQExpBufferData command;
+	char		buf[65536];
+	size_t		len = 0;
+	bool		ok = true;
+	pid_t		pid;
+	int			fd;
+	int			status;
+
+	initPQExpBuffer(&command);
+	appendPQExpBuffer(&command, "%s list-objects-v2 --bucket ", s3_command);
+	if (prefix != NULL)
+	{
+		char	   *bucket_name = pg_malloc(prefix - bucket + 1);
+
+		memcpy(bucket_name, bucket, prefix - bucket);
+		bucket_name[prefix - bucket] = '\0';
+		AppendShellQuoted(&command, bucket_name);
+		pg_free(bucket_name);
+
+		prefix++;
+		if (*prefix != '\0')
+		{
+			appendPQExpBufferStr(&command, " --prefix ");
+			AppendShellQuoted(&command, prefix);
+		}
+	}
+	else
+		AppendShellQuoted(&command, bucket);
+	appendPQExpBuffer(&command, " --page-size %i --query 'Contents[].[Key]' --output text",
+					  S3_LIST_PAGE_SIZE);
+
+	pid = SpawnCommand(command.data, &fd);
+
+	termPQExpBuffer(&command);
+
+	if (pid < 0)
+	{
+		fprintf(stderr, "Unable to list WAL archive \"%s\": %s\n", url, strerror(errno));
+		return false;
+	}
+
+	for (;;)
+	{
+		ssize_t		ret = read(fd, buf + len, sizeof(buf) - len);
+		size_t		start = 0;
+		char	   *eol;
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0)
+		{
+			fprintf(stderr, "Unable to read the listing of WAL archive \"%s\": %s\n",
+					url, strerror(errno));
+			ok = false;
+			break;
+		}
+
+		/* the last key may lack a newline */
+		if (ret == 0)
+		{
+			if (len > 0)
+				buf[len++] = '\n';
+			else
+				break;
+		}
+		else
+			len += ret;
+
+		while ((eol = memchr(buf + start, '\n', len - start)) != NULL)
+		{
+			const char *key = buf + start;
+			size_t		key_len = eol - key;
+			const char *base;
+
+			if (key_len > 0 && key[key_len - 1] == '\r')
+				key_len--;
+
+			/* only the last component of the key is the file's name */
+			for (base = key + key_len; base > key && base[-1] != '/'; base--)
+				;
+
+			AddArchivedName(names, base, key_len - (base - key));
+
+			start = eol - buf + 1;
+		}
+
+		/* keys are at most 1024 bytes, so this is never a key */
+		if (start == 0 && len == sizeof(buf))
+			len = 0;
+
+		memmove(buf, buf + start, len - start);
+		len -= start;
+
+		if (ret == 0)
+			break;
+	}
+
+	close(fd);
+
+	while (waitpid(pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			status = -1;
+			break;
+		}
+	}
+
+	if (status != 0)
+	{
+		if (WIFEXITED(status))
+			fprintf(stderr, "The command listing WAL archive \"%s\" exited with status %i\n",
+					url, WEXITSTATUS(status));
+		else
+			fprintf(stderr, "The command listing WAL archive \"%s\" was terminated abnormally\n",
+					url);
+		ok = false;
+	}
+
+	return ok;
+}
+
+
+/*
+ * Add the segment an archived file's name, of "len" bytes, is for, if it
+ * is for one: a segment file name followed by nothing, or by a '.' or '-'
+ * and some suffix, e.g. ".gz" or "-<checksum>.zst", so long as it isn't
+ * a partial segment or a backup history file.
+ */
+static void
+AddArchivedName(ArchiveNames *names, const char *name, size_t len)
+{
+	char		suffix[MAXPGPATH];
+	char	   *segment;
+
+	if (len < WAL_SEGMENT_NAME_LEN ||
+		strspn(name, "0123456789ABCDEF") < WAL_SEGMENT_NAME_LEN)
+		return;
+
+	if (len > WAL_SEGMENT_NAME_LEN)
+	{
+		if (name[WAL_SEGMENT_NAME_LEN] != '.' && name[WAL_SEGMENT_NAME_LEN] != '-')
+			return;
+
+		if (len - WAL_SEGMENT_NAME_LEN >= sizeof(suffix))
+			return;
+
+		memcpy(suffix, name + WAL_SEGMENT_NAME_LEN, len - WAL_SEGMENT_NAME_LEN);
+		suffix[len - WAL_SEGMENT_NAME_LEN] = '\0';
+
+		if (strstr(suffix, ".partial") != NULL || strstr(suffix, ".backup") != NULL)
+			return;
+	}
+
+	if (names->names_cnt == names->names_size)
+	{
+		names->names_size *= 2;
+		names->names = pg_realloc(names->names, names->names_size * sizeof(char *));
+	}
+
+	segment = pg_malloc(WAL_SEGMENT_NAME_LEN + 1);
+	memcpy(segment, name, WAL_SEGMENT_NAME_LEN);
+	segment[WAL_SEGMENT_NAME_LEN] = '\0';
+
+	names->names[names->names_cnt++] = segment;
+}
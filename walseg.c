@@ -0,0 +1,418 @@
+/*
+ * walseg.c
+ *
+ * Index of the WAL segment files present in a directory, used to
+ * determine how much WAL each replication slot is holding back.
+ *
+ * The directory is read once, with segment file names parsed into
+ * (timeline, segment number) pairs and sorted, so finding the segments
+ * a slot requires is a binary search however many there are.
+ *
+ * Portions Copyright (c) 2012-2016, PostgreSQL Global Development Group
+ *
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pg_replslot_reader.h"
+
+/* offsetof(XLogPageHeaderData, xlp_pageaddr) */
+#define XLP_PAGEADDR_OFFSET		8
+
+static bool IsFutureSegment(const char *wal_dir, const WalSegment *segment,
+							uint32 segment_size);
+static void CountDistinctSegments(WalSegmentIndex *index);
+static int	WalSegmentCmp(const void *a, const void *b);
+
+
+/*
+ * Parse the name of a WAL segment file, e.g. "000000010000000A000000FF",
+ * into its timeline and segment number.  Returns false if "name" is not
+ * a segment file name (partial segments, history and backup label files
+ * are not segments).
+ *
+ * See XLogFromFileName() in src/include/access/xlog_internal.h
+ */
+bool
+ParseWalSegmentName(const char *name, uint32 segment_size,
+					TimeLineID *tli, XLogSegNo *segno)
+{
+	uint32		log;
+	uint32		seg;
+	int			i;
+
+	for (i = 0; i < WAL_SEGMENT_NAME_LEN; i++)
+	{
+		if (!isxdigit((unsigned char) name[i]))
+			return false;
+	}
+
+	if (name[WAL_SEGMENT_NAME_LEN] != '\0')
+		return false;
+
+	if (sscanf(name, "%08X%08X%08X", tli, &log, &seg) != 3)
+		return false;
+
+	if (seg >= WalSegmentsPerXLogId(segment_size))
+		return false;
+
+	*segno = (uint64) log * WalSegmentsPerXLogId(segment_size) + seg;
+
+	return true;
+}
+
+
+/*
+ * See XLogFileName() in src/include/access/xlog_internal.h
+ */
+void
+FormatWalSegmentName(char *buf, TimeLineID tli, XLogSegNo segno,
+					 uint32 segment_size)
+{
+	snprintf(buf, WAL_SEGMENT_NAME_LEN + 1, "%08X%08X%08X",
+			 tli,
+			 (uint32) (segno / WalSegmentsPerXLogId(segment_size)),
+			 (uint32) (segno % WalSegmentsPerXLogId(segment_size)));
+}
+
+
+/*
+ * Read the WAL segment size the cluster in "datadir" was initialised with
+ * from its global/pg_control.  Returns 0, having reported why, if it
+ * can't be read.
+ *
+ * As ControlFileData's layout changes between releases, rather than the
+ * field being read at an offset particular to each, floatFormat, which
+ * precedes it in every release, is looked for at each offset it could
+ * have been aligned to.
+ */
+uint32
+ReadWalSegmentSize(const char *datadir)
+{
+	char		path[MAXPGPATH];
+	char		buf[CONTROL_READ_SIZE];
+	ssize_t		len;
+	int			fd;
+	int			offset;
+
+	snprintf(path, MAXPGPATH, "%s/global/pg_control", datadir);
+
+	fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Unable to open file \"%s\": %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	len = read(fd, buf, sizeof(buf));
+	if (len < 0)
+	{
+		fprintf(stderr, "Unable to read file \"%s\": %s\n", path, strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	close(fd);
+
+	for (offset = 0; offset + (ssize_t) sizeof(ControlFileSizes) <= len;
+		 offset += sizeof(double))
+	{
+		ControlFileSizes sizes;
+
+		memcpy(&sizes, buf + offset, sizeof(ControlFileSizes));
+
+		if (sizes.floatFormat != CONTROL_FLOAT_FORMAT)
+			continue;
+
+		if (!IsValidWalSegmentSize(sizes.xlog_seg_size))
+		{
+			fprintf(stderr, "Invalid WAL segment size %u in file \"%s\"\n",
+					sizes.xlog_seg_size, path);
+			return 0;
+		}
+
+		return sizes.xlog_seg_size;
+	}
+
+	fprintf(stderr, "Unable to find the WAL segment size in file \"%s\"\n", path);
+
+	return 0;
+}
+
+
+/*
+ * Build an index of the WAL segment files in "wal_dir", of "segment_size"
+ * bytes each.  Returns NULL, having reported why, if the directory can't
+ * be read.
+ *
+ * Only the segments up to the one being written to are indexed, and so
+ * counted as retained; past it, pg_wal holds segments recycled ahead of
+ * use, or preallocated, which no slot holds back.
+ */
+WalSegmentIndex *
+ScanWalSegments(const char *wal_dir, uint32 segment_size)
+{
+	WalSegmentIndex *index;
+	DIR		   *dir;
+	struct dirent *de;
+	char	  **names;
+	int			names_cnt = 0;
+	int			names_size = 256;
+
+	dir = opendir(wal_dir);
+	if (dir == NULL)
+	{
+		fprintf(stderr, "Unable to open directory \"%s\": %s\n", wal_dir, strerror(errno));
+		return NULL;
+	}
+
+	names = pg_malloc(names_size * sizeof(char *));
+
+	while ((de = readdir(dir)) != NULL)
+	{
+		if (strlen(de->d_name) != WAL_SEGMENT_NAME_LEN ||
+			strspn(de->d_name, "0123456789ABCDEF") != WAL_SEGMENT_NAME_LEN)
+			continue;
+
+		if (names_cnt == names_size)
+		{
+			names_size *= 2;
+			names = pg_realloc(names, names_size * sizeof(char *));
+		}
+
+		names[names_cnt++] = pg_strdup(de->d_name);
+	}
+
+	closedir(dir);
+
+	index = BuildWalSegmentIndex(names, names_cnt, segment_size);
+
+	/*
+	 * The segments to be dropped are the newest, so they are checked from
+	 * the newest down, until one which has been written to is found.
+	 */
+	if (index->segment_cnt > 0 &&
+		IsFutureSegment(wal_dir, &index->segments[index->segment_cnt - 1], segment_size))
+	{
+		do
+			index->segment_cnt--;
+		while (index->segment_cnt > 0 &&
+			   IsFutureSegment(wal_dir, &index->segments[index->segment_cnt - 1],
+							   segment_size));
+
+		CountDistinctSegments(index);
+	}
+
+	return index;
+}
+
+
+/*
+ * Whether the segment file for "segment" in "wal_dir" is yet to be written
+ * to: a recycled segment still holds the pages of the segment it was, and
+ * a preallocated one zeroes, so the address in its first page's header is
+ * not its own.  The segment being written to is taken to be one too if its
+ * first page hasn't reached the file yet, though at most that one segment
+ * goes uncounted.  A file which can't be read is assumed to be in use.
+ *
+ * See XLogPageHeaderData in src/include/access/xlog_internal.h; its
+ * xlp_pageaddr is at the same offset in every release with slots.
+ */
+static bool
+IsFutureSegment(const char *wal_dir, const WalSegment *segment, uint32 segment_size)
+{
+	char		path[MAXPGPATH];
+	char		name[WAL_SEGMENT_NAME_LEN + 1];
+	char		header[XLP_PAGEADDR_OFFSET + sizeof(XLogRecPtr)];
+	XLogRecPtr	pageaddr;
+	int			fd;
+	ssize_t		len;
+
+	FormatWalSegmentName(name, segment->tli, segment->segno, segment_size);
+	snprintf(path, MAXPGPATH, "%s/%s", wal_dir, name);
+
+	fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+		return false;
+
+	len = read(fd, header, sizeof(header));
+	close(fd);
+
+	if (len != sizeof(header))
+		return len == 0;
+
+	memcpy(&pageaddr, header + XLP_PAGEADDR_OFFSET, sizeof(XLogRecPtr));
+
+	return pageaddr != segment->segno * segment_size;
+}
+
+
+/*
+ * Build an index of the segments whose file names are in "names", which
+ * are freed, together with the array, along with any which aren't segment
+ * file names.
+ */
+WalSegmentIndex *
+BuildWalSegmentIndex(char **names, int names_cnt, uint32 segment_size)
+{
+	WalSegmentIndex *index;
+	int			i;
+
+	index = pg_malloc0(sizeof(WalSegmentIndex));
+	index->segment_size = segment_size;
+	index->segments = pg_malloc(Max(names_cnt, 1) * sizeof(WalSegment));
+
+	for (i = 0; i < names_cnt; i++)
+	{
+		WalSegment *segment = &index->segments[index->segment_cnt];
+
+		if (ParseWalSegmentName(names[i], index->segment_size,
+								&segment->tli, &segment->segno))
+			index->segment_cnt++;
+
+		pg_free(names[i]);
+	}
+
+	pg_free(names);
+
+	qsort(index->segments, index->segment_cnt, sizeof(WalSegment), WalSegmentCmp);
+
+	CountDistinctSegments(index);
+
+	return index;
+}
+
+
+/*
+ * Set the index's distinct_cnt, for the retained byte count, in which
+ * each segment number counts only once.
+ */
+static void
+CountDistinctSegments(WalSegmentIndex *index)
+{
+	int			i;
+
+	if (index->distinct_cnt != NULL)
+		pg_free(index->distinct_cnt);
+	index->distinct_cnt = pg_malloc(Max(index->segment_cnt, 1) * sizeof(int));
+
+	for (i = index->segment_cnt - 1; i >= 0; i--)
+	{
+		if (i == index->segment_cnt - 1)
+			index->distinct_cnt[i] = 1;
+		else if (index->segments[i].segno == index->segments[i + 1].segno)
+			index->distinct_cnt[i] = index->distinct_cnt[i + 1];
+		else
+			index->distinct_cnt[i] = index->distinct_cnt[i + 1] + 1;
+	}
+}
+
+
+void
+FreeWalSegmentIndex(WalSegmentIndex *index)
+{
+	pg_free(index->segments);
+	pg_free(index->distinct_cnt);
+	pg_free(index);
+}
+
+
+/*
+ * Return the position of the first segment with a segment number of at
+ * least "segno", or segment_cnt if there is none.
+ */
+int
+WalSegmentIndexLookup(const WalSegmentIndex *index, XLogSegNo segno)
+{
+	int			low = 0;
+	int			high = index->segment_cnt;
+
+	while (low < high)
+	{
+		int			mid = low + (high - low) / 2;
+
+		if (index->segments[mid].segno < segno)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+
+/*
+ * Work out how much of the indexed WAL is retained on behalf of a slot,
+ * i.e. the segments from the one containing its restart_lsn onwards, and
+ * which segment is the oldest it requires.
+ */
+void
+CalcWalRetention(const WalSegmentIndex *index, ReplslotInfo *replslot_info)
+{
+	XLogSegNo	segno;
+	int			pos;
+	int			i;
+
+	replslot_info->wal_retention_known = true;
+	replslot_info->wal_retained_bytes = 0;
+	replslot_info->wal_retained_segments = 0;
+	replslot_info->wal_segment_missing = false;
+	*replslot_info->oldest_wal_segment = '\0';
+
+	/* a slot which hasn't reserved WAL doesn't hold any back */
+	if (XLogRecPtrIsInvalid(replslot_info->restart_lsn))
+		return;
+
+	segno = replslot_info->restart_lsn / index->segment_size;
+	pos = WalSegmentIndexLookup(index, segno);
+
+	if (pos < index->segment_cnt)
+	{
+		replslot_info->wal_retained_segments = index->distinct_cnt[pos];
+		replslot_info->wal_retained_bytes =
+			(uint64) index->distinct_cnt[pos] * index->segment_size;
+	}
+
+	if (pos == index->segment_cnt || index->segments[pos].segno != segno)
+	{
+		/* the segment the slot needs has already been removed */
+		replslot_info->wal_segment_missing = true;
+
+		/* report the name it would have on the newest known timeline */
+		FormatWalSegmentName(replslot_info->oldest_wal_segment,
+							 index->segment_cnt > 0 ?
+							 index->segments[index->segment_cnt - 1].tli : 1,
+							 segno, index->segment_size);
+		return;
+	}
+
+	/*
+	 * After a timeline switch the same segment may exist on several
+	 * timelines; the one on the latest timeline is the one that's used.
+	 */
+	for (i = pos; i + 1 < index->segment_cnt && index->segments[i + 1].segno == segno; i++)
+		;
+
+	FormatWalSegmentName(replslot_info->oldest_wal_segment,
+						 index->segments[i].tli, segno, index->segment_size);
+}
+
+
+static int
+WalSegmentCmp(const void *a, const void *b)
+{
+	const WalSegment *sa = (const WalSegment *) a;
+	const WalSegment *sb = (const WalSegment *) b;
+
+	if (sa->segno != sb->segno)
+		return sa->segno < sb->segno ? -1 : 1;
+
+	if (sa->tli != sb->tli)
+		return sa->tli < sb->tli ? -1 : 1;
+
+	return 0;
+}